@@ -1,18 +1,35 @@
 #!/bin/bash
 
+# TLVD=1 ./runner.sh serves the radar and the sensor board from a single
+# process (tlvd) instead of running radar and sensor side by side
+#
+# INPROC=1 ./runner.sh is for a smartscope built with make INPROC=1, it
+# runs the parsers itself
+
 cd tlv-processor
-if pgrep -x "sensor" > /dev/null; then
-    echo "Already running sensor!"
+if [ "$INPROC" == "1" ]; then
+  echo "Parsers run inside smartscope"
+elif [ "$TLVD" == "1" ]; then
+  if pgrep -x "tlvd" > /dev/null; then
+      echo "Already running tlvd!"
+  else
+      echo "Starting tlvd program!"
+      ./tlvd > tlvd_log &
+  fi
 else
-    echo "Starting sensor program!"
-    ./sensor > sensor_log &
-fi
+  if pgrep -x "sensor" > /dev/null; then
+      echo "Already running sensor!"
+  else
+      echo "Starting sensor program!"
+      ./sensor > sensor_log &
+  fi
 
-if pgrep -x "radar" > /dev/null; then
-    echo "Already running radar!"
-else
-    echo "Starting radar program!"
-    ./radar > radar_log & 
+  if pgrep -x "radar" > /dev/null; then
+      echo "Already running radar!"
+  else
+      echo "Starting radar program!"
+      ./radar > radar_log & 
+  fi
 fi
 
 cd ..
@@ -7,11 +7,13 @@
 #include <pthread.h>
 #include <errno.h>
 #include <math.h>
+#include <limits.h>
 #include <sys/time.h>
 
 #include "gstnvdsmeta.h"
 #include "sensor_board_tlv.h"
 #include "radar_tlv.h"
+#include "seqlock.h"
 #include "radar.h"
 #include "mq.h"
 #include "algo.h"
@@ -19,17 +21,19 @@
 #include "time.h"
 #include "imu.h"
 #include "interpolate.h"
+#include "reactor.h"
 
-static mqd_t radar_calibrated_mq;
+static shm_mailbox radar_calibrated_mailbox;
 static mqd_t inference_output_mq; 
-static mqd_t crosshair_input_mq; 
+static shm_mailbox crosshair_mailbox;
+static mq_topic crosshair_topic;
 
-static pthread_t aiming_th, distance_th;
-static pthread_mutex_t distance_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t algo_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t distance_th;
+static int aim_timer;
 
 static void *distance_thread(void*);
-static void *aiming_thread(void*);
+static void on_inference(int);
+static void on_aim_deadline(int);
 static void find_centeroid(char*);
 static void filter_outliers(char*, char*, point_cartesian_t*, int*);
 static aim_sm_curr_state_e get_state(void);
@@ -38,38 +42,38 @@ static void draw_crosshair(context_t*);
 static sm_t aim_sm_transition(context_t*);
 static sm_t aim_sm_lock(context_t*);
 
-static int check_if_inference_is_centered(context_t*);
+static int check_if_inference_is_centered(const inference_detected_t*, context_t*);
 static void set_ctx_entery_track_state(context_t*);
 
-static float calculated_distance;
-static aim_sm_curr_state_e curr_state;
-static overlay_info_t overlay_info;
+// What the OSD probe draws every frame. Each is written by one thread
+// (distance by distance_thread, the rest by the reactor thread) and read
+// without waiting on it, see seqlock.h.
+typedef struct{
+  aim_sm_curr_state_e state;
+  overlay_info_t      overlay;
+} aim_display_t;
 
-float get_distance(){
-  float distance;
+static SEQLOCK_SNAPSHOT(float) calculated_distance;
+static SEQLOCK_SNAPSHOT(aim_display_t) aim_display;
 
-  pthread_mutex_lock(&distance_mutex);
-  distance = calculated_distance;
-  pthread_mutex_unlock(&distance_mutex);
+static aim_display_t get_aim_display(){
+  aim_display_t display;
+  SEQLOCK_LOAD(&aim_display, display);
+  return display;
+}
 
+float get_distance(){
+  float distance;
+  SEQLOCK_LOAD(&calculated_distance, distance);
   return distance;
 }
 
 float get_angular_trained_angular_velocity(){
-  float ret;  
-  pthread_mutex_lock(&algo_mutex);
-  ret = overlay_info.angular_velocity;
-  pthread_mutex_unlock(&algo_mutex);  
-  return ret;
+  return get_aim_display().overlay.angular_velocity;
 }
 
 float get_angular_trained_distance(){
-  float ret;  
-  pthread_mutex_lock(&algo_mutex);
-  ret = overlay_info.calculated_distance;
-  pthread_mutex_unlock(&algo_mutex);
-  
-  return ret;
+  return get_aim_display().overlay.calculated_distance;
 }
 
 bool state_request_progress_bar(){
@@ -91,11 +95,7 @@ bool state_request_corrected_crosshair(){
 }
 
 progress_bar_t get_lock_progress_bar(){
-  progress_bar_t prog; 
-  pthread_mutex_lock(&algo_mutex);
-  prog = overlay_info.prog;
-  pthread_mutex_unlock(&algo_mutex);
-  return prog;
+  return get_aim_display().overlay.prog;
 }
 
 bool state_request_bounding_hashes(){
@@ -125,45 +125,44 @@ bool state_request_simple_crosshair(){
 }
 
 void get_overlay_text(char *const dst, int *x_offset){
-  pthread_mutex_lock(&algo_mutex);
-  strncpy(dst, overlay_info.overlay_str, MAX_DISPLAY_LEN);
-  *x_offset = overlay_info.overlay_x_offset;
-  pthread_mutex_unlock(&algo_mutex);
+  aim_display_t display = get_aim_display();
+  strncpy(dst, display.overlay.overlay_str, MAX_DISPLAY_LEN);
+  *x_offset = display.overlay.overlay_x_offset;
 }
 
 static void open_radar_mq(){
-  radar_calibrated_mq = open_mq(RADAR_CALIBRATED_MQ_PATH, O_RDONLY | O_CREAT | O_NONBLOCK);
+  open_mailbox(&radar_calibrated_mailbox, RADAR_CALIBRATED_MAILBOX_PATH, sizeof(cartesian_point_cloud_and_meta_t));
+  subscribe_topic(RADAR_CALIBRATED_MAILBOX_PATH, MQ_TOPIC_MAILBOX);
   inference_output_mq = open_mq(MESSAGE_QUEUE_OUTPUT_INF, O_RDONLY | O_CREAT | O_NONBLOCK);
-  crosshair_input_mq  = open_mq(MESSAGE_QUEUE_CROSS,      O_WRONLY | O_CREAT | O_NONBLOCK);  
+  open_mailbox(&crosshair_mailbox, MAILBOX_CROSS, sizeof(aim_overlay_t));
+  crosshair_topic = publish_topic(MAILBOX_CROSS, MQ_TOPIC_MAILBOX);
 }
 
 static aim_sm_curr_state_e get_state(){
-  aim_sm_curr_state_e state;  
-  pthread_mutex_lock(&algo_mutex);
-  state = curr_state;
-  pthread_mutex_unlock(&algo_mutex);
-  return state;
+  return get_aim_display().state;
 }
 
+// Setters run on the reactor thread only, the one writer of aim_display,
+// so they can start from aim_display.value as it is
 static void set_state(aim_sm_curr_state_e state){
-  pthread_mutex_lock(&algo_mutex);
-  curr_state = state;
-  pthread_mutex_unlock(&algo_mutex);
+  aim_display_t display = aim_display.value;
+  display.state = state;
+  SEQLOCK_PUBLISH(&aim_display, display);
 }
 
 static void set_angular_velocity_plus_distance(const float angular_velocity, const float distance){
-  pthread_mutex_lock(&algo_mutex);
-  overlay_info.angular_velocity  = angular_velocity;
-  overlay_info.calculated_distance = distance;
-  pthread_mutex_unlock(&algo_mutex);
+  aim_display_t display = aim_display.value;
+  display.overlay.angular_velocity    = angular_velocity;
+  display.overlay.calculated_distance = distance;
+  SEQLOCK_PUBLISH(&aim_display, display);
 }
 
 static void set_overlay_info(const char *str, int x_offset, progress_bar_t prog){
-  pthread_mutex_lock(&algo_mutex);
-  strncpy(overlay_info.overlay_str, str, MAX_DISPLAY_LEN);
-  overlay_info.overlay_x_offset = x_offset;
-  overlay_info.prog = prog;
-  pthread_mutex_unlock(&algo_mutex); 
+  aim_display_t display = aim_display.value;
+  strncpy(display.overlay.overlay_str, str, MAX_DISPLAY_LEN);
+  display.overlay.overlay_x_offset = x_offset;
+  display.overlay.prog = prog;
+  SEQLOCK_PUBLISH(&aim_display, display);
 }
 
 void init_algo_thread(){
@@ -175,11 +174,15 @@ void init_algo_thread(){
     assert(0);
   }
 
-  rc = pthread_create(&aiming_th, NULL, aiming_thread, NULL);
-  if(rc != 0){
-    printf("Failed to start aiming thread with error %s\n", strerror(rc));
-    assert(0);
-  }
+  // The aim state machine runs on the reactor thread, once per inference
+  // and whenever the deadline of its current state is up
+  aim_timer = reactor_add_timer(on_aim_deadline);
+  reactor_watch(inference_output_mq, on_inference);
+#ifdef DEBUG_ALWAYS_GO_TO_NEXT_STATE
+  // No inferences to wait for, keep the state machine (and the moving
+  // crosshair) ticking instead
+  reactor_arm_timer(aim_timer, AIM_DEBUG_TICK_MS, AIM_DEBUG_TICK_MS);
+#endif
 }
 
 /* filters a point cloud in two ways,
@@ -261,7 +264,10 @@ static void find_centeroid(char *input_points){
   int new_points; 
  
   assert(input_points);
-  char filtered_points[MESSAGE_QUEUE_SIZE];
+  // Room for a full cloud, too big for the stack. A real cloud (not a
+  // char array) so the points are aligned.
+  static cartesian_point_cloud_and_meta_t filtered_cloud;
+  char *filtered_points = (char*)&filtered_cloud;
   point_cartesian_t mean;
 
   // step A) rough filtering, only accepts points that are close to the x/z axis, does not care about groupings
@@ -279,27 +285,19 @@ static void find_centeroid(char *input_points){
   new_average = new_average / ROLLING_AVERAGE_SAMPLES;
   last_index = (last_index + 1) % ROLLING_AVERAGE_SAMPLES;
   
-  pthread_mutex_lock(&distance_mutex);
-  calculated_distance = new_average;
-  pthread_mutex_unlock(&distance_mutex);
+  SEQLOCK_PUBLISH(&calculated_distance, new_average);
 }
 
 static void *distance_thread(void* arg){
-#define FRAME_PERIOD_RADAR (33333333)
   printf("Distance thread starting\n");
   
-  char buff[MESSAGE_QUEUE_SIZE];
-  struct timespec sleep_frame_duration;
-  sleep_frame_duration.tv_sec = 0;
-  sleep_frame_duration.tv_nsec = FRAME_PERIOD_RADAR;
+  static cartesian_point_cloud_and_meta_t cloud;
 
   while(1){
-    // run every 33ms or so - this is how often we get a new frame from
-    // the radar.
-    nanosleep(&sleep_frame_duration, NULL);
-
-    if (0 < get_radar_frame(buff, MESSAGE_QUEUE_SIZE)) {
-      find_centeroid(buff);
+    // wakes up once per calibrated radar frame (every 33ms or so), frames
+    // that came in while we were busy are skipped, only the newest counts
+    if (0 < shm_mailbox_wait(&radar_calibrated_mailbox, &cloud, sizeof(cloud), NULL, -1)) {
+      find_centeroid((char*)&cloud);
     }
   }
 }
@@ -388,7 +386,7 @@ static sm_t aim_sm_track(context_t *ctx){
   int time_now = (int)get_ms_since_start();
   ctx->state = STATE_TRACK; 
   
-  if(check_if_inference_is_centered(ctx)){
+  if(check_if_inference_is_centered(ctx->new_inference, ctx)){
     ctx->aim_track_centered_frames++;
   }
 
@@ -399,8 +397,14 @@ static sm_t aim_sm_track(context_t *ctx){
       ctx->aim_fail_reason |= AIM_CV_FAIL_REASON;
     }
     
-    // Was the gyro variance reasonable during the tracking phase?
-    rotation_analysis_t gyro_result = calculate_mean_rotation_and_variance();
+    // Was the gyro variance reasonable during the tracking phase? Falls
+    // back on the last TOTAL_SAMPLES_FOR_VARIANCE samples if the IMU went
+    // quiet.
+    rotation_analysis_t gyro_result;
+    if(imu_rotation_between(ctx->aim_track_start_ns, get_ns_monotonic(), &gyro_result)){
+      printf("No IMU samples while tracking\n");
+      gyro_result = calculate_mean_rotation_and_variance();
+    }
     ctx->gyro_result = gyro_result;
     if(gyro_result.variance_rotation > MAX_VARIANCE_ROTATION){
       ctx->aim_fail_reason |= AIM_GYRO_VAR_FAIL_REASON;
@@ -436,7 +440,7 @@ static sm_t aim_sm_lock(context_t *ctx){
   int time_cutoff = time_now - SAMPLING_PERIOD_FOR_LOCK_IN_MS;
   ctx->state = STATE_LOCK; 
 
-  if(check_if_inference_is_centered(NULL)){
+  if(check_if_inference_is_centered(ctx->new_inference, NULL)){
     lock_history[sample_index] = time_now;
     sample_index = (sample_index + 1) % HISTORY_BUFF_SIZE; 
   }
@@ -445,13 +449,19 @@ static sm_t aim_sm_lock(context_t *ctx){
   // centered, we assume we have lock and go to the next
   // state.
   int recent_frames_in_lock = 0;
+  int oldest_frame_in_lock  = INT_MAX;
   for(int i = 0; i < HISTORY_BUFF_SIZE; i++){
     if(lock_history[i] >= time_cutoff){
       recent_frames_in_lock++;   
+      if(lock_history[i] < oldest_frame_in_lock){
+        oldest_frame_in_lock = lock_history[i];
+      }
     }
   }
 
   ctx->aim_lock_recent_centered_frames = recent_frames_in_lock;
+  // The progress bar has to go down once the oldest frame falls out of the window
+  ctx->aim_lock_expiry_time = (INT_MAX == oldest_frame_in_lock) ? -1 : oldest_frame_in_lock + SAMPLING_PERIOD_FOR_LOCK_IN_MS + 1;
  
 #ifdef DEBUG_ALWAYS_GO_TO_NEXT_STATE
   if(1) {
@@ -475,8 +485,6 @@ static cartesian_point_t calculate_bullet_drop_and_lead(context_t *ctx){
 }
 
 static void draw_crosshair(context_t *ctx){
-  char mq_buff[MESSAGE_QUEUE_SIZE];
-  inference_detected_t *inference;
   aim_overlay_t aim_overlay;
 
 #ifdef DEBUG_ALWAYS_GO_TO_NEXT_STATE
@@ -494,32 +502,29 @@ static void draw_crosshair(context_t *ctx){
   goto EXIT;
 #endif
  
-  int rc = mq_receive(inference_output_mq, mq_buff, MESSAGE_QUEUE_SIZE, NULL);
-  if(-1 == rc){
+  if(NULL == ctx->new_inference){
     goto EXIT;
   }
 
   // Update target - new inference available 
-  inference = (inference_detected_t*)(mq_buff);
-  ctx->last_aim_point = calculate_optimial_aim_location(*inference);
+  ctx->last_aim_point = calculate_optimial_aim_location(*ctx->new_inference);
 
 EXIT:
   aim_overlay.aim_target                                    = ctx->last_aim_point;
   aim_overlay.aim_target_corrected_for_bullet_lead_and_drop = calculate_bullet_drop_and_lead(ctx);
-  mq_send(crosshair_input_mq, (char*)&aim_overlay, sizeof(aim_overlay), 0);
+  if(topic_wanted(&crosshair_topic)){
+    shm_mailbox_write(&crosshair_mailbox, &aim_overlay, sizeof(aim_overlay));
+    mq_topic_sent(&crosshair_topic, 1);
+  }
 }
 
-// returns 1 if the crosshair is on top of a target.
-static int check_if_inference_is_centered(context_t* ctx){
-  char mq_buff[MESSAGE_QUEUE_SIZE];
-  inference_detected_t *inference;
-  
-  int rc = mq_receive(inference_output_mq, mq_buff, MESSAGE_QUEUE_SIZE, NULL);
-  if(-1 == rc){
+// returns 1 if the crosshair is on top of a target. inference is NULL
+// when the state machine runs because of a deadline.
+static int check_if_inference_is_centered(const inference_detected_t* inference, context_t* ctx){
+  if(NULL == inference){
     return 0;
   }
 
-  inference = (inference_detected_t*)(mq_buff);
   if(calculate_if_bounding_box_centered(*inference)){
     if(ctx){
       ctx->last_center    = calculate_bounding_box_center(*inference);
@@ -532,6 +537,7 @@ static int check_if_inference_is_centered(context_t* ctx){
 
 static void set_ctx_entery_track_state(context_t *ctx){
   ctx->aim_track_exit_time = (int)get_ms_since_start() + TRACK_DURATION_MS;
+  ctx->aim_track_start_ns  = get_ns_monotonic();
   ctx->aim_track_centered_frames = 0;
 }
 
@@ -588,22 +594,58 @@ static void update_crosshair_overlay_based_on_state(context_t *ctx){
   set_overlay_info(overlay_str, x_offset, prog);
 }
 
-static void *aiming_thread(void *arg){
-#define FRAME_PERIOD_CAMERA (3333333) // 300fps 
-  /* We run the state machine about 300 times a second */
+// Time (ms since start) at which the current state has to run again even
+// without a new inference, -1 if it can wait for the next one
+static int aim_sm_deadline(context_t *ctx){
+  switch(ctx->state){
+    case STATE_LOCK:  return ctx->aim_lock_expiry_time;
+    case STATE_TRACK: return ctx->aim_track_exit_time + 1;
+    case STATE_FIRE:  return ctx->aim_fire_exit_time + 1;
+    case STATE_FAIL:  return ctx->aim_fail_exit_time + 1;
+  }
+  return -1;
+}
 
-  printf("Aiming thread starting\n");
-  struct timespec sleep_frame_duration;
-  sleep_frame_duration.tv_sec = 0;
-  sleep_frame_duration.tv_nsec = FRAME_PERIOD_CAMERA;
-  context_t ctx;
+// Runs on the reactor thread only, ctx needs no locking
+static void aim_sm_run(const inference_detected_t *inference){
+  static context_t ctx;
+  static state_fun state_fun_ptr = aim_sm_lock;
 
-  state_fun state_fun_ptr = aim_sm_lock;
-  while(1){
-    nanosleep(&sleep_frame_duration, NULL);
+  // A state that was just entered runs right away (without the
+  // inference, that one was handled already) so the overlay and the
+  // deadline are the new state's
+  ctx.new_inference = inference;
+  state_fun ran;
+  do {
+    ran = state_fun_ptr;
     state_fun_ptr = state_fun_ptr(&ctx).next_state;
+    ctx.new_inference = NULL;
+  } while(state_fun_ptr != ran);
+
+  set_state(ctx.state);
+  update_crosshair_overlay_based_on_state(&ctx);
+
+#ifndef DEBUG_ALWAYS_GO_TO_NEXT_STATE
+  int deadline = aim_sm_deadline(&ctx);
+  if(-1 == deadline){
+    reactor_arm_timer(aim_timer, 0, 0);
+  } else {
+    int time_left = deadline - (int)get_ms_since_start();
+    reactor_arm_timer(aim_timer, time_left > 0 ? time_left : 1, 0);
+  }
+#endif
+}
+
+static void on_inference(int fd){
+  char mq_buff[MESSAGE_QUEUE_SIZE];
 
-    set_state(ctx.state);
-    update_crosshair_overlay_based_on_state(&ctx);
+  int rc = mq_receive(inference_output_mq, mq_buff, MESSAGE_QUEUE_SIZE, NULL);
+  if(-1 == rc){
+    return;
   }
+  aim_sm_run((inference_detected_t*)(mq_buff));
+}
+
+static void on_aim_deadline(int fd){
+  aim_sm_run(NULL);
 }
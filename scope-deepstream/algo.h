@@ -24,6 +24,8 @@ typedef enum {STATE_LOCK, STATE_TRACK, STATE_FIRE, STATE_FAIL} aim_sm_curr_state
 // COOLDOWN STATE
 #define COOLDOWN_DURATION_FAIL_MS (1000)
 #define COOLDOWN_DURATION_FIRE_MS (5000)
+// DEBUG_ALWAYS_GO_TO_NEXT_STATE only, state machine period
+#define AIM_DEBUG_TICK_MS (3)
 
 typedef struct{
   int x;
@@ -47,7 +49,9 @@ typedef struct{
 
 typedef struct{
   int                  aim_lock_recent_centered_frames;
+  int                  aim_lock_expiry_time;
   int                  aim_track_exit_time;
+  uint64_t             aim_track_start_ns;
   size_t               aim_track_centered_frames;
   uint32_t             aim_fail_reason;
   int                  aim_fail_exit_time;
@@ -60,6 +64,7 @@ typedef struct{
   inference_detected_t last_inference;
   float                angular_velocity;
   double               target_distance;
+  const inference_detected_t *new_inference; // NULL unless an inference woke the state machine
 } context_t;
 
 typedef struct{
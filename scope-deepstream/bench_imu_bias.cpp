@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include <random>
+#include <vector>
+
+#include "imu_bias.h"
+#include "bench.h"
+
+// imu_bias (imu_bias.h) against what calibrate_imu() in imu.c used to do,
+// the mean gyro over 10s from startup.
+//
+// Samples at 800Hz with a gyro bias and noise, the scope handled (panned
+// into position, hand tremor, accelerometer wobble) for BENCH_HANDLED_S
+// and then put down. How long after that the first estimate comes and
+// how far off it is, against the 10s mean taken over the handling and the
+// stillness alike.
+//
+// Then the board warming: still for BENCH_WARM_S while the bias drifts,
+// how far behind the estimate is at the end. And the cost of a sample.
+//
+// Exits with 1 if the first estimate takes longer than a second or any
+// estimate is off by more than BENCH_MAX_ERROR.
+
+#define BENCH_RATE_HZ      (800)
+#define BENCH_HANDLED_S    (2)
+#define BENCH_STILL_S      (10)
+#define BENCH_WARM_S       (300)
+#define BENCH_MAX_ERROR    (0.002)   // rad/s
+#define BENCH_COST_SAMPLES (10000000)
+
+static const double bias[3] = { 0.012, -0.007, 0.004 };
+
+// drift is added to the bias, in rad/s per second
+static imu_t make_sample(std::mt19937_64& rng, double t, bool handled, double drift) {
+  std::normal_distribution<double> gyro_noise(0, 0.005), accel_noise(0, 0.05);
+  double tremor = handled ? 0.1 * sin(2 * M_PI * 8 * t) : 0;
+  double pan    = handled ? 0.15 : 0;
+  double wobble = handled ? 0.5 * sin(2 * M_PI * 3 * t) : 0;
+  imu_t sample;
+
+  sample.a_x = 0.3 + wobble + accel_noise(rng);
+  sample.a_y = -0.2 + accel_noise(rng);
+  sample.a_z = 9.8 - wobble + accel_noise(rng);
+  sample.r_p = bias[0] + drift * t + tremor + gyro_noise(rng);
+  sample.r_r = bias[1] + drift * t - tremor / 2 + gyro_noise(rng);
+  sample.r_y = bias[2] + drift * t + pan + tremor / 3 + gyro_noise(rng);
+  sample.cpu_cycles_since_boot = (uint32_t)(t * 32768);
+  return sample;
+}
+
+static double error_of(const float estimate[3], double drift_now) {
+  double worst = 0;
+  for(int k = 0; k < 3; k++) {
+    worst = fmax(worst, fabs(estimate[k] - (bias[k] + drift_now)));
+  }
+  return worst;
+}
+
+static bool bench_startup() {
+  std::mt19937_64 rng(5);
+  imu_bias b;
+  imu_bias_init(&b);
+  double old_sum[3] = { 0 }, first_s = -1, first_error = 0, worst_error = 0;
+  uint64_t total = (uint64_t)(BENCH_HANDLED_S + BENCH_STILL_S) * BENCH_RATE_HZ;
+
+  for(uint64_t i = 0; i < total; i++) {
+    double t = (double)i / BENCH_RATE_HZ;
+    imu_t sample = make_sample(rng, t, t < BENCH_HANDLED_S, 0);
+
+    if(i < 10 * BENCH_RATE_HZ) {
+      old_sum[0] += sample.r_p;
+      old_sum[1] += sample.r_r;
+      old_sum[2] += sample.r_y;
+    }
+    if(imu_bias_add(&b, &sample)) {
+      double error = error_of(b.bias, 0);
+      if(first_s < 0) {
+        first_s     = t - BENCH_HANDLED_S;
+        first_error = error;
+        if(t < BENCH_HANDLED_S) {
+          printf("estimate while handled at %.2fs\n", t);
+          return false;
+        }
+      }
+      worst_error = fmax(worst_error, error);
+    }
+  }
+
+  float old[3];
+  for(int k = 0; k < 3; k++) {
+    old[k] = old_sum[k] / (10 * BENCH_RATE_HZ);
+  }
+  printf("handled %ds, then still %ds, 800Hz\n", BENCH_HANDLED_S, BENCH_STILL_S);
+  printf("%-34s %10s %14s\n", "", "ready (s)", "error (rad/s)");
+  printf("%-34s %10.3f %14.5f\n", "imu_bias, first estimate", first_s, first_error);
+  printf("%-34s %10s %14.5f\n", "imu_bias, worst estimate after", "", worst_error);
+  printf("%-34s %10.3f %14.5f\n", "10s mean from startup (old)", 10.0, error_of(old, 0));
+  return first_s >= 0 && first_s < 1.0 && worst_error < BENCH_MAX_ERROR;
+}
+
+static bool bench_warming() {
+  std::mt19937_64 rng(6);
+  imu_bias b;
+  imu_bias_init(&b);
+  // 0.01 rad/s over the whole run
+  double drift = 0.01 / BENCH_WARM_S;
+
+  for(uint64_t i = 0; i < (uint64_t)BENCH_WARM_S * BENCH_RATE_HZ; i++) {
+    double t = (double)i / BENCH_RATE_HZ;
+    imu_t sample = make_sample(rng, t, false, drift);
+    imu_bias_add(&b, &sample);
+  }
+  double error = error_of(b.bias, drift * BENCH_WARM_S);
+  printf("\nstill %ds, bias drifting 0.01 rad/s: %u estimates, error at the end %.5f rad/s\n", BENCH_WARM_S,
+         b.estimates, error);
+  return error < BENCH_MAX_ERROR;
+}
+
+static void bench_cost() {
+  std::mt19937_64 rng(7);
+  std::vector<imu_t> samples;
+  for(int i = 0; i < 4096; i++) {
+    samples.push_back(make_sample(rng, (double)i / BENCH_RATE_HZ, false, 0));
+  }
+
+  imu_bias b;
+  imu_bias_init(&b);
+  uint64_t start = now_ns();
+  for(uint64_t i = 0; i < BENCH_COST_SAMPLES; i++) {
+    imu_bias_add(&b, &samples[i & 4095]);
+  }
+  double ns = (double)(now_ns() - start) / BENCH_COST_SAMPLES;
+  sink = b.bias[0];
+  printf("\nimu_bias_add %.1f ns, %.4f%% of a core at 800Hz\n", ns, ns * 800 / 1e7);
+}
+
+int main() {
+  bool ok = true;
+  ok &= bench_startup();
+  ok &= bench_warming();
+  bench_cost();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include <random>
+#include <vector>
+
+#include "imu_fusion.h"
+#include "bench.h"
+
+// imu_fusion (imu_fusion.h) against the tilt imu.c used to show, atan() of
+// a 5 sample boxcar of the accelerometer.
+//
+// The scope follows a known path: rolling and pitching a few degrees,
+// panning back and forth, with recoil every few seconds (30 m/s^2 for
+// 20ms). Gyro samples carry a bias and noise, accelerometer samples noise
+// and the recoil. Tilt error is against the true gravity direction, after
+// BENCH_SETTLE_S for the filter to find the gyro bias.
+//
+// Then the cost of a sample, one at a time and in imu_batch sized bursts,
+// and what that is at 800Hz and 3.2kHz.
+//
+// Exits with 1 if the filter is not better than the boxcar or the batch
+// update does not track the single one.
+
+#define BENCH_SECONDS     (60)
+#define BENCH_SETTLE_S    (5)
+#define BENCH_BOXCAR      (5)
+#define BENCH_BATCH       (8)
+#define BENCH_COST_SAMPLES (2000000)
+
+#define DEG (M_PI / 180)
+
+// Roll, pitch, yaw (ZYX) of the path at t and their rates
+static void path(double t, double angles[3], double rates[3]) {
+  angles[0] = 8 * DEG * sin(2 * M_PI * 0.25 * t) + 3 * DEG * sin(2 * M_PI * 1.7 * t);
+  angles[1] = 6 * DEG * sin(2 * M_PI * 0.18 * t + 1);
+  angles[2] = 40 * DEG * sin(2 * M_PI * 0.05 * t);
+  rates[0]  = 8 * DEG * 2 * M_PI * 0.25 * cos(2 * M_PI * 0.25 * t) + 3 * DEG * 2 * M_PI * 1.7 * cos(2 * M_PI * 1.7 * t);
+  rates[1]  = 6 * DEG * 2 * M_PI * 0.18 * cos(2 * M_PI * 0.18 * t + 1);
+  rates[2]  = 40 * DEG * 2 * M_PI * 0.05 * cos(2 * M_PI * 0.05 * t);
+}
+
+// Gravity in the sensor frame, unit length
+static void gravity(const double angles[3], double v[3]) {
+  v[0] = -sin(angles[1]);
+  v[1] = sin(angles[0]) * cos(angles[1]);
+  v[2] = cos(angles[0]) * cos(angles[1]);
+}
+
+typedef struct {
+  std::vector<imu_t>  samples;
+  std::vector<double> roll;   // tilt as imu.c shows it, degrees
+  std::vector<double> pitch;
+} bench_run;
+
+static bench_run make_run(uint32_t rate_hz) {
+  std::mt19937_64 rng(11);
+  std::normal_distribution<double> gyro_noise(0, 0.005), accel_noise(0, 0.05);
+  const double bias[3] = { 0.01, -0.008, 0.005 };
+  bench_run run;
+
+  for(uint64_t i = 0; i < (uint64_t)BENCH_SECONDS * rate_hz; i++) {
+    double t = (double)i / rate_hz, angles[3], rates[3], v[3];
+    path(t, angles, rates);
+    gravity(angles, v);
+
+    // Euler rates to body rates
+    double sr = sin(angles[0]), cr = cos(angles[0]), sp = sin(angles[1]), cp = cos(angles[1]);
+    double w_x = rates[0] - rates[2] * sp;
+    double w_y = rates[1] * cr + rates[2] * cp * sr;
+    double w_z = -rates[1] * sr + rates[2] * cp * cr;
+
+    // Recoil, along the barrel (x) mostly
+    double kick = fmod(t, 4.0) < 0.02 ? 1.0 : 0.0;
+
+    imu_t sample;
+    sample.a_x = IMU_FUSION_GRAVITY * v[0] + 30 * kick + accel_noise(rng);
+    sample.a_y = IMU_FUSION_GRAVITY * v[1] + 5 * kick + accel_noise(rng);
+    sample.a_z = IMU_FUSION_GRAVITY * v[2] - 10 * kick + accel_noise(rng);
+    sample.r_p = w_x + bias[0] + gyro_noise(rng);
+    sample.r_r = w_y + bias[1] + gyro_noise(rng);
+    sample.r_y = w_z + bias[2] + gyro_noise(rng);
+    sample.cpu_cycles_since_boot = (uint32_t)llround(t * IMU_FUSION_BOARD_HZ);
+    run.samples.push_back(sample);
+    run.roll.push_back(atan(v[0] / v[2]) / DEG);
+    run.pitch.push_back(atan(v[1] / v[2]) / DEG);
+  }
+  return run;
+}
+
+typedef struct {
+  double rms;
+  double max;
+} bench_error;
+
+static void add_error(double error, double& sum_sq, double& max) {
+  sum_sq += error * error;
+  max = fmax(max, fabs(error));
+}
+
+static bench_error boxcar_error(const bench_run& run, uint32_t rate_hz) {
+  double sum_sq = 0, max = 0;
+  uint64_t counted = 0;
+  for(size_t i = BENCH_BOXCAR; i < run.samples.size(); i++) {
+    float a_x = 0, a_y = 0, a_z = 0;
+    for(size_t k = i + 1 - BENCH_BOXCAR; k <= i; k++) {
+      a_x += run.samples[k].a_x / BENCH_BOXCAR;
+      a_y += run.samples[k].a_y / BENCH_BOXCAR;
+      a_z += run.samples[k].a_z / BENCH_BOXCAR;
+    }
+    if(i >= (size_t)BENCH_SETTLE_S * rate_hz) {
+      add_error(atan(a_x / a_z) / DEG - run.roll[i], sum_sq, max);
+      add_error(atan(a_y / a_z) / DEG - run.pitch[i], sum_sq, max);
+      counted += 2;
+    }
+  }
+  return (bench_error){ sqrt(sum_sq / counted), max };
+}
+
+// batch 0 updates one sample at a time
+static bench_error fusion_error(const bench_run& run, uint32_t rate_hz, uint32_t batch, imu_fusion* fusion) {
+  double sum_sq = 0, max = 0;
+  uint64_t counted = 0;
+  imu_fusion_init(fusion, IMU_FUSION_DEFAULT_KP, IMU_FUSION_DEFAULT_KI);
+
+  for(size_t i = 0; i < run.samples.size();) {
+    size_t n = batch ? batch : 1;
+    n = n < run.samples.size() - i ? n : run.samples.size() - i;
+    if(batch) {
+      imu_fusion_update_batch(fusion, &run.samples[i], n);
+    } else {
+      imu_fusion_update(fusion, &run.samples[i]);
+    }
+    i += n;
+
+    // Where the display would be after this batch
+    if(i - 1 >= (size_t)BENCH_SETTLE_S * rate_hz) {
+      imu_fusion_angles angles = imu_fusion_get_angles(fusion);
+      add_error(angles.roll - run.roll[i - 1], sum_sq, max);
+      add_error(angles.pitch - run.pitch[i - 1], sum_sq, max);
+      counted += 2;
+    }
+  }
+  return (bench_error){ sqrt(sum_sq / counted), max };
+}
+
+static bool check_rate(uint32_t rate_hz) {
+  bench_run run = make_run(rate_hz);
+  imu_fusion single, batched;
+
+  bench_error boxcar = boxcar_error(run, rate_hz);
+  bench_error one    = fusion_error(run, rate_hz, 0, &single);
+  bench_error burst  = fusion_error(run, rate_hz, BENCH_BATCH, &batched);
+
+  double q_diff = 0;
+  for(int k = 0; k < 4; k++) {
+    q_diff = fmax(q_diff, fabs(single.q[k] - batched.q[k]));
+  }
+
+  printf("%5u Hz | boxcar+atan %6.3f %6.3f | fusion %6.3f %6.3f | fusion batch %6.3f %6.3f | bias %.4f %.4f %.4f\n",
+         rate_hz, boxcar.rms, boxcar.max, one.rms, one.max, burst.rms, burst.max, -single.integral[0],
+         -single.integral[1], -single.integral[2]);
+  return one.rms < boxcar.rms && one.max < boxcar.max && q_diff < 1e-3;
+}
+
+static void bench_cost() {
+  bench_run run = make_run(800);
+  std::vector<imu_t>& samples = run.samples;
+  imu_fusion fusion;
+
+  imu_fusion_init(&fusion, IMU_FUSION_DEFAULT_KP, IMU_FUSION_DEFAULT_KI);
+  uint64_t start = now_ns();
+  for(uint64_t i = 0; i < BENCH_COST_SAMPLES; i++) {
+    imu_fusion_update(&fusion, &samples[i % samples.size()]);
+  }
+  double single_ns = (double)(now_ns() - start) / BENCH_COST_SAMPLES;
+  sink = fusion.q[0];
+
+  imu_fusion_init(&fusion, IMU_FUSION_DEFAULT_KP, IMU_FUSION_DEFAULT_KI);
+  start = now_ns();
+  for(uint64_t i = 0; i < BENCH_COST_SAMPLES; i += BENCH_BATCH) {
+    imu_fusion_update_batch(&fusion, &samples[i % (samples.size() - BENCH_BATCH)], BENCH_BATCH);
+  }
+  double batch_ns = (double)(now_ns() - start) / BENCH_COST_SAMPLES;
+  sink = fusion.q[0];
+
+  printf("\n%-26s %8s %10s %10s\n", "update", "ns", "% @800Hz", "% @3.2kHz");
+  printf("%-26s %8.1f %10.4f %10.4f\n", "imu_fusion_update", single_ns, single_ns * 800 / 1e7, single_ns * 3200 / 1e7);
+  printf("%-26s %8.1f %10.4f %10.4f\n", "imu_fusion_update_batch/8", batch_ns, batch_ns * 800 / 1e7,
+         batch_ns * 3200 / 1e7);
+}
+
+int main() {
+  printf("Tilt error against the true gravity direction, degrees (rms max), %ds with recoil every 4s\n", BENCH_SECONDS);
+  bool ok = true;
+  ok &= check_rate(800);
+  ok &= check_rate(3200);
+  bench_cost();
+  return ok ? 0 : 1;
+}
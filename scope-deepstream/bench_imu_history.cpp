@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <thread>
+#include <atomic>
+#include <random>
+#include <vector>
+
+#include "imu_history.h"
+#include "bench.h"
+
+// Checks and times imu_history (imu_history.h).
+//
+// clock   - samples at 800Hz by the board clock, starting just before
+//           cpu_cycles_since_boot wraps, arrive in batches of 8 with
+//           0.1-3ms of transport delay and a host clock BENCH_DRIFT_PPM
+//           faster than the board's. The time given to every sample is
+//           compared with when it was really taken.
+// queries - random time ranges over the history against a brute force
+//           pass over the same samples (mean, variance, integral).
+// threads - a reader querying while the writer adds as fast as it can,
+//           a_x is the sample index so every result can be checked.
+// cost    - a query over a TRACK_DURATION_MS (1.5s) window against walking
+//           the samples of that window.
+//
+// Exits with 1 if anything is off.
+
+#define BENCH_SAMPLES      (2000000)
+#define BENCH_PERIOD_NS    (1250000)
+#define BENCH_BATCH        (8)
+#define BENCH_DRIFT_PPM    (30)
+#define BENCH_QUERIES      (20000)
+#define BENCH_TRACK_NS     (1500000000ULL)
+#define BENCH_TOLERANCE    (1e-6)
+#define BENCH_EXACT_TICKS  (64)       // board ticks a sample in the threads run,
+#define BENCH_EXACT_NS     (1953125)  // exactly this many ns
+
+static double relative_error(double value, double expected) {
+  double scale = fabs(expected) > 1e-9 ? fabs(expected) : 1e-9;
+  return fabs(value - expected) / scale;
+}
+
+// Error against the size of the signal, not of the result: a mean or an
+// integral close to 0 says nothing about how precise the sums are
+static double scaled_error(double value, double expected, double scale) {
+  return fabs(value - expected) / (scale > 1e-12 ? scale : 1e-12);
+}
+
+static float axis_value(const imu_history_entry& entry, imu_axis_e axis) {
+  return entry.value[axis];
+}
+
+// Gyro and accelerometer of a scope carried around, then held still
+static imu_t make_sample(std::mt19937_64& rng, uint64_t i) {
+  std::normal_distribution<float> noise(0.0f, 1.0f);
+  imu_t sample;
+  float moving = (i / 4000) % 3 ? 0.0f : 1.0f;
+  sample.a_x = 0.2f * noise(rng) + moving * sinf(i * 0.01f);
+  sample.a_y = 0.2f * noise(rng);
+  sample.a_z = 9.81f + 0.05f * noise(rng);
+  sample.r_p = 0.01f * noise(rng);
+  sample.r_r = 0.01f * noise(rng);
+  sample.r_y = 0.005f + 0.002f * noise(rng) + moving * 0.8f * sinf(i * 0.003f);
+  return sample;
+}
+
+// Board ticks of sample i at 800Hz, starting 10s before the counter wraps
+static uint32_t board_cycles(uint64_t i) {
+  return (uint32_t)(0xFFFFFFFFu - 10 * IMU_HISTORY_BOARD_HZ + (i * IMU_HISTORY_BOARD_HZ + 400) / 800);
+}
+
+static bool check_clock_and_queries(imu_history& history) {
+  std::mt19937_64 rng(42);
+  std::exponential_distribution<double> delay(1.0 / 300000);
+  const uint64_t host_start = 1000000000000ULL;
+
+  double worst_time_error_us = 0;
+  for(uint64_t i = 0; i < BENCH_SAMPLES; i++) {
+    imu_t sample = make_sample(rng, i);
+    // When it was taken, by the host clock
+    uint64_t taken = host_start + (uint64_t)(i * BENCH_PERIOD_NS * (1 + BENCH_DRIFT_PPM * 1e-6));
+    uint64_t received = 0;
+    if(0 == i % BENCH_BATCH) {
+      // imu_batch.received_ns, when the first sample of it came in
+      received = taken + 100000 + (uint64_t)fmin(delay(rng), 2.9e6);
+    }
+    sample.cpu_cycles_since_boot = board_cycles(i);
+    imu_history_add(&history, &sample, received);
+
+    // After a second to learn the offset
+    if(i > 800) {
+      const imu_history_entry& entry = history.entries[i & (history.capacity - 1)];
+      worst_time_error_us = fmax(worst_time_error_us, fabs((double)entry.t_ns - (double)taken) / 1e3);
+    }
+  }
+
+  // The history holds the last capacity samples, query inside them
+  uint64_t head   = history.head;
+  uint32_t mask   = history.capacity - 1;
+  uint64_t oldest = head - (history.capacity - IMU_HISTORY_GUARD);
+  double worst_mean = 0, worst_variance = 0, worst_integral = 0;
+  bool counts_ok = true;
+
+  for(int q = 0; q < BENCH_QUERIES; q++) {
+    uint64_t a = oldest + rng() % (head - oldest);
+    uint64_t b = oldest + rng() % (head - oldest);
+    uint64_t start_ns = history.entries[(a < b ? a : b) & mask].t_ns - rng() % 1000;
+    uint64_t end_ns   = history.entries[(a < b ? b : a) & mask].t_ns + rng() % 1000;
+    imu_axis_e axis   = (imu_axis_e)(q % IMU_AXES);
+
+    // Brute force over the samples in range
+    double sum = 0, sum_sq = 0, integral = 0, integral_abs = 0;
+    uint32_t count = 0;
+    const imu_history_entry* previous = NULL;
+    for(uint64_t i = oldest; i < head; i++) {
+      const imu_history_entry& entry = history.entries[i & mask];
+      if(entry.t_ns < start_ns || entry.t_ns > end_ns) {
+        continue;
+      }
+      sum += axis_value(entry, axis);
+      sum_sq += axis_value(entry, axis) * axis_value(entry, axis);
+      if(previous) {
+        double dt = (entry.t_ns - previous->t_ns) / 1e9;
+        integral += 0.5 * (axis_value(entry, axis) + axis_value(*previous, axis)) * dt;
+        integral_abs += 0.5 * (fabs(axis_value(entry, axis)) + fabs(axis_value(*previous, axis))) * dt;
+      }
+      previous = &entry;
+      count++;
+    }
+    double mean = sum / count, m2 = 0;
+    for(uint64_t i = oldest; i < head; i++) {
+      const imu_history_entry& entry = history.entries[i & mask];
+      if(entry.t_ns >= start_ns && entry.t_ns <= end_ns) {
+        m2 += (axis_value(entry, axis) - mean) * (axis_value(entry, axis) - mean);
+      }
+    }
+
+    imu_history_stats stats;
+    if(imu_history_query(&history, axis, start_ns, end_ns, &stats) || stats.count != count) {
+      counts_ok = false;
+      continue;
+    }
+    worst_mean     = fmax(worst_mean, scaled_error(stats.mean, mean, sqrt(sum_sq / count)));
+    worst_variance = fmax(worst_variance, scaled_error(stats.variance, m2 / count, sum_sq / count));
+    worst_integral = fmax(worst_integral, scaled_error(stats.integral, integral, integral_abs));
+  }
+
+  // Nothing in an empty range
+  imu_history_stats stats;
+  uint64_t last_ns = history.entries[(head - 1) & mask].t_ns;
+  counts_ok &= -1 == imu_history_query(&history, IMU_AXIS_R_Y, last_ns + 1, last_ns + 1000000, &stats);
+
+  bool clock_ok = worst_time_error_us < 200;
+  bool query_ok = counts_ok && worst_mean < BENCH_TOLERANCE && worst_variance < BENCH_TOLERANCE &&
+                  worst_integral < BENCH_TOLERANCE;
+  printf("clock:   %d samples across the board clock wrapping, %d ppm drift, worst time error %.1f us "
+         "(100 us of it the shortest transport delay) | %s\n",
+         BENCH_SAMPLES, BENCH_DRIFT_PPM, worst_time_error_us, clock_ok ? "ok" : "FAILED");
+  printf("queries: %d ranges, worst error (of the signal's size) mean %.2e variance %.2e integral %.2e, counts %s | %s\n",
+         BENCH_QUERIES, worst_mean, worst_variance, worst_integral, counts_ok ? "exact" : "WRONG",
+         query_ok ? "ok" : "FAILED");
+  return clock_ok && query_ok;
+}
+
+// a_x of sample i is i, so a range of n samples starting at sample k has a
+// mean of k + (n - 1) / 2. A query mixing two writes would be off in
+// count or mean. (Variance is not checked here, squares of indices in the
+// millions are past what the prefix sums hold exactly.)
+static bool check_threads() {
+  imu_history history;
+  if(imu_history_init(&history, IMU_HISTORY_DEFAULT_SAMPLES)) {
+    return false;
+  }
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> added{0};
+  uint64_t queries = 0, wrong = 0, gone = 0;
+
+  std::thread reader([&]() {
+    std::mt19937_64 rng(5);
+    while(!done) {
+      uint64_t head = added;
+      if(head < 2000) {
+        continue;
+      }
+      uint64_t last  = head - 1 - rng() % 500;
+      uint64_t first = last - rng() % 1000;
+      imu_history_stats stats;
+      if(imu_history_query(&history, IMU_AXIS_A_X, first * BENCH_EXACT_NS + 1000000000ULL,
+                           last * BENCH_EXACT_NS + 1000000000ULL, &stats)) {
+        // Fine if the reader was switched out long enough for the range
+        // to leave the history
+        if(added < first + history.capacity - IMU_HISTORY_GUARD) {
+          wrong++;
+        } else {
+          gone++;
+        }
+        continue;
+      }
+      double n = stats.count;
+      queries++;
+      if(stats.first_ns > first * BENCH_EXACT_NS + 1000000000ULL) {
+        // Same, only part of the range was left
+        gone++;
+      } else if(stats.count != last - first + 1 || relative_error(stats.mean, first + (n - 1) / 2) > 1e-9) {
+        wrong++;
+      }
+    }
+  });
+
+  for(uint64_t i = 0; i < BENCH_SAMPLES; i++) {
+    imu_t sample = {0};
+    sample.a_x = (float)i;
+    // Arrives the moment it is taken, times are exact
+    sample.cpu_cycles_since_boot = (uint32_t)(i * BENCH_EXACT_TICKS);
+    imu_history_add(&history, &sample, i * BENCH_EXACT_NS + 1000000000ULL);
+    added = i + 1;
+  }
+  done = true;
+  reader.join();
+  imu_history_free(&history);
+
+  printf("threads: %llu queries while adding, %llu wrong, %llu for samples already gone | %s\n",
+         (unsigned long long)queries, (unsigned long long)wrong, (unsigned long long)gone, wrong ? "FAILED" : "ok");
+  return 0 == wrong;
+}
+
+static void bench(imu_history& history) {
+  uint64_t head    = history.head;
+  uint32_t mask    = history.capacity - 1;
+  uint64_t last_ns = history.entries[(head - 1) & mask].t_ns;
+  std::mt19937_64 rng(3);
+
+  // Ranges ending in the last second, like aim_sm_track asks at the end
+  // of tracking
+  std::vector<uint64_t> ends(1024);
+  for(auto& end : ends) {
+    end = last_ns - rng() % 1000000000ULL;
+  }
+
+  uint64_t start = now_ns();
+  for(int q = 0; q < BENCH_QUERIES * 10; q++) {
+    imu_history_stats stats;
+    uint64_t end_ns = ends[q & 1023];
+    imu_history_query(&history, IMU_AXIS_R_Y, end_ns - BENCH_TRACK_NS, end_ns, &stats);
+    sink = stats.variance;
+  }
+  double query_ns = (double)(now_ns() - start) / (BENCH_QUERIES * 10);
+
+  start = now_ns();
+  for(int q = 0; q < BENCH_QUERIES; q++) {
+    uint64_t end_ns = ends[q & 1023], start_ns = end_ns - BENCH_TRACK_NS;
+    double sum = 0, sum_sq = 0;
+    uint32_t count = 0;
+    for(uint64_t i = head - (history.capacity - IMU_HISTORY_GUARD); i < head; i++) {
+      const imu_history_entry& entry = history.entries[i & mask];
+      if(entry.t_ns >= start_ns && entry.t_ns <= end_ns) {
+        sum += entry.value[IMU_AXIS_R_Y];
+        sum_sq += entry.value[IMU_AXIS_R_Y] * entry.value[IMU_AXIS_R_Y];
+        count++;
+      }
+    }
+    sink = sum_sq / count - (sum / count) * (sum / count);
+  }
+  double scan_ns = (double)(now_ns() - start) / BENCH_QUERIES;
+
+  imu_history scratch;
+  imu_history_init(&scratch, IMU_HISTORY_DEFAULT_SAMPLES);
+  imu_t sample = {0};
+  start = now_ns();
+  for(uint64_t i = 0; i < BENCH_SAMPLES; i++) {
+    sample.r_y = (float)(i & 0xFF);
+    sample.cpu_cycles_since_boot = (uint32_t)(i * 41);
+    imu_history_add(&scratch, &sample, i % BENCH_BATCH ? 0 : i * BENCH_PERIOD_NS + 1);
+  }
+  double add_ns = (double)(now_ns() - start) / BENCH_SAMPLES;
+  imu_history_free(&scratch);
+
+  printf("\n%u samples of history (%.1fs at 800Hz, %zu KB)\n", history.capacity,
+         history.capacity * (BENCH_PERIOD_NS / 1e9), history.capacity * sizeof(imu_history_entry) / 1024);
+  printf("%-32s %10.1f ns\n", "imu_history_add", add_ns);
+  printf("%-32s %10.1f ns\n", "imu_history_query, 1.5s", query_ns);
+  printf("%-32s %10.1f ns\n", "scan of the history, 1.5s", scan_ns);
+}
+
+int main() {
+  imu_history history;
+  if(imu_history_init(&history, IMU_HISTORY_DEFAULT_SAMPLES)) {
+    return 1;
+  }
+
+  bool ok = check_clock_and_queries(history);
+  ok &= check_threads();
+  bench(history);
+  imu_history_free(&history);
+  return ok ? 0 : 1;
+}
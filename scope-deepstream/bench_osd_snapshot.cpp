@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include "seqlock.h"
+#include "bench.h"
+
+// How long the OSD probe spends getting what it draws, the way smartscope
+// did it (a pthread mutex per value, every getter locking) and with
+// seqlock.h snapshots.
+//
+// Producers run at their real rates and publish values the size of the
+// real ones: orientation from the IMU thread at 800Hz, aim state and
+// overlay from the reactor thread at 300Hz (two updates per run, state
+// then overlay), distance at 30Hz. The probe stands in for
+// osd_sink_pad_buffer_probe, the same 7 getter calls per frame, 1000
+// frames a second for BENCH_SECONDS. Each probe is timed as a whole.
+//
+// Run spread over the cores and with every thread on one core, where a
+// producer switched out holding the mutex stalls the probe.
+//
+// Exits with 1 if a seqlock probe ever sees an orientation half written
+// (the producer writes the same value to every field).
+
+#define BENCH_SECONDS      (5)
+#define BENCH_PROBE_HZ     (1000)
+#define BENCH_DISPLAY_LEN  (64)
+
+typedef struct {
+  float pitch, roll, yaw, rotation, pitch_rate, roll_rate;
+} bench_orientation;
+
+typedef struct {
+  int   state;
+  char  overlay_str[BENCH_DISPLAY_LEN];
+  int   overlay_x_offset;
+  int   prog[5];
+  float angular_velocity;
+  float calculated_distance;
+} bench_aim_display;
+
+// Old: plain values next to each other, a mutex per producer
+static struct {
+  pthread_mutex_t   imu_mutex;
+  pthread_mutex_t   algo_mutex;
+  pthread_mutex_t   distance_mutex;
+  bench_orientation orientation;
+  bench_aim_display aim;
+  float             distance;
+} locked = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER };
+
+// New
+static SEQLOCK_SNAPSHOT(bench_orientation) orientation;
+static SEQLOCK_SNAPSHOT(bench_aim_display) aim_display;
+static SEQLOCK_SNAPSHOT(float) distance;
+
+static uint64_t torn;
+
+static void pin(bool one_core) {
+  if(one_core) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+}
+
+// Calls publish(i) rate_hz times a second until done
+template<typename Publish>
+static std::thread producer(std::atomic<bool>& done, bool one_core, uint32_t rate_hz, Publish publish) {
+  return std::thread([&done, one_core, rate_hz, publish]() {
+    pin(one_core);
+    uint64_t next = now_ns();
+    for(uint32_t i = 0; !done; i++) {
+      publish(i);
+      pace(next, rate_hz);
+    }
+  });
+}
+
+static void fill_aim(bench_aim_display& aim, uint32_t i) {
+  aim.state = i % 4;
+  snprintf(aim.overlay_str, sizeof(aim.overlay_str), "TRACKING %u", i);
+  aim.overlay_x_offset = 330;
+  aim.angular_velocity = i * 0.1f;
+}
+
+static void fill_orientation(bench_orientation& o, uint32_t i) {
+  o.pitch = o.roll = o.yaw = o.rotation = o.pitch_rate = o.roll_rate = (float)i;
+}
+
+// What osd_sink_pad_buffer_probe asks for each frame
+static void probe_locked() {
+  char text[BENCH_DISPLAY_LEN];
+  int x_offset, state = 0, prog[5];
+  float sum = 0;
+
+  pthread_mutex_lock(&locked.imu_mutex);
+  sum += locked.orientation.roll + locked.orientation.pitch;
+  pthread_mutex_unlock(&locked.imu_mutex);
+  for(int k = 0; k < 3; k++) {
+    pthread_mutex_lock(&locked.algo_mutex);
+    state += locked.aim.state;
+    pthread_mutex_unlock(&locked.algo_mutex);
+  }
+  pthread_mutex_lock(&locked.algo_mutex);
+  memcpy(prog, locked.aim.prog, sizeof(prog));
+  pthread_mutex_unlock(&locked.algo_mutex);
+  pthread_mutex_lock(&locked.algo_mutex);
+  strncpy(text, locked.aim.overlay_str, sizeof(text));
+  x_offset = locked.aim.overlay_x_offset;
+  pthread_mutex_unlock(&locked.algo_mutex);
+  pthread_mutex_lock(&locked.distance_mutex);
+  sum += locked.distance;
+  pthread_mutex_unlock(&locked.distance_mutex);
+  sink = sum + state + x_offset + prog[0] + text[0];
+}
+
+static void probe_seqlock() {
+  bench_orientation o;
+  bench_aim_display aim;
+  char text[BENCH_DISPLAY_LEN];
+  int x_offset, state = 0, prog[5];
+  float d, sum = 0;
+
+  SEQLOCK_LOAD(&orientation, o);
+  sum += o.roll + o.pitch;
+  torn += o.pitch != o.roll_rate;
+  for(int k = 0; k < 3; k++) {
+    SEQLOCK_LOAD(&aim_display, aim);
+    state += aim.state;
+  }
+  SEQLOCK_LOAD(&aim_display, aim);
+  memcpy(prog, aim.prog, sizeof(prog));
+  SEQLOCK_LOAD(&aim_display, aim);
+  strncpy(text, aim.overlay_str, sizeof(text));
+  x_offset = aim.overlay_x_offset;
+  SEQLOCK_LOAD(&distance, d);
+  sum += d;
+  sink = sum + state + x_offset + prog[0] + text[0];
+}
+
+static void run(const char* name, bool use_seqlock, bool one_core) {
+  std::atomic<bool> done{false};
+  std::vector<std::thread> producers;
+
+  if(use_seqlock) {
+    producers.push_back(producer(done, one_core, 800, [](uint32_t i) {
+      bench_orientation o;
+      fill_orientation(o, i);
+      SEQLOCK_PUBLISH(&orientation, o);
+    }));
+    producers.push_back(producer(done, one_core, 300, [](uint32_t i) {
+      bench_aim_display aim = aim_display.value;
+      aim.state = i % 4;
+      SEQLOCK_PUBLISH(&aim_display, aim);
+      fill_aim(aim, i);
+      SEQLOCK_PUBLISH(&aim_display, aim);
+    }));
+    producers.push_back(producer(done, one_core, 30, [](uint32_t i) {
+      float d = i * 0.5f;
+      SEQLOCK_PUBLISH(&distance, d);
+    }));
+  } else {
+    producers.push_back(producer(done, one_core, 800, [](uint32_t i) {
+      pthread_mutex_lock(&locked.imu_mutex);
+      fill_orientation(locked.orientation, i);
+      pthread_mutex_unlock(&locked.imu_mutex);
+    }));
+    producers.push_back(producer(done, one_core, 300, [](uint32_t i) {
+      pthread_mutex_lock(&locked.algo_mutex);
+      locked.aim.state = i % 4;
+      pthread_mutex_unlock(&locked.algo_mutex);
+      pthread_mutex_lock(&locked.algo_mutex);
+      fill_aim(locked.aim, i);
+      pthread_mutex_unlock(&locked.algo_mutex);
+    }));
+    producers.push_back(producer(done, one_core, 30, [](uint32_t i) {
+      pthread_mutex_lock(&locked.distance_mutex);
+      locked.distance = i * 0.5f;
+      pthread_mutex_unlock(&locked.distance_mutex);
+    }));
+  }
+
+  std::vector<uint64_t> probe_ns;
+  std::thread probe([&]() {
+    pin(one_core);
+    uint64_t next = now_ns();
+    for(uint32_t i = 0; i < BENCH_SECONDS * BENCH_PROBE_HZ; i++) {
+      uint64_t start = now_ns();
+      use_seqlock ? probe_seqlock() : probe_locked();
+      probe_ns.push_back(now_ns() - start);
+      pace(next, BENCH_PROBE_HZ);
+    }
+  });
+  probe.join();
+  done = true;
+  for(auto& t : producers) {
+    t.join();
+  }
+
+  latency_percentiles latency = summarize_latencies(probe_ns);
+  printf("%-24s | %8zu | %8.0f %8.0f %8.0f %9.0f\n", name, probe_ns.size(), latency.p50_us * 1e3, latency.p99_us * 1e3,
+         latency.p999_us * 1e3, latency.max_us * 1e3);
+}
+
+int main() {
+  printf("OSD probe getters, %d probes a second for %ds, ns per probe\n", BENCH_PROBE_HZ, BENCH_SECONDS);
+  printf("snapshot sizes: orientation %zu, aim display %zu, distance %zu bytes\n", sizeof(orientation),
+         sizeof(aim_display), sizeof(distance));
+  printf("%-24s | %8s | %8s %8s %8s %9s\n", "getters", "probes", "p50", "p99", "p99.9", "max");
+  run("mutex, spread", false, false);
+  run("seqlock, spread", true, false);
+  run("mutex, one core", false, true);
+  run("seqlock, one core", true, true);
+  printf("torn seqlock reads: %lu\n", (unsigned long)torn);
+  return torn ? 1 : 0;
+}
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include <thread>
+#include <atomic>
+#include <random>
+
+#include "window_stats.h"
+#include "bench.h"
+
+// window_stats (window_stats.h) against what imu.c used to do, a two pass
+// mean and variance over the whole window every time it was asked.
+//
+// First checks it: streams of gyro like samples go through a window of
+// BENCH_WINDOW samples and every BENCH_CHECK_EVERY samples the snapshot is
+// compared with a two pass over the same window in double. Long runs are
+// there to catch drift, the offset run to catch cancellation (a big mean
+// with a small variance). Exits with 1 if any run is off by more than
+// BENCH_TOLERANCE relative (mean and variance) or at all (min, max).
+//
+// Then a reader thread spins on window_stats_read while samples are added
+// and checks every snapshot it gets is whole (min <= mean <= max).
+//
+// Then the cost: ns per window_stats_add, per window_stats_read and per
+// two pass over the window.
+
+#define BENCH_WINDOW       (550)
+#define BENCH_CHECK_EVERY  (997)
+#define BENCH_TOLERANCE    (1e-9)
+#define BENCH_ADDS         (20000000)
+#define BENCH_TWO_PASSES   (200000)
+
+static float window[BENCH_WINDOW];
+static double relative_error(double value, double expected) {
+  double scale = fabs(expected) > 1e-12 ? fabs(expected) : 1e-12;
+  return fabs(value - expected) / scale;
+}
+
+// Two pass in double over the last count samples, oldest first
+static window_stats_snapshot two_pass(const float* samples, uint32_t count) {
+  window_stats_snapshot expected = {0};
+  expected.count = count;
+  expected.min   = samples[0];
+  expected.max   = samples[0];
+
+  double mean = 0;
+  for(uint32_t i = 0; i < count; i++) {
+    mean += samples[i];
+    expected.min = samples[i] < expected.min ? samples[i] : expected.min;
+    expected.max = samples[i] > expected.max ? samples[i] : expected.max;
+  }
+  mean /= count;
+
+  double m2 = 0;
+  for(uint32_t i = 0; i < count; i++) {
+    m2 += (samples[i] - mean) * (samples[i] - mean);
+  }
+  expected.mean     = mean;
+  expected.variance = m2 / count;
+  return expected;
+}
+
+// The float two pass imu.c had
+static void two_pass_float(const float* samples, uint32_t count, float* mean_out, float* variance_out) {
+  float mean = 0;
+  for(uint32_t i = 0; i < count; i++) {
+    mean += samples[i];
+  }
+  mean = mean / count;
+
+  float sigma = 0;
+  for(uint32_t i = 0; i < count; i++) {
+    sigma += (samples[i] - mean) * (samples[i] - mean);
+  }
+  *mean_out     = mean;
+  *variance_out = sigma / count;
+}
+
+typedef float (*sample_source)(std::mt19937_64& rng, uint64_t i);
+
+// Gyro at rest: a small bias and noise, degrees a second
+static float gyro_at_rest(std::mt19937_64& rng, uint64_t) {
+  std::normal_distribution<float> noise(0.0f, 0.05f);
+  return 0.3f + noise(rng);
+}
+
+// Someone swinging the scope around, big steps between quiet stretches
+static float gyro_moving(std::mt19937_64& rng, uint64_t i) {
+  std::normal_distribution<float> noise(0.0f, 2.0f);
+  return ((i / 5000) % 2 ? 180.0f : -45.0f) + noise(rng) + 30.0f * sinf(i * 0.001f);
+}
+
+// Mean much bigger than the spread, where a naive sum of squares falls
+// apart
+static float big_offset(std::mt19937_64& rng, uint64_t) {
+  std::normal_distribution<float> noise(0.0f, 0.01f);
+  return 1000.0f + noise(rng);
+}
+
+static bool check(const char* name, sample_source source, uint64_t samples) {
+  window_stats stats;
+  if(window_stats_init(&stats, BENCH_WINDOW)) {
+    return false;
+  }
+  std::mt19937_64 rng(1234);
+  double mean_error = 0, variance_error = 0;
+  bool min_max_ok = true;
+
+  for(uint64_t i = 0; i < samples; i++) {
+    float value = source(rng, i);
+    window[i % BENCH_WINDOW] = value;
+    window_stats_add(&stats, value);
+
+    if(i % BENCH_CHECK_EVERY && i != samples - 1) {
+      continue;
+    }
+    // Oldest first, like the samples went in
+    float ordered[BENCH_WINDOW];
+    uint32_t count = i + 1 < BENCH_WINDOW ? i + 1 : BENCH_WINDOW;
+    for(uint32_t k = 0; k < count; k++) {
+      ordered[k] = window[(i + 1 - count + k) % BENCH_WINDOW];
+    }
+    window_stats_snapshot expected = two_pass(ordered, count);
+    window_stats_snapshot got      = window_stats_read(&stats);
+
+    mean_error     = fmax(mean_error, relative_error(got.mean, expected.mean));
+    variance_error = fmax(variance_error, relative_error(got.variance, expected.variance));
+    min_max_ok    &= got.count == expected.count && got.min == expected.min && got.max == expected.max;
+  }
+  window_stats_free(&stats);
+
+  bool ok = min_max_ok && mean_error < BENCH_TOLERANCE && variance_error < BENCH_TOLERANCE;
+  printf("%-10s | %10llu | %11.2e %11.2e | %7s | %s\n", name, (unsigned long long)samples, mean_error, variance_error,
+         min_max_ok ? "exact" : "WRONG", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+// Snapshots must never mix two updates
+static bool check_concurrent_reads() {
+  window_stats stats;
+  if(window_stats_init(&stats, BENCH_WINDOW)) {
+    return false;
+  }
+  std::atomic<bool> done{false};
+  uint64_t reads = 0, torn = 0;
+
+  std::thread reader([&]() {
+    while(!done) {
+      window_stats_snapshot snapshot = window_stats_read(&stats);
+      reads++;
+      if(snapshot.count && (snapshot.mean < snapshot.min - 1e-3 || snapshot.mean > snapshot.max + 1e-3 ||
+                            snapshot.variance < 0)) {
+        torn++;
+      }
+    }
+  });
+
+  // Steps far apart so a snapshot mixing two updates would show
+  std::mt19937_64 rng(99);
+  for(uint64_t i = 0; i < BENCH_ADDS / 4; i++) {
+    window_stats_add(&stats, gyro_moving(rng, i) + ((i / BENCH_WINDOW) % 2 ? 1e4f : -1e4f));
+  }
+  done = true;
+  reader.join();
+  window_stats_free(&stats);
+
+  printf("concurrent reads: %llu snapshots, %llu torn | %s\n", (unsigned long long)reads, (unsigned long long)torn,
+         torn ? "FAILED" : "ok");
+  return 0 == torn;
+}
+
+static void bench() {
+  window_stats stats;
+  if(window_stats_init(&stats, BENCH_WINDOW)) {
+    return;
+  }
+  std::mt19937_64 rng(7);
+  for(uint32_t i = 0; i < BENCH_WINDOW; i++) {
+    window[i] = gyro_moving(rng, i);
+  }
+
+  uint64_t start = now_ns();
+  for(uint64_t i = 0; i < BENCH_ADDS; i++) {
+    window_stats_add(&stats, window[i % BENCH_WINDOW] + (i & 0xFF));
+  }
+  double add_ns = (double)(now_ns() - start) / BENCH_ADDS;
+
+  start = now_ns();
+  for(uint64_t i = 0; i < BENCH_ADDS; i++) {
+    sink = window_stats_read(&stats).variance;
+  }
+  double read_ns = (double)(now_ns() - start) / BENCH_ADDS;
+
+  start = now_ns();
+  for(uint64_t i = 0; i < BENCH_TWO_PASSES; i++) {
+    float mean, variance;
+    window[i % BENCH_WINDOW] += 1e-6f;
+    two_pass_float(window, BENCH_WINDOW, &mean, &variance);
+    sink = variance;
+  }
+  double two_pass_ns = (double)(now_ns() - start) / BENCH_TWO_PASSES;
+  window_stats_free(&stats);
+
+  printf("\nwindow of %d samples\n", BENCH_WINDOW);
+  printf("%-28s %10.1f ns\n", "window_stats_add", add_ns);
+  printf("%-28s %10.1f ns\n", "window_stats_read", read_ns);
+  printf("%-28s %10.1f ns\n", "two pass (float, old imu.c)", two_pass_ns);
+  printf("at 800Hz: %.4f%% of a core to keep the window, a two pass per sample would be %.4f%%\n",
+         add_ns * 800 / 1e7, two_pass_ns * 800 / 1e7);
+}
+
+int main() {
+  printf("window_stats against a two pass in double, window of %d, checked every %d samples\n", BENCH_WINDOW,
+         BENCH_CHECK_EVERY);
+  printf("%-10s | %10s | %11s %11s | %7s |\n", "stream", "samples", "mean err", "var err", "min/max");
+
+  bool ok = true;
+  ok &= check("partial", gyro_at_rest, BENCH_WINDOW / 2);
+  ok &= check("at rest", gyro_at_rest, BENCH_ADDS);
+  ok &= check("moving", gyro_moving, BENCH_ADDS);
+  ok &= check("offset", big_offset, BENCH_ADDS);
+  ok &= check_concurrent_reads();
+
+  bench();
+  return ok ? 0 : 1;
+}
@@ -5,6 +5,8 @@
 #include <assert.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
 
 #include "calibration.h"
 #include "crc.h"
@@ -14,6 +16,12 @@
 #define CALIBRATION_FILE_PATH "/etc/radar"
 #define CALIBRATION_FULL_PATH CALIBRATION_FILE_PATH "/" CALIBRATION_FILE_NAME
 
+#define IMU_CALIBRATION_FILE_NAME "imu_calibration.dat"
+#define IMU_CALIBRATION_FULL_PATH CALIBRATION_FILE_PATH "/" IMU_CALIBRATION_FILE_NAME
+
+// millidegrees C
+#define BOARD_TEMPERATURE_PATH "/sys/class/thermal/thermal_zone0/temp"
+
 static calibration_data_with_crc cal_data;
 static int calibration_fd;
 
@@ -98,3 +106,58 @@ static int open_calibration_file(){
   }
   calibration_fd = rc; 
 }
+
+// Returns -1 if there is no file or it is not one we wrote
+int load_imu_calibration(imu_calibration_t* cal){
+  imu_calibration_with_crc file;
+
+  int fd = open(IMU_CALIBRATION_FULL_PATH, O_RDONLY);
+  if(fd == -1){
+    return -1;
+  }
+  int rc = read(fd, &file, sizeof(file));
+  close(fd);
+
+  if(rc != sizeof(file) || file.version != IMU_CALIBRATION_VERSION){
+    return -1;
+  }
+  if(file.crc32 != crc32((uint8_t*)&file.data, sizeof(file.data))){
+    return -1;
+  }
+  *cal = file.data;
+  return 0;
+}
+
+void save_imu_calibration(const imu_calibration_t* cal){
+  imu_calibration_with_crc file = {0};
+  file.version = IMU_CALIBRATION_VERSION;
+  file.data    = *cal;
+  file.crc32   = crc32((uint8_t*)&file.data, sizeof(file.data));
+
+  int fd = open(IMU_CALIBRATION_FULL_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd == -1){
+    printf("Failed to open IMU calibration file, error %s\n", strerror(errno));
+    return;
+  }
+  if(write(fd, &file, sizeof(file)) != sizeof(file)){
+    printf("Failed to save IMU calibration, error %s\n", strerror(errno));
+  }
+  close(fd);
+}
+
+// Degrees C, NAN if the board doesn't say
+float read_board_temperature(){
+  char buf[16] = {0};
+
+  int fd = open(BOARD_TEMPERATURE_PATH, O_RDONLY);
+  if(fd == -1){
+    return NAN;
+  }
+  int rc = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+
+  if(rc <= 0){
+    return NAN;
+  }
+  return atoi(buf) / 1000.0f;
+}
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <stdint.h>
-#include <stdint.h>
+#include <stddef.h>
 #include "menu.h"
 
 #define MAX_CALIBRATION_POINTS (20)
@@ -25,14 +25,46 @@
 typedef struct{
   int16_t drop_calibration_points[MAX_CALIBRATION_POINTS];
   int16_t lead_calibration_points[MAX_CALIBRATION_POINTS][MAX_CALIBRATION_POINTS];
-} __attribute__((packed)) calibration_data_t;
+} calibration_data_t;
 
+// This is the calibration file as is. Not packed, everything is naturally
+// aligned without padding, so the layout is the same one the packed
+// version wrote and old files still load. The asserts keep it that way.
 typedef struct{
   uint32_t crc32;
   calibration_data_t data;
-} __attribute__((packed)) calibration_data_with_crc;
+} calibration_data_with_crc;
+
+_Static_assert(sizeof(calibration_data_t) == 840, "calibration file layout changed");
+_Static_assert(offsetof(calibration_data_with_crc, data) == 4, "calibration file layout changed");
+_Static_assert(sizeof(calibration_data_with_crc) == 844, "calibration file layout changed");
+
+// Gyro bias (see imu_bias.h) as last estimated, kept next to the bullet
+// calibration in a file of its own so a restart can use it right away.
+// The temperature is the Jetson's, the IMU has no sensor of its own but
+// sits in the same box.
+typedef struct{
+  float   gyro_bias[3];   // rad/s, r_p r_r r_y as the sensor board sends them
+  float   temperature;    // degrees C when estimated, NAN if unknown
+  int64_t saved_at;       // seconds from epoch
+} imu_calibration_t;
+
+typedef struct{
+  uint32_t crc32;
+  uint32_t version;
+  imu_calibration_t data;
+} imu_calibration_with_crc;
+
+#define IMU_CALIBRATION_VERSION (1)
+
+_Static_assert(sizeof(imu_calibration_t) == 24, "IMU calibration file layout changed");
+_Static_assert(offsetof(imu_calibration_with_crc, data) == 8, "IMU calibration file layout changed");
+_Static_assert(sizeof(imu_calibration_with_crc) == 32, "IMU calibration file layout changed");
 
 void save_calibration_data_with_crc(void);
 int load_calibration_data_and_verify_crc(void);
 void save_calibration_value(calibration_enum_e, uint16_t, uint16_t, int16_t);
 int16_t fetch_calibration_value(calibration_enum_e, uint16_t, uint16_t);
+int  load_imu_calibration(imu_calibration_t*);
+void save_imu_calibration(const imu_calibration_t*);
+float read_board_temperature(void);
@@ -51,7 +51,8 @@ static void draw_bounding_box_corner(NvDsFrameMeta *, NvDsDisplayMeta *, nv_ods_
 static void extract_inference(NvDsMetaList*, NvDsFrameMeta*, inference_detected_t*);
 
 static mqd_t inference_output_mq; 
-static mqd_t crosshair_input_mq;
+static mq_topic inference_topic;
+static shm_mailbox crosshair_mailbox;
 
 static int bounding_box_enable_overide;
  
@@ -129,10 +130,13 @@ static void extract_inference(NvDsMetaList * l_frame, NvDsFrameMeta *frame_meta,
         bounding_box_ptr->valid = true;
         memcpy(bounding_box_ptr, &bounding_box, sizeof(bounding_box));       
 
-        printf("Sending sample @ time %f\n", get_ms_since_start()); 
-        int rc = mq_send(inference_output_mq, (char*)&bounding_box, sizeof(inference_detected_t), 0);
-        if(rc) {
-          puts("Failed to send out of inference pipeline");
+        if(topic_wanted(&inference_topic)) {
+          printf("Sending sample @ time %f\n", get_ms_since_start()); 
+          int rc = mq_send(inference_output_mq, (char*)&bounding_box, sizeof(inference_detected_t), 0);
+          mq_topic_sent(&inference_topic, 0 == rc);
+          if(rc) {
+            puts("Failed to send out of inference pipeline");
+          }
         }
       }
   }
@@ -441,12 +445,17 @@ static void draw_target(NvDsFrameMeta *frame_meta, NvDsDisplayMeta *display_meta
 #define COS_45_DEGREES                  (SINE_45_DEGREES)
 
 
-  char mq_buff[MESSAGE_QUEUE_SIZE];
-  int rc = mq_receive(crosshair_input_mq, mq_buff, MESSAGE_QUEUE_SIZE, NULL);
-  if(rc == -1) {
+  // The aim state machine publishes when the aim point changes (new
+  // inference), not per video frame, keep drawing the last one it sent
+  static aim_overlay_t latest_aim_overlay;
+  static bool has_aim_overlay;
+  if(shm_mailbox_read(&crosshair_mailbox, &latest_aim_overlay, sizeof(latest_aim_overlay), NULL)) {
+    has_aim_overlay = true;
+  }
+  if(!has_aim_overlay) {
     return;
   }
-  aim_overlay_t *aim_overlay = (aim_overlay_t*)mq_buff;
+  aim_overlay_t *aim_overlay = &latest_aim_overlay;
   
   NvOSD_CircleParams *circle_params = &display_meta->circle_params[0];
   NvOSD_RectParams   *rect_params = &display_meta->rect_params[0];
@@ -700,7 +709,9 @@ int deepstream_init(uint32_t unix_time_in_seconds, prog_config_t config)
 
   /* Create the message queues used */
   inference_output_mq = open_mq(MESSAGE_QUEUE_OUTPUT_INF, O_WRONLY | O_CREAT | O_NONBLOCK);  
-  crosshair_input_mq  = open_mq(MESSAGE_QUEUE_CROSS,      O_RDONLY | O_CREAT | O_NONBLOCK);  
+  inference_topic     = publish_topic(MESSAGE_QUEUE_OUTPUT_INF, MQ_TOPIC_MQUEUE);
+  open_mailbox(&crosshair_mailbox, MAILBOX_CROSS, sizeof(aim_overlay_t));
+  subscribe_topic(MAILBOX_CROSS, MQ_TOPIC_MAILBOX);
 
   /* Standard GStreamer initialization */
   gst_init (&argc, &argv_p);
@@ -32,6 +32,7 @@ typedef struct{
   bool has_zoom;
   bool force_bb;
   bool calibrate_imu_on_boot;
+  bool quantized_radar_dump;
 } prog_config_t;
 
 typedef struct{
@@ -8,164 +8,290 @@
 #include <errno.h>
 #include <unistd.h>
 #include <math.h>
+#include <sys/eventfd.h>
 
 #include "sensor_board_tlv.h"
+#include "shm_ring.h"
+#include "imu_batch.h"
+#include "window_stats.h"
+#include "imu_history.h"
+#include "imu_fusion.h"
+#include "imu_bias.h"
+#include "seqlock.h"
 #include "imu.h"
+#include "calibration.h"
+#include "reactor.h"
+#include "time.h"
 
-static mqd_t imu_mq;
+// A cached gyro bias is used if it is this recent and was estimated
+// within this many degrees of the current board temperature
+#define IMU_BIAS_CACHE_MAX_AGE_S   (30*24*3600)
+#define IMU_BIAS_CACHE_MAX_TEMP_C  (10)
+// Saved again when an estimate moves this far from the saved one (rad/s)
+#define IMU_BIAS_SAVE_DELTA        (0.001f)
+
+static shm_ring imu_ring;
 static pthread_t imu_th;
 
-static float roll_degrees;
-static float pitch_degrees;
-static float angular_rotation_degrees;
-static float gyro_rotation_samples[TOTAL_SAMPLES_FOR_VARIANCE];
-static float calibrated_rotation_offset;
+static window_stats gyro_rotation_stats;
+static imu_history  imu_samples;
+static imu_fusion   orientation_filter;
+
+// Subtracted from every sample, sensor axes (rad/s). IMU thread only.
+static imu_bias gyro_bias_estimator;
+static float    gyro_bias[3];
+static float    saved_gyro_bias[3];
+static int      gyro_bias_saved;
+
+// Estimates to save, handed to the reactor thread
+static SEQLOCK_SNAPSHOT(imu_calibration_t) bias_to_save;
+static int bias_save_fd;
 
-static imu_t rolling_average_imu_sample;
-static pthread_mutex_t imu_sample_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t calculate_imu_variance = PTHREAD_MUTEX_INITIALIZER;
+// Read by the OSD probe every frame, see seqlock.h
+static SEQLOCK_SNAPSHOT(pitch_roll_rot_t) orientation;
 
 static void* imu_thread(void*);
 
 static void open_imu_mq(){
-  imu_mq = open_mq(MESSAGE_QUEUE_NAME_IMU_DISPLAY, O_RDONLY | O_CREAT);
-}
-
-float calibrate_imu(){
-#define COUNT_CALIBRATION (5)
-  float gyro_history[COUNT_CALIBRATION];
- 
-  for(int i = 0; i < COUNT_CALIBRATION; i++){
-    sleep(2);
-    rotation_analysis_t rot = calculate_mean_rotation_and_variance();
-    gyro_history[i] = rot.mean_rotation;
-  }
-  
-  float rot = 0;
-  for(int i = 0; i < COUNT_CALIBRATION; i++){
-    rot += gyro_history[i];
+  // Batches of samples from the sensor program, see imu_batch.h
+  if(shm_ring_open(&imu_ring, IMU_BATCH_RING_PATH, IMU_BATCH_RING_SLOTS, sizeof(imu_batch))){
+    assert(0);
   }
-
-  calibrated_rotation_offset = rot/COUNT_CALIBRATION;
-  printf("IMU calibrated with angular offset = %f\n", calibrated_rotation_offset);
+  shm_ring_skip_to_latest(&imu_ring);
+  subscribe_topic(IMU_BATCH_RING_PATH, MQ_TOPIC_RING);
 }
 
-rotation_analysis_t calculate_mean_rotation_and_variance(){
-  float mean = 0;
-  rotation_analysis_t rot_var;
+// Reactor thread, file I/O stays off the IMU thread
+static void on_bias_estimate(int fd){
+  uint64_t count;
+  imu_calibration_t cal;
 
-  pthread_mutex_unlock(&calculate_imu_variance);
+  read(fd, &count, sizeof(count));
+  SEQLOCK_LOAD(&bias_to_save, cal);
+  cal.temperature = read_board_temperature();
+  cal.saved_at    = get_seconds_from_epoch();
+  save_imu_calibration(&cal);
+  printf("IMU gyro bias %f %f %f rad/s saved (%.1fC)\n", cal.gyro_bias[0], cal.gyro_bias[1], cal.gyro_bias[2],
+         cal.temperature);
+}
 
-  // First, we need to find the mean  
-  for(int i = 0; i < TOTAL_SAMPLES_FOR_VARIANCE; i++){
-    mean += gyro_rotation_samples[i];
+// What a restart can start with, before the estimator has seen the scope
+// sit still
+static void load_cached_gyro_bias(){
+  imu_calibration_t cal;
+  if(load_imu_calibration(&cal)){
+    puts("No cached IMU gyro bias");
+    return;
   }
-  mean = mean/TOTAL_SAMPLES_FOR_VARIANCE;
 
-  float sigma_square_mean_minus_val = 0;
-  for(int i = 0; i < TOTAL_SAMPLES_FOR_VARIANCE; i++){
-    sigma_square_mean_minus_val += (gyro_rotation_samples[i] - mean)*(gyro_rotation_samples[i] - mean);
+  int64_t age = get_seconds_from_epoch() - cal.saved_at;
+  float temperature = read_board_temperature();
+  // A temperature the board didn't report, then or now, can't be compared
+  if(age < 0 || age > IMU_BIAS_CACHE_MAX_AGE_S || isnan(temperature) || isnan(cal.temperature) ||
+     fabsf(temperature - cal.temperature) > IMU_BIAS_CACHE_MAX_TEMP_C){
+    printf("Cached IMU gyro bias is stale (%llds old, %.1fC then, %.1fC now)\n", (long long)age,
+           cal.temperature, temperature);
+    return;
   }
 
-  pthread_mutex_unlock(&calculate_imu_variance);
-
-  rot_var.mean_rotation     = mean - calibrated_rotation_offset;
-  rot_var.variance_rotation = sigma_square_mean_minus_val/TOTAL_SAMPLES_FOR_VARIANCE;
-  return rot_var;
+  memcpy(gyro_bias, cal.gyro_bias, sizeof(gyro_bias));
+  memcpy(saved_gyro_bias, cal.gyro_bias, sizeof(saved_gyro_bias));
+  gyro_bias_saved = 1;
+  printf("Using cached IMU gyro bias %f %f %f rad/s\n", gyro_bias[0], gyro_bias[1], gyro_bias[2]);
 }
 
-static void imu_store_sample_for_variance_calculation(imu_t* sample){
-  static size_t variance_index;
+// Takes a new estimate, and asks for it to be saved if it is the first
+// one or has moved since
+static void apply_gyro_bias(const float bias[3]){
+  int save = !gyro_bias_saved;
 
-  // Variance calculations can take a bit of time, since we lock
-  // calculate_imu_variance during that time, we will use
-  // a trylock here and exit if we don't get the lock instead
-  // of freezing this entire thread
-  if(-1 == pthread_mutex_trylock(&calculate_imu_variance)){
+  for(int k = 0; k < 3; k++){
+    // What the orientation filter's integral absorbed of the old bias is
+    // now taken out by the new one
+    orientation_filter.integral[k] += bias[k] - gyro_bias[k];
+    gyro_bias[k] = bias[k];
+    save |= fabsf(bias[k] - saved_gyro_bias[k]) > IMU_BIAS_SAVE_DELTA;
+  }
+  if(!save){
     return;
   }
-  gyro_rotation_samples[variance_index] = sample->r_y * DEGREES_IN_RAD;
-  pthread_mutex_unlock(&calculate_imu_variance);
-  
-  if(variance_index == TOTAL_SAMPLES_FOR_VARIANCE - 1){
-    variance_index = 0;
-  } else {
-    variance_index++;
+
+  imu_calibration_t cal = {0};
+  memcpy(cal.gyro_bias, bias, sizeof(cal.gyro_bias));
+  SEQLOCK_PUBLISH(&bias_to_save, cal);
+  memcpy(saved_gyro_bias, bias, sizeof(saved_gyro_bias));
+  gyro_bias_saved = 1;
+
+  uint64_t one = 1;
+  write(bias_save_fd, &one, sizeof(one));
+}
+
+// Feeds the bias estimator the sample as the board sent it, then takes
+// the bias out
+static void imu_correct_sample(imu_t* sample){
+  if(imu_bias_add(&gyro_bias_estimator, sample)){
+    apply_gyro_bias(gyro_bias_estimator.bias);
   }
+  sample->r_p -= gyro_bias[0];
+  sample->r_r -= gyro_bias[1];
+  sample->r_y -= gyro_bias[2];
 }
 
-static int imu_calculate_rolling_average(imu_t* sample){
-#define ROLLING_AVERAGE_SAMPLES (5)
-  static imu_t samples[ROLLING_AVERAGE_SAMPLES];
-  static size_t last_index = 0;
- 
-  samples[(last_index + 1) % ROLLING_AVERAGE_SAMPLES] = *sample;
+// Last TOTAL_SAMPLES_FOR_VARIANCE samples, kept up to date as they come
+// in (see window_stats.h), this only reads the latest snapshot and can be
+// called from any thread
+rotation_analysis_t calculate_mean_rotation_and_variance(){
+  rotation_analysis_t rot_var;
+  window_stats_snapshot stats = window_stats_read(&gyro_rotation_stats);
 
-  imu_t new_average = { 0 };
-  for(int i = 0; i < ROLLING_AVERAGE_SAMPLES; i++) {
-    new_average.a_x += samples[i].a_x;
-    new_average.a_y += samples[i].a_y;
-    new_average.a_z += samples[i].a_z;
-    new_average.r_y += samples[i].r_y;
+  rot_var.mean_rotation     = stats.mean;
+  rot_var.variance_rotation = stats.variance;
+  return rot_var;
+}
+
+// Over the samples taken between start_ns and end_ns (CLOCK_MONOTONIC),
+// see imu_history.h. Returns -1 if there are none.
+int imu_rotation_between(uint64_t start_ns, uint64_t end_ns, rotation_analysis_t* rot_var){
+  imu_history_stats stats;
+  if(imu_history_query(&imu_samples, IMU_AXIS_R_Y, start_ns, end_ns, &stats)){
+    return -1;
   }
 
-  new_average.a_x = new_average.a_x / ROLLING_AVERAGE_SAMPLES;
-  new_average.a_y = new_average.a_y / ROLLING_AVERAGE_SAMPLES;
-  new_average.a_z = new_average.a_z / ROLLING_AVERAGE_SAMPLES;
-  new_average.r_y = new_average.r_y / ROLLING_AVERAGE_SAMPLES;
-  
-  last_index = (last_index + 1) % ROLLING_AVERAGE_SAMPLES;
-  
-  pthread_mutex_lock(&imu_sample_mutex);
-  rolling_average_imu_sample = new_average;
+  rot_var->mean_rotation     = stats.mean * DEGREES_IN_RAD;
+  rot_var->variance_rotation = stats.variance * DEGREES_IN_RAD * DEGREES_IN_RAD;
+  return 0;
+}
 
-  roll_degrees             = DEGREES_IN_RAD*atan(new_average.a_x/new_average.a_z);
-  pitch_degrees            = DEGREES_IN_RAD*atan(new_average.a_y/new_average.a_z);
-  angular_rotation_degrees = DEGREES_IN_RAD*new_average.r_y;
-  pthread_mutex_unlock(&imu_sample_mutex);
+static void imu_store_sample_for_variance_calculation(imu_t* sample){
+  window_stats_add(&gyro_rotation_stats, sample->r_y * DEGREES_IN_RAD);
 }
 
-pitch_roll_rot_t imu_get_orientation(){
-  pitch_roll_rot_t orientation;
+// Display values from the orientation filter (see imu_fusion.h), once
+// per sample or batch
+static void imu_publish_orientation(){
+  imu_fusion_angles angles = imu_fusion_get_angles(&orientation_filter);
+  pitch_roll_rot_t latest;
 
-  pthread_mutex_lock(&imu_sample_mutex);
-  orientation.pitch    = pitch_degrees;
-  orientation.roll     = roll_degrees;
-  orientation.rotation = angular_rotation_degrees;
-  pthread_mutex_unlock(&imu_sample_mutex);
+  latest.pitch      = angles.pitch;
+  latest.roll       = angles.roll;
+  latest.yaw        = angles.yaw;
+  latest.pitch_rate = DEGREES_IN_RAD*orientation_filter.rate[0];
+  latest.roll_rate  = DEGREES_IN_RAD*orientation_filter.rate[1];
+  // Clockwise positive, like r_y after imu_consume_sample
+  latest.rotation   = -DEGREES_IN_RAD*orientation_filter.rate[2];
+  SEQLOCK_PUBLISH(&orientation, latest);
+}
 
-  return orientation;
+// Never waits on the IMU thread
+pitch_roll_rot_t imu_get_orientation(){
+  pitch_roll_rot_t current;
+  SEQLOCK_LOAD(&orientation, current);
+  return current;
 }
 
-static int get_imu_sample(char* sample){
+static int imu_sample_valid(const imu_t* sample){
 #define MAX_ACCELERATION 30 // Gs experienced in a car crash - reasonable limit
-  assert(sample);
-  imu_t* imu_ptr;
-
-  int rc = mq_receive(imu_mq, sample, MESSAGE_QUEUE_SIZE, NULL);
-  if(-1 == rc){
-    printf("Failed to recieve from message queue, error: %s\n",strerror(errno));
-    return -1;
-  }
-  
-  imu_ptr = (imu_t*)(sample);
-  if(imu_ptr->a_x > MAX_ACCELERATION || imu_ptr->a_y > MAX_ACCELERATION || imu_ptr->a_z > MAX_ACCELERATION){
+  if(sample->a_x > MAX_ACCELERATION || sample->a_y > MAX_ACCELERATION || sample->a_z > MAX_ACCELERATION){
     printf("Unexpectedly high acceleration...");
-    return -1;
+    return 0;
   }
+  return 1;
+}
 
+// Everything but the orientation filter, which needs the sample as the
+// sensor gave it
+static void imu_consume_sample(imu_t* sample, uint64_t received_ns){
   // Make clockwise spin positive
-  imu_ptr->r_y *= -1;
+  sample->r_y *= -1;
+
+  imu_store_sample_for_variance_calculation(sample);
+  imu_history_add(&imu_samples, sample, received_ns);
+}
+
+// Validates and consumes a sample, called in process mode (TLV_INPROC)
+// straight from the tlv-processor thread. received_ns is when the sample
+// arrived (CLOCK_MONOTONIC), 0 if not known.
+int imu_handle_sample(imu_t* imu_ptr, uint64_t received_ns){
+  assert(imu_ptr);
+
+  if(!imu_sample_valid(imu_ptr)){
+    return -1;
+  }
+
+  imu_correct_sample(imu_ptr);
 
   // Gets fed to display, always ongoing
-  imu_calculate_rolling_average(imu_ptr);
+  imu_fusion_update(&orientation_filter, imu_ptr);
+  imu_publish_orientation();
 
-  imu_store_sample_for_variance_calculation(imu_ptr);
-  
+  imu_consume_sample(imu_ptr, received_ns);
   return 0;
 }
 
-void init_imu_thread(){
+// Blocks until the sensor program publishes a batch, then runs the valid
+// samples of it through the orientation filter in one go and the rest of
+// the IMU code one by one. Returns the number of samples handled.
+static int get_imu_batch(){
+#define IMU_SAMPLE_TIMEOUT_MS (1000)
+  uint32_t len;
+  const imu_batch* batch = shm_ring_peek(&imu_ring, &len, IMU_SAMPLE_TIMEOUT_MS);
+  if(!batch){
+    printf("No IMU sample in %dms\n", IMU_SAMPLE_TIMEOUT_MS);
+    return 0;
+  }
+
+  // imu_consume_sample flips r_y, don't touch the ring
+  imu_t samples[IMU_BATCH_MAX_SAMPLES];
+  uint64_t received_ns = 0;
+  int count = 0;
+  if(len >= imu_batch_size(0) && batch->count <= IMU_BATCH_MAX_SAMPLES && len == imu_batch_size(batch->count)){
+    // Only the batch's arrival time is known, it goes with whichever
+    // sample comes first, imu_history lines the board clock up with it
+    received_ns = batch->received_ns;
+    for(int i = 0; i < batch->count; i++){
+      if(imu_sample_valid(&batch->samples[i])){
+        samples[count] = batch->samples[i];
+        imu_correct_sample(&samples[count++]);
+      }
+    }
+  } else {
+    printf("Dropping IMU batch of %u bytes\n", len);
+  }
+  shm_ring_release(&imu_ring);
+
+  if(count){
+    imu_fusion_update_batch(&orientation_filter, samples, count);
+    imu_publish_orientation();
+  }
+  for(int i = 0; i < count; i++){
+    imu_consume_sample(&samples[i], i ? 0 : received_ns);
+  }
+  return count;
+}
+
+// use_cached_bias 0 starts without the saved gyro bias, it gets
+// estimated again as soon as the scope is still
+void init_imu_thread(int use_cached_bias){
+  if(window_stats_init(&gyro_rotation_stats, TOTAL_SAMPLES_FOR_VARIANCE) ||
+     imu_history_init(&imu_samples, IMU_HISTORY_DEFAULT_SAMPLES)){
+    assert(0);
+  }
+  imu_fusion_init(&orientation_filter, IMU_FUSION_DEFAULT_KP, IMU_FUSION_DEFAULT_KI);
+  imu_bias_init(&gyro_bias_estimator);
+  if(use_cached_bias){
+    load_cached_gyro_bias();
+  }
+
+  bias_save_fd = eventfd(0, EFD_NONBLOCK);
+  if(bias_save_fd == -1){
+    assert(0);
+  }
+  reactor_watch(bias_save_fd, on_bias_estimate);
+
+#ifdef TLV_INPROC
+  // Samples come in through imu_handle_sample, on the tlv-processor thread
+  return;
+#endif
   open_imu_mq();
   
   int rc = pthread_create(&imu_th, NULL, imu_thread, NULL);
@@ -176,16 +302,10 @@ void init_imu_thread(){
 }
 
 static void* imu_thread(void* arg){
-#define IMU_PERIOD_DISPLAY (1250000) // 800Hz
   printf("IMU thread staring.\n");
 
-  struct timespec sleep_frame_duration;
-  sleep_frame_duration.tv_sec  = 0;
-  sleep_frame_duration.tv_nsec = IMU_PERIOD_DISPLAY;
- 
-  char mq_buff[MESSAGE_QUEUE_SIZE]; 
+  // Paced by the sensor program (800Hz), one wake up per batch
   while(1){
-    nanosleep(&sleep_frame_duration, NULL);
-    get_imu_sample(mq_buff);
+    get_imu_batch();
   }
 }
@@ -1,15 +1,19 @@
 #pragma once
 
 #include "mq.h"
+#include "sensor_board_tlv.h"
 
 #define DEGREES_IN_RAD (57.2958)
-#define MESSAGE_QUEUE_NAME_IMU_DISPLAY "/mq_imu_display"
 #define TOTAL_SAMPLES_FOR_VARIANCE (550)
 
+// Degrees and degrees a second, from the orientation filter
 typedef struct{
   float pitch;
   float roll;
-  float rotation;
+  float yaw;        // since power on, drifts (no magnetometer)
+  float rotation;   // yaw rate, clockwise positive
+  float pitch_rate;
+  float roll_rate;
 } pitch_roll_rot_t;
 
 typedef struct{
@@ -17,7 +21,8 @@ typedef struct{
   float variance_rotation;
 } rotation_analysis_t;
 
-float calibrate_imu(void);
-void init_imu_thread(void);
+void init_imu_thread(int use_cached_bias);
+int  imu_handle_sample(imu_t*, uint64_t received_ns);
 pitch_roll_rot_t imu_get_orientation(void);
 rotation_analysis_t calculate_mean_rotation_and_variance(void);
+int imu_rotation_between(uint64_t start_ns, uint64_t end_ns, rotation_analysis_t* rot_var);
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "sensor_board_tlv.h"
+
+// Gyro bias, estimated whenever the scope sits still. Samples are taken
+// IMU_BIAS_BLOCK at a time. A block is still if no gyro or accelerometer
+// axis moves more than noise within it, consecutive still blocks make a
+// run, and the bias is the mean gyro over the run once it is long and
+// quiet enough (IMU_BIAS_MIN_SAMPLES, standard error under
+// IMU_BIAS_MAX_ERROR). With the noise of the board's gyro that is about
+// a third of a second of stillness.
+//
+// A run keeps refining the estimate for as long as it lasts, older
+// samples fading out after IMU_BIAS_MAX_RUN so a warming board is
+// followed. Movement ends the run, the last estimate stays.
+//
+// A block whose mean is off the run's by more than IMU_BIAS_MAX_STEP
+// starts a new run. A turn perfectly smooth from the start of a run
+// still looks like bias, nothing but the gyro can tell, but a hand
+// holding the scope is never that smooth.
+//
+// Sensor axes and units (r_p, r_r, r_y in rad/s as the board sends them,
+// before imu.c flips r_y).
+//
+// One thread adds samples.
+
+#define IMU_BIAS_BLOCK          (40)       // 50ms at 800Hz
+#define IMU_BIAS_MAX_GYRO_STD   (0.015f)   // rad/s, within a block
+#define IMU_BIAS_MAX_ACCEL_STD  (0.2f)     // m/s^2, within a block
+#define IMU_BIAS_MAX_STEP       (0.005f)   // rad/s, block mean against run mean
+#define IMU_BIAS_MIN_SAMPLES    (240)      // 0.3s at 800Hz
+#define IMU_BIAS_MAX_ERROR      (0.0005f)  // rad/s, standard error of the estimate
+#define IMU_BIAS_MAX_RUN        (48000)    // a minute at 800Hz, then older samples fade
+
+typedef struct {
+  // Current block, gyro then accelerometer
+  uint32_t block_n;
+  double   block_sum[6];
+  double   block_sum_sq[6];
+
+  // Current run of still blocks, gyro only
+  double   run_n;
+  double   run_sum[3];
+  double   run_sum_sq[3];
+
+  float    bias[3];      // rad/s, valid once estimates > 0
+  float    error;        // standard error of bias, worst axis (rad/s)
+  uint32_t estimates;    // times bias was updated
+} imu_bias;
+
+static inline void imu_bias_init(imu_bias* b) {
+  memset(b, 0, sizeof(*b));
+}
+
+static inline void imu_bias_restart_run(imu_bias* b) {
+  b->run_n = 0;
+  memset(b->run_sum, 0, sizeof(b->run_sum));
+  memset(b->run_sum_sq, 0, sizeof(b->run_sum_sq));
+}
+
+// Ends the block: still or not, and the run it belongs to. Returns 1 if
+// the run is good enough for an estimate.
+static inline int imu_bias_end_block(imu_bias* b) {
+  double n = b->block_n;
+  int still = 1;
+
+  for(int k = 0; k < 6; k++) {
+    double mean     = b->block_sum[k] / n;
+    double variance = b->block_sum_sq[k] / n - mean * mean;
+    double max_std  = k < 3 ? IMU_BIAS_MAX_GYRO_STD : IMU_BIAS_MAX_ACCEL_STD;
+    still &= variance < max_std * max_std;
+  }
+  if(!still) {
+    imu_bias_restart_run(b);
+    return 0;
+  }
+
+  if(b->run_n > 0) {
+    for(int k = 0; k < 3; k++) {
+      if(fabs(b->block_sum[k] / n - b->run_sum[k] / b->run_n) > IMU_BIAS_MAX_STEP) {
+        imu_bias_restart_run(b);
+        break;
+      }
+    }
+  }
+
+  if(b->run_n >= IMU_BIAS_MAX_RUN) {
+    b->run_n /= 2;
+    for(int k = 0; k < 3; k++) {
+      b->run_sum[k]    /= 2;
+      b->run_sum_sq[k] /= 2;
+    }
+  }
+  b->run_n += n;
+  for(int k = 0; k < 3; k++) {
+    b->run_sum[k]    += b->block_sum[k];
+    b->run_sum_sq[k] += b->block_sum_sq[k];
+  }
+  if(b->run_n < IMU_BIAS_MIN_SAMPLES) {
+    return 0;
+  }
+
+  float bias[3], error = 0;
+  for(int k = 0; k < 3; k++) {
+    double mean     = b->run_sum[k] / b->run_n;
+    double variance = fmax(b->run_sum_sq[k] / b->run_n - mean * mean, 0);
+    bias[k] = (float)mean;
+    error   = fmaxf(error, (float)sqrt(variance / b->run_n));
+  }
+  if(error > IMU_BIAS_MAX_ERROR) {
+    return 0;
+  }
+  memcpy(b->bias, bias, sizeof(bias));
+  b->error = error;
+  b->estimates++;
+  return 1;
+}
+
+// Returns 1 when bias was updated by this sample
+static inline int imu_bias_add(imu_bias* b, const imu_t* sample) {
+  const float v[6] = { sample->r_p, sample->r_r, sample->r_y, sample->a_x, sample->a_y, sample->a_z };
+
+  for(int k = 0; k < 6; k++) {
+    b->block_sum[k]    += v[k];
+    b->block_sum_sq[k] += (double)v[k] * v[k];
+  }
+  if(++b->block_n < IMU_BIAS_BLOCK) {
+    return 0;
+  }
+
+  int updated = imu_bias_end_block(b);
+  b->block_n = 0;
+  memset(b->block_sum, 0, sizeof(b->block_sum));
+  memset(b->block_sum_sq, 0, sizeof(b->block_sum_sq));
+  return updated;
+}
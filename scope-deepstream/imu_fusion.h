@@ -0,0 +1,258 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "sensor_board_tlv.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Attitude of the scope as a quaternion, Mahony's complementary filter
+// run on every IMU sample. The gyro is integrated with the real time step
+// (cpu_cycles_since_boot, 32768 a second), the accelerometer pulls the
+// estimate back towards gravity with a proportional and an integral term.
+// The integral term ends up as the gyro bias, imu_fusion.integral holds
+// its negative.
+//
+// Samples where the accelerometer reads far from 1g (recoil, the scope
+// being swung) only go through the gyro, gravity can't be told apart from
+// the rest of the acceleration in them.
+//
+// Axes are the sensor's: a_x/a_y/a_z and r_p/r_r/r_y are x/y/z, gyro in
+// rad/s, accelerometer in m/s^2, right handed (imu.c flips r_y for its
+// own use after this).
+//
+// imu_fusion_update_batch takes a whole imu_batch. The recursion is
+// sequential but what feeds it is not: the normalized, gated
+// accelerometer of every sample is worked out first, 4 samples a vector
+// (SSE2 on x86, NEON on the Jetson, plain C anywhere else).
+//
+// One thread updates, reads need whatever lock the caller already holds.
+
+#define IMU_FUSION_BOARD_HZ    (32768)
+#define IMU_FUSION_GRAVITY     (9.80665f)
+#define IMU_FUSION_MIN_G       (0.85f)   // accelerometer is trusted between these
+#define IMU_FUSION_MAX_G       (1.15f)
+#define IMU_FUSION_MAX_DT      (0.1f)    // a bigger gap restarts the filter from the accelerometer
+#define IMU_FUSION_DEFAULT_KP  (2.0f)    // ~0.5s to settle on gravity
+#define IMU_FUSION_DEFAULT_KI  (0.1f)
+#define IMU_FUSION_CHUNK       (32)      // samples preprocessed at a time, a full imu_batch
+
+typedef struct {
+  float    q[4];          // w, x, y, z, sensor to world
+  float    integral[3];   // added to the gyro, -bias (rad/s)
+  float    rate[3];       // last bias corrected gyro (rad/s)
+  float    kp;
+  float    ki;
+  uint32_t last_cycles;
+  int      initialized;
+} imu_fusion;
+
+// Degrees, tilt worked out from the estimated gravity the same way it
+// used to be from the accelerometer. Yaw is from the start and drifts,
+// there is no magnetometer.
+typedef struct {
+  float pitch;
+  float roll;
+  float yaw;
+} imu_fusion_angles;
+
+static inline void imu_fusion_init(imu_fusion* fusion, float kp, float ki) {
+  memset(fusion, 0, sizeof(*fusion));
+  fusion->q[0] = 1.0f;
+  fusion->kp   = kp;
+  fusion->ki   = ki;
+}
+
+// Level with gravity, yaw 0
+static inline void imu_fusion_reset_to(imu_fusion* fusion, float a_x, float a_y, float a_z) {
+  float roll  = atan2f(a_y, a_z);
+  float pitch = atan2f(-a_x, sqrtf(a_y * a_y + a_z * a_z));
+  float cr = cosf(roll / 2), sr = sinf(roll / 2);
+  float cp = cosf(pitch / 2), sp = sinf(pitch / 2);
+
+  fusion->q[0] = cr * cp;
+  fusion->q[1] = sr * cp;
+  fusion->q[2] = cr * sp;
+  fusion->q[3] = -sr * sp;
+}
+
+// One step, accelerometer already normalized. trust_accel is 0 or 1.
+static inline void imu_fusion_step(imu_fusion* fusion, float g_x, float g_y, float g_z, float a_x, float a_y,
+                                   float a_z, float trust_accel, float dt) {
+  float* q = fusion->q;
+
+  // Half the gravity direction the estimate expects, in the sensor frame
+  float half_vx = q[1] * q[3] - q[0] * q[2];
+  float half_vy = q[0] * q[1] + q[2] * q[3];
+  float half_vz = q[0] * q[0] - 0.5f + q[3] * q[3];
+
+  // How far the measured gravity is off from it
+  float half_ex = (a_y * half_vz - a_z * half_vy) * trust_accel;
+  float half_ey = (a_z * half_vx - a_x * half_vz) * trust_accel;
+  float half_ez = (a_x * half_vy - a_y * half_vx) * trust_accel;
+
+  fusion->integral[0] += 2.0f * fusion->ki * half_ex * dt;
+  fusion->integral[1] += 2.0f * fusion->ki * half_ey * dt;
+  fusion->integral[2] += 2.0f * fusion->ki * half_ez * dt;
+  g_x += fusion->integral[0];
+  g_y += fusion->integral[1];
+  g_z += fusion->integral[2];
+  fusion->rate[0] = g_x;
+  fusion->rate[1] = g_y;
+  fusion->rate[2] = g_z;
+
+  g_x = (g_x + 2.0f * fusion->kp * half_ex) * 0.5f * dt;
+  g_y = (g_y + 2.0f * fusion->kp * half_ey) * 0.5f * dt;
+  g_z = (g_z + 2.0f * fusion->kp * half_ez) * 0.5f * dt;
+
+  float w = q[0], x = q[1], y = q[2], z = q[3];
+  q[0] += -x * g_x - y * g_y - z * g_z;
+  q[1] +=  w * g_x + y * g_z - z * g_y;
+  q[2] +=  w * g_y - x * g_z + z * g_x;
+  q[3] +=  w * g_z + x * g_y - y * g_x;
+
+  float norm = 1.0f / sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+  q[0] *= norm;
+  q[1] *= norm;
+  q[2] *= norm;
+  q[3] *= norm;
+}
+
+// Normalizes count accelerometer readings (SoA) in place, trust is 1 where
+// the reading is within IMU_FUSION_MIN_G..IMU_FUSION_MAX_G of gravity and
+// 0 otherwise. count is a multiple of 4, pad with zeros.
+static inline void imu_fusion_normalize(float* a_x, float* a_y, float* a_z, float* trust, uint32_t count) {
+  const float min_sq = (IMU_FUSION_MIN_G * IMU_FUSION_GRAVITY) * (IMU_FUSION_MIN_G * IMU_FUSION_GRAVITY);
+  const float max_sq = (IMU_FUSION_MAX_G * IMU_FUSION_GRAVITY) * (IMU_FUSION_MAX_G * IMU_FUSION_GRAVITY);
+  uint32_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128 min_v = _mm_set1_ps(min_sq), max_v = _mm_set1_ps(max_sq), one = _mm_set1_ps(1.0f);
+  for(; i < count; i += 4) {
+    __m128 x = _mm_loadu_ps(a_x + i), y = _mm_loadu_ps(a_y + i), z = _mm_loadu_ps(a_z + i);
+    __m128 norm_sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+    __m128 ok = _mm_and_ps(_mm_cmpge_ps(norm_sq, min_v), _mm_cmple_ps(norm_sq, max_v));
+    // Rejected readings (0 among them) are not divided by
+    __m128 safe = _mm_or_ps(_mm_and_ps(ok, norm_sq), _mm_andnot_ps(ok, one));
+    __m128 inv  = _mm_and_ps(_mm_div_ps(one, _mm_sqrt_ps(safe)), ok);
+    _mm_storeu_ps(a_x + i, _mm_mul_ps(x, inv));
+    _mm_storeu_ps(a_y + i, _mm_mul_ps(y, inv));
+    _mm_storeu_ps(a_z + i, _mm_mul_ps(z, inv));
+    _mm_storeu_ps(trust + i, _mm_and_ps(ok, one));
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const float32x4_t min_v = vdupq_n_f32(min_sq), max_v = vdupq_n_f32(max_sq), one = vdupq_n_f32(1.0f);
+  for(; i < count; i += 4) {
+    float32x4_t x = vld1q_f32(a_x + i), y = vld1q_f32(a_y + i), z = vld1q_f32(a_z + i);
+    float32x4_t norm_sq = vfmaq_f32(vfmaq_f32(vmulq_f32(x, x), y, y), z, z);
+    uint32x4_t  ok      = vandq_u32(vcgeq_f32(norm_sq, min_v), vcleq_f32(norm_sq, max_v));
+    float32x4_t inv     = vdivq_f32(one, vsqrtq_f32(vbslq_f32(ok, norm_sq, one)));
+    inv = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(inv), ok));
+    vst1q_f32(a_x + i, vmulq_f32(x, inv));
+    vst1q_f32(a_y + i, vmulq_f32(y, inv));
+    vst1q_f32(a_z + i, vmulq_f32(z, inv));
+    vst1q_f32(trust + i, vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(one), ok)));
+  }
+#else
+  for(; i < count; i++) {
+    float norm_sq = a_x[i] * a_x[i] + a_y[i] * a_y[i] + a_z[i] * a_z[i];
+    float inv     = 0;
+    trust[i]      = 0;
+    if(norm_sq >= min_sq && norm_sq <= max_sq) {
+      inv      = 1.0f / sqrtf(norm_sq);
+      trust[i] = 1;
+    }
+    a_x[i] *= inv;
+    a_y[i] *= inv;
+    a_z[i] *= inv;
+  }
+#endif
+}
+
+// Seconds since the sample before, or a negative number if the filter has
+// to start over (first sample, a gap, the board clock went backwards)
+static inline float imu_fusion_dt(imu_fusion* fusion, uint32_t cycles) {
+  uint32_t delta = cycles - fusion->last_cycles;
+  int      started = fusion->initialized;
+
+  fusion->last_cycles = cycles;
+  fusion->initialized = 1;
+  if(!started || (delta & 0x80000000u)) {
+    return -1;
+  }
+  float dt = (float)delta / IMU_FUSION_BOARD_HZ;
+  return dt > IMU_FUSION_MAX_DT ? -1 : dt;
+}
+
+static inline void imu_fusion_update_batch(imu_fusion* fusion, const imu_t* samples, uint32_t count) {
+  float a_x[IMU_FUSION_CHUNK], a_y[IMU_FUSION_CHUNK], a_z[IMU_FUSION_CHUNK], trust[IMU_FUSION_CHUNK];
+
+  for(uint32_t start = 0; start < count; start += IMU_FUSION_CHUNK) {
+    const imu_t* chunk = samples + start;
+    uint32_t n = count - start < IMU_FUSION_CHUNK ? count - start : IMU_FUSION_CHUNK;
+    uint32_t padded = (n + 3) & ~3u;
+
+    for(uint32_t i = 0; i < padded; i++) {
+      a_x[i] = i < n ? chunk[i].a_x : 0;
+      a_y[i] = i < n ? chunk[i].a_y : 0;
+      a_z[i] = i < n ? chunk[i].a_z : 0;
+    }
+    imu_fusion_normalize(a_x, a_y, a_z, trust, padded);
+
+    for(uint32_t i = 0; i < n; i++) {
+      float dt = imu_fusion_dt(fusion, chunk[i].cpu_cycles_since_boot);
+      if(dt < 0) {
+        if(trust[i]) {
+          imu_fusion_reset_to(fusion, a_x[i], a_y[i], a_z[i]);
+        }
+        continue;
+      }
+      imu_fusion_step(fusion, chunk[i].r_p, chunk[i].r_r, chunk[i].r_y, a_x[i], a_y[i], a_z[i], trust[i], dt);
+    }
+  }
+}
+
+static inline void imu_fusion_update(imu_fusion* fusion, const imu_t* sample) {
+  float a_x = sample->a_x, a_y = sample->a_y, a_z = sample->a_z;
+  float norm_sq = a_x * a_x + a_y * a_y + a_z * a_z;
+  float trust   = 0;
+
+  if(norm_sq >= (IMU_FUSION_MIN_G * IMU_FUSION_GRAVITY) * (IMU_FUSION_MIN_G * IMU_FUSION_GRAVITY) &&
+     norm_sq <= (IMU_FUSION_MAX_G * IMU_FUSION_GRAVITY) * (IMU_FUSION_MAX_G * IMU_FUSION_GRAVITY)) {
+    float inv = 1.0f / sqrtf(norm_sq);
+    a_x *= inv;
+    a_y *= inv;
+    a_z *= inv;
+    trust = 1;
+  }
+
+  float dt = imu_fusion_dt(fusion, sample->cpu_cycles_since_boot);
+  if(dt < 0) {
+    if(trust) {
+      imu_fusion_reset_to(fusion, a_x, a_y, a_z);
+    }
+    return;
+  }
+  imu_fusion_step(fusion, sample->r_p, sample->r_r, sample->r_y, a_x, a_y, a_z, trust, dt);
+}
+
+static inline imu_fusion_angles imu_fusion_get_angles(const imu_fusion* fusion) {
+  const float* q = fusion->q;
+  imu_fusion_angles angles;
+
+  // Gravity in the sensor frame, what a still accelerometer would read
+  float v_x = 2.0f * (q[1] * q[3] - q[0] * q[2]);
+  float v_y = 2.0f * (q[0] * q[1] + q[2] * q[3]);
+  float v_z = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+
+  angles.roll  = 57.2958f * atanf(v_x / v_z);
+  angles.pitch = 57.2958f * atanf(v_y / v_z);
+  angles.yaw   = 57.2958f * atan2f(2.0f * (q[0] * q[3] + q[1] * q[2]), 1.0f - 2.0f * (q[2] * q[2] + q[3] * q[3]));
+  return angles;
+}
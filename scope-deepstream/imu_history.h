@@ -0,0 +1,233 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sensor_board_tlv.h"
+
+// The last capacity IMU samples, each stamped with host CLOCK_MONOTONIC
+// time, answering "mean, variance and integral of an axis between t0 and
+// t1" with two binary searches and a handful of subtractions.
+//
+// Time stamps come from the sensor board clock (cpu_cycles_since_boot,
+// 32768 a second, wraps every 36 hours) so the spacing of samples is the
+// board's, not the USB's. The board clock is mapped to ours with an
+// offset learnt from samples whose arrival time is known (the first of
+// every imu_batch): the smallest received - board time seen is the one
+// with the least transport delay. The offset is allowed to creep up by
+// IMU_HISTORY_DRIFT_NS per reference, enough to follow the two crystals
+// drifting apart (tens of ppm), too little for one late batch to matter.
+// A board clock going backwards (board reset) forgets the offset.
+//
+// Every entry holds prefix sums since the first sample of the value, of
+// its square and of its trapezoid integral over time, per axis. Sums are
+// of value - shift, shift being the first sample, so variance does not
+// cancel out for an axis sitting far from 0 (a_z at 1g).
+//
+// One writer (imu_history_add) and any number of readers
+// (imu_history_query) on other threads, without locks. A reader retries if
+// the writer overwrote what it was reading, the IMU_HISTORY_GUARD oldest
+// entries are never searched so that is rare.
+
+#define IMU_HISTORY_DEFAULT_SAMPLES  (8192)  // ~10s at 800Hz, a power of 2
+#define IMU_HISTORY_BOARD_HZ         (32768)
+#define IMU_HISTORY_DRIFT_NS         (1000)
+#define IMU_HISTORY_GUARD            (32)
+
+typedef enum {
+  IMU_AXIS_A_X,
+  IMU_AXIS_A_Y,
+  IMU_AXIS_A_Z,
+  IMU_AXIS_R_P,
+  IMU_AXIS_R_R,
+  IMU_AXIS_R_Y,
+  IMU_AXES
+} imu_axis_e;
+
+typedef struct {
+  uint64_t t_ns;
+  float    value[IMU_AXES];
+  double   sum[IMU_AXES];       // of value - shift, up to and with this sample
+  double   sum_sq[IMU_AXES];    // of (value - shift)^2
+  double   integral[IMU_AXES];  // of value over time since the first sample (value * s)
+} imu_history_entry;
+
+typedef struct {
+  uint32_t count;     // samples with first_ns <= t <= last_ns
+  uint64_t first_ns;  // time of the first and last of them
+  uint64_t last_ns;
+  double   mean;
+  double   variance;  // population
+  double   integral;  // from first_ns to last_ns, trapezoids
+} imu_history_stats;
+
+typedef struct {
+  uint32_t           capacity;
+  uint64_t           head;      // samples ever added, entries[head % capacity] is written next
+  imu_history_entry* entries;
+  float              shift[IMU_AXES];
+
+  // Board clock, writer only
+  uint32_t last_cycles;
+  uint64_t cycles;              // unwrapped
+  int64_t  offset_ns;           // host - board
+  int      offset_valid;
+} imu_history;
+
+// Returns 0 on success, -1 (after printing why) otherwise
+static inline int imu_history_init(imu_history* history, uint32_t capacity) {
+  memset(history, 0, sizeof(*history));
+  if(capacity <= IMU_HISTORY_GUARD || (capacity & (capacity - 1))) {
+    printf("imu history: capacity %u is not a power of 2 above %d\n", capacity, IMU_HISTORY_GUARD);
+    return -1;
+  }
+
+  history->capacity = capacity;
+  history->entries  = (imu_history_entry*)calloc(capacity, sizeof(imu_history_entry));
+  if(!history->entries) {
+    printf("imu history: failed to allocate %u samples\n", capacity);
+    return -1;
+  }
+  return 0;
+}
+
+static inline void imu_history_free(imu_history* history) {
+  free(history->entries);
+  history->entries = NULL;
+}
+
+static inline uint64_t imu_history_board_ns(uint64_t cycles) {
+  return (cycles / IMU_HISTORY_BOARD_HZ) * 1000000000ULL +
+         (cycles % IMU_HISTORY_BOARD_HZ) * 1000000000ULL / IMU_HISTORY_BOARD_HZ;
+}
+
+// Host time of a sample, received_ns is when it arrived (CLOCK_MONOTONIC)
+// or 0 if that is not known
+static inline uint64_t imu_history_sample_ns(imu_history* history, const imu_t* sample, uint64_t received_ns,
+                                             uint64_t last_ns) {
+  if(history->head) {
+    uint32_t delta = sample->cpu_cycles_since_boot - history->last_cycles;
+    if(delta & 0x80000000u) {
+      // Went backwards, the board restarted
+      delta = 0;
+      history->offset_valid = 0;
+    }
+    history->cycles += delta;
+  }
+  history->last_cycles = sample->cpu_cycles_since_boot;
+  uint64_t board_ns = imu_history_board_ns(history->cycles);
+
+  if(received_ns) {
+    int64_t offset = (int64_t)(received_ns - board_ns);
+    if(!history->offset_valid || offset < history->offset_ns) {
+      history->offset_ns    = offset;
+      history->offset_valid = 1;
+    } else if(offset - history->offset_ns > IMU_HISTORY_DRIFT_NS) {
+      history->offset_ns += IMU_HISTORY_DRIFT_NS;
+    } else {
+      history->offset_ns = offset;
+    }
+  }
+
+  // Without an offset yet the sample gets the time of the one before,
+  // times never go backwards (the binary search needs that)
+  uint64_t t = history->offset_valid ? board_ns + history->offset_ns : last_ns;
+  return t > last_ns ? t : last_ns;
+}
+
+// Writer only
+static inline void imu_history_add(imu_history* history, const imu_t* sample, uint64_t received_ns) {
+  const float values[IMU_AXES] = { sample->a_x, sample->a_y, sample->a_z, sample->r_p, sample->r_r, sample->r_y };
+  uint32_t mask = history->capacity - 1;
+  imu_history_entry* entry = &history->entries[history->head & mask];
+
+  if(0 == history->head) {
+    memcpy(history->shift, values, sizeof(values));
+    __atomic_store_n(&entry->t_ns, imu_history_sample_ns(history, sample, received_ns, 0), __ATOMIC_RELAXED);
+    for(int axis = 0; axis < IMU_AXES; axis++) {
+      entry->value[axis]    = values[axis];
+      entry->sum[axis]      = 0;
+      entry->sum_sq[axis]   = 0;
+      entry->integral[axis] = 0;
+    }
+  } else {
+    const imu_history_entry* last = &history->entries[(history->head - 1) & mask];
+    uint64_t t  = imu_history_sample_ns(history, sample, received_ns, last->t_ns);
+    double   dt = (t - last->t_ns) / 1e9;
+
+    // Only this thread writes entries, last can't change under us
+    __atomic_store_n(&entry->t_ns, t, __ATOMIC_RELAXED);
+    for(int axis = 0; axis < IMU_AXES; axis++) {
+      double shifted = (double)values[axis] - history->shift[axis];
+      entry->value[axis]    = values[axis];
+      entry->sum[axis]      = last->sum[axis] + shifted;
+      entry->sum_sq[axis]   = last->sum_sq[axis] + shifted * shifted;
+      entry->integral[axis] = last->integral[axis] + 0.5 * ((double)values[axis] + last->value[axis]) * dt;
+    }
+  }
+  __atomic_store_n(&history->head, history->head + 1, __ATOMIC_RELEASE);
+}
+
+// First index in [lo, hi) whose sample is at or after t_ns (hi if none)
+static inline uint64_t imu_history_lower_bound(const imu_history* history, uint64_t lo, uint64_t hi, uint64_t t_ns) {
+  uint32_t mask = history->capacity - 1;
+  while(lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if(__atomic_load_n(&history->entries[mid & mask].t_ns, __ATOMIC_RELAXED) < t_ns) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Stats of one axis over the samples taken between start_ns and end_ns
+// (CLOCK_MONOTONIC, both included). Returns 0, or -1 if there are none.
+// Check stats->first_ns to tell if the history reached back to start_ns.
+// Any thread.
+static inline int imu_history_query(const imu_history* history, imu_axis_e axis, uint64_t start_ns, uint64_t end_ns,
+                                    imu_history_stats* stats) {
+  uint32_t mask = history->capacity - 1;
+  imu_history_entry first, last;
+  uint64_t head, lo, first_index, last_index;
+
+  memset(stats, 0, sizeof(*stats));
+  if(end_ns < start_ns) {
+    return -1;
+  }
+  do {
+    head = __atomic_load_n(&history->head, __ATOMIC_ACQUIRE);
+    lo   = head > history->capacity - IMU_HISTORY_GUARD ? head - (history->capacity - IMU_HISTORY_GUARD) : 0;
+
+    first_index = imu_history_lower_bound(history, lo, head, start_ns);
+    // Last sample at or before end_ns, the one before the first after it
+    last_index  = UINT64_MAX == end_ns ? head : imu_history_lower_bound(history, first_index, head, end_ns + 1);
+    if(first_index >= last_index) {
+      return -1;
+    }
+    last_index--;
+
+    memcpy(&first, &history->entries[first_index & mask], sizeof(first));
+    memcpy(&last, &history->entries[last_index & mask], sizeof(last));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    // The writer could have come round to lo while we searched
+  } while(__atomic_load_n(&history->head, __ATOMIC_RELAXED) > lo + history->capacity - 1);
+
+  double n       = (double)(last_index - first_index + 1);
+  double shifted = (double)first.value[axis] - history->shift[axis];
+  double sum     = last.sum[axis] - first.sum[axis] + shifted;
+  double sum_sq  = last.sum_sq[axis] - first.sum_sq[axis] + shifted * shifted;
+  double mean    = sum / n;
+
+  stats->count    = (uint32_t)n;
+  stats->first_ns = first.t_ns;
+  stats->last_ns  = last.t_ns;
+  stats->mean     = history->shift[axis] + mean;
+  stats->variance = sum_sq / n - mean * mean;
+  stats->variance = stats->variance < 0 ? 0 : stats->variance;
+  stats->integral = last.integral[axis] - first.integral[axis];
+  return 0;
+}
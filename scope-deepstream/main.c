@@ -1,5 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <assert.h>
 #include <unistd.h>
 #include <sys/wait.h>
 
@@ -12,6 +14,32 @@
 #include "time.h"
 #include "calibration.h"
 #include "interpolate.h"
+#include "reactor.h"
+
+#ifdef TLV_INPROC
+#include "tlvproc.h"
+
+// The sample sits unaligned in the parse buffer, and the IMU code flips r_y
+static void on_sensor_sample(const uint8_t* sample, tlv_message_type_e type){
+  if(TLV_TYPE_IMU == type){
+    imu_t imu;
+    memcpy(&imu, sample, sizeof(imu));
+    imu_handle_sample(&imu, get_ns_monotonic());
+  } else {
+    // UI event is a single byte
+    ui_handle_event(sample[0]);
+  }
+}
+
+// Radar and sensor board parsers run as a thread of smartscope instead
+// of as the radar and sensor programs
+static void start_tlv_processor(){
+  tlvproc_callbacks callbacks = { radar_handle_cloud, on_sensor_sample };
+  if(tlvproc_start(&callbacks)){
+    assert(0);
+  }
+}
+#endif
 
 static void smart_scope(prog_config_t config){
   int seconds_from_epoch = get_seconds_from_epoch();
@@ -19,13 +47,17 @@ static void smart_scope(prog_config_t config){
   load_calibration_data_and_verify_crc();
   init_interpolation_distance();
   interpolate_create_lead();
-  init_imu_thread();
+  // Before anything that registers with it (algo, ui)
+  init_reactor_thread();
+  // The gyro bias is estimated in the background whenever the scope is
+  // still, -c only throws away the one saved last time
+  init_imu_thread(!config.calibrate_imu_on_boot);
   init_algo_thread();
-  if(config.calibrate_imu_on_boot){
-    calibrate_imu();
-  }
-  init_ui_thread();
-  init_radar_thread(seconds_from_epoch);
+  init_ui();
+  init_radar_thread(seconds_from_epoch, config.quantized_radar_dump);
+#ifdef TLV_INPROC
+  start_tlv_processor();
+#endif
   register_all_menus();
 
   deepstream_init(seconds_from_epoch, config);
@@ -35,7 +67,7 @@ int main(int argc, char **argv){
   prog_config_t config = {0};
   int opt;
 
-  while ((opt = getopt (argc, argv, "szfc")) != -1){
+  while ((opt = getopt (argc, argv, "szfcq")) != -1){
     switch (opt)
     {
     case 's':
@@ -48,8 +80,13 @@ int main(int argc, char **argv){
       config.force_bb = 1;
       break;
     case 'c':
+      // Ignore the cached gyro bias, estimate it from scratch
       config.calibrate_imu_on_boot = 1;
       break;
+    case 'q':
+      // radar_<time>.q16 (quantized clouds) instead of the radar_<time>.dump text
+      config.quantized_radar_dump = 1;
+      break;
     defualt:
       assert(0);
     }
@@ -5,9 +5,22 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "mq.h"
 
+static mq_registry_header* registry;
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+
+static void open_registry(){
+  registry = mq_registry_open();
+}
+
+static mq_registry_header* get_registry(){
+  pthread_once(&registry_once, open_registry);
+  return registry;
+}
+
 mqd_t open_mq(const char* mq_path, int flags) 
 {
   assert(mq_path);
@@ -21,5 +34,34 @@ mqd_t open_mq(const char* mq_path, int flags)
     printf("Failed to open message queue for (%s)\n", mq_path);
     assert(0);
   }
+
+  if(O_RDONLY == (flags & O_ACCMODE)){
+    subscribe_topic(mq_path, MQ_TOPIC_MQUEUE);
+  }
   return ret;
 }
+
+void open_mailbox(shm_mailbox* mailbox, const char* path, uint32_t size)
+{
+  assert(mailbox && path);
+
+  if(shm_mailbox_open(mailbox, path, size)){
+    printf("Failed to open mailbox for (%s)\n", path);
+    assert(0);
+  }
+}
+
+mq_topic subscribe_topic(const char* path, mq_topic_kind kind)
+{
+  return mq_topic_subscribe(get_registry(), path, kind);
+}
+
+mq_topic publish_topic(const char* path, mq_topic_kind kind)
+{
+  return mq_topic_publish(get_registry(), path, kind);
+}
+
+int topic_wanted(mq_topic* topic)
+{
+  return mq_topic_wanted(get_registry(), topic);
+}
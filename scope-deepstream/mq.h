@@ -1,12 +1,22 @@
 #pragma once
 #include <mqueue.h>
 #include "message_queue.h"
-
-#define MESSAGE_QUEUE_NAME       "/mq_imu_display" 
+#include "shm_mailbox.h"
+#include "mq_registry.h"
 
 // goes to python
 #define MESSAGE_QUEUE_OUTPUT_INF "/mq_inference" 
-// comes from python
-#define MESSAGE_QUEUE_CROSS      "/mq_crosshair" 
+// Latest aim overlay, algo.c -> deepstream.c (shm_mailbox)
+#define MAILBOX_CROSS            "/shm_crosshair"
 
+// Opening a queue read only subscribes to it (see mq_registry.h)
 mqd_t open_mq(const char *, int);
+
+// Latest value channels (see shm_mailbox.h), asserts on failure like open_mq
+void open_mailbox(shm_mailbox*, const char*, uint32_t);
+
+// Subscriber registry. Readers of a mailbox or ring subscribe explicitly,
+// writers check topic_wanted() before putting a message together.
+mq_topic subscribe_topic(const char*, mq_topic_kind);
+mq_topic publish_topic(const char*, mq_topic_kind);
+int      topic_wanted(mq_topic*);
@@ -8,24 +8,31 @@
 #include <errno.h>
 #include <math.h>
 #include <sys/time.h>
+#include <time.h>
 #include <stdbool.h>
 
 #include "sensor_board_tlv.h"
 #include "radar_tlv.h"
 #include "radar.h"
 #include "mq.h"
+#include "shm_ring.h"
+#include "point_cloud_q16.h"
 #include "algo.h"
 
 //#define DEBUG_PRINT
 
-static mqd_t radar_mq;
-static mqd_t radar_calibrated_mq;
+static shm_ring radar_ring;
+static shm_mailbox radar_calibrated_mailbox;
+static mq_topic radar_calibrated_topic;
 static pthread_t radar_th;
+static FILE* radar_dump_fp;
+static bool radar_dump_quantized;
 static pthread_mutex_t history_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static int radar_statitics_register_event(int);
 static void* radar_thread(void*);
-static int process_radar_frame(char*, FILE*);
+static int process_radar_frame(const PointCloudWire*, FILE*);
+static void record_radar_frame(const PointCloudWire*, FILE*);
 
 static int radar_frames_received; 
 static int radar_points_received; 
@@ -47,22 +54,32 @@ static double get_ms_since_start(){
 }
 
 static void open_radar_mq(){
-  radar_mq            = open_mq(RADAR_MQ_PATH, O_RDONLY | O_CREAT); // IN
-  radar_calibrated_mq = open_mq(RADAR_CALIBRATED_MQ_PATH, O_RDWR | O_CREAT | O_NONBLOCK); // OUT (flips the image and does other calibration)
-}
+#ifndef TLV_INPROC
+  // IN, frames from the radar program are read in place
+  if(shm_ring_open(&radar_ring, RADAR_RING_PATH, RADAR_RING_SLOTS, RADAR_RING_SLOT_SIZE)){
+    assert(0);
+  }
+  shm_ring_skip_to_latest(&radar_ring);
+  subscribe_topic(RADAR_RING_PATH, MQ_TOPIC_RING);
+#endif
 
-int get_radar_frame(char* frame_calibrated, size_t buff_len){
-  assert(buff_len <= MESSAGE_QUEUE_SIZE);
-  return mq_receive(radar_calibrated_mq, frame_calibrated, buff_len, NULL);
+  // OUT (flips the image and does other calibration), only the newest cloud matters
+  open_mailbox(&radar_calibrated_mailbox, RADAR_CALIBRATED_MAILBOX_PATH, sizeof(cartesian_point_cloud_and_meta_t));
+  radar_calibrated_topic = publish_topic(RADAR_CALIBRATED_MAILBOX_PATH, MQ_TOPIC_MAILBOX);
 }
 
-static int process_radar_frame(char* frame, FILE* dump_file){
-  assert(frame);
-  cartesian_point_cloud_and_meta_t cart_cloud;
+static int process_radar_frame(const PointCloudWire* point_cloud_ptr, FILE* dump_file){
+  assert(point_cloud_ptr);
+  const DPIF_PointCloudSpherical* spheres = point_cloud_wire_points(point_cloud_ptr);
+  const DPIF_PointCloudSideInfo*  side    = point_cloud_wire_side_info(point_cloud_ptr);
+  // Too big for the stack, only ever used by one thread (radar_thread or
+  // the tlv-processor thread)
+  static cartesian_point_cloud_and_meta_t cart_cloud;
   char buff[MESSAGE_QUEUE_SIZE];
   static int frame_num;
 
-  PointCloudSpherical* point_cloud_ptr = (PointCloudSpherical*)(frame);
+  uint32_t calibrated_points = point_cloud_ptr->meta_data.points;
+  assert(calibrated_points <= RADAR_RING_MAX_POINTS);
   //printf("New sample with %d frames\n", point_cloud_ptr->meta_data.points);
 
   //puts("Processing new frame.\n\n");
@@ -70,33 +87,58 @@ static int process_radar_frame(char* frame, FILE* dump_file){
 
   for(int i = 0; i < point_cloud_ptr->meta_data.points; i++){
 #ifdef DEBUG_PRINT
-    printf("range:%f\n",        point_cloud_ptr->points[i].sphere.range);
-    printf("azimuthAngle:%f\n", point_cloud_ptr->points[i].sphere.azimuthAngle);
-    printf("elevAngle:%f\n",    point_cloud_ptr->points[i].sphere.elevAngle);
+    printf("range:%f\n",        spheres[i].range);
+    printf("azimuthAngle:%f\n", spheres[i].azimuthAngle);
+    printf("elevAngle:%f\n",    spheres[i].elevAngle);
 #endif
 
-    float R     = point_cloud_ptr->points[i].sphere.range;        // R
-    float phi   = point_cloud_ptr->points[i].sphere.elevAngle;    // Θ
-    float theta = point_cloud_ptr->points[i].sphere.azimuthAngle; // Φ
+    float R     = spheres[i].range;        // R
+    float phi   = spheres[i].elevAngle;    // Θ
+    float theta = spheres[i].azimuthAngle; // Φ
 
     // The sensor is installed upside down... hence the -1 factor.
     float X = R * cos(phi) * sin(theta) * -1;
     float Z = R * sin(phi) * -1; 
     float Y = R * cos(phi) * cos(theta);
     
-    cart_cloud.points[i] = (point_cartesian_t){X,Y,Z, point_cloud_ptr->points[i].side.snr, point_cloud_ptr->points[i].side.noise};
+    cart_cloud.points[i] = (point_cartesian_t){X,Y,Z, side[i].snr, side[i].noise};
 
-    snprintf(buff, MESSAGE_QUEUE_SIZE, "%f, %d, %f, %f, %f\n", ms_since_start, frame_num, X, Z, Y);
-    fwrite(buff, 1, strlen(buff), dump_file);
+    if(!radar_dump_quantized){
+      snprintf(buff, MESSAGE_QUEUE_SIZE, "%f, %d, %f, %f, %f\n", ms_since_start, frame_num, X, Z, Y);
+      fwrite(buff, 1, strlen(buff), dump_file);
+    }
+  }
+  if(radar_dump_quantized){
+    record_radar_frame(point_cloud_ptr, dump_file);
   }
   
   frame_num++;
   cart_cloud.meta_data = point_cloud_ptr->meta_data;
-  size_t calibrated_size = sizeof(PointCloudMetaData) + (point_cloud_ptr->meta_data.points)*sizeof(point_cartesian_t);
-  assert(calibrated_size < MESSAGE_QUEUE_SIZE);
+  cart_cloud.meta_data.points = calibrated_points;
+  size_t calibrated_size = offsetof(cartesian_point_cloud_and_meta_t, points) + calibrated_points*sizeof(point_cartesian_t);
 
   radar_statitics_register_event(point_cloud_ptr->meta_data.points);
-  mq_send(radar_calibrated_mq, (char*)(&cart_cloud), calibrated_size, 0);
+  if(topic_wanted(&radar_calibrated_topic)){
+    shm_mailbox_write(&radar_calibrated_mailbox, &cart_cloud, calibrated_size);
+    mq_topic_sent(&radar_calibrated_topic, 1);
+  }
+}
+
+// One capture.h record per cloud, quantized, instead of a line of text
+// per point
+static void record_radar_frame(const PointCloudWire* cloud, FILE* dump_file){
+  static union {
+    PointCloudWireQ16 cloud;
+    uint8_t           buff[RADAR_RING_SLOT_SIZE];
+  } quantized;
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+
+  capture_record_header record;
+  record.monotonic_ns = tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+  record.len          = point_cloud_q16_from_wire(cloud, &quantized.cloud);
+  fwrite(&record, sizeof(record), 1, dump_file);
+  fwrite(quantized.buff, 1, record.len, dump_file);
 }
 
 static int radar_statitics_register_event(int count){
@@ -147,40 +189,87 @@ radar_history_t fetch_radar_history(){
   return history;
 }
 
-static int get_radar_point_cloud(char* frame){
-  assert(frame);
+static FILE* open_radar_dump(int time){
+  char buff[MESSAGE_QUEUE_SIZE];
+  if(radar_dump_quantized){
+    printf("Radar recording file_name = radar_%d.q16\n", time);
+    snprintf(buff, MESSAGE_QUEUE_SIZE, "radar_%d.q16", time);
+    FILE * radar_fp = fopen(buff, "w+");
 
-  int rc = mq_receive(radar_mq, frame, MESSAGE_QUEUE_SIZE, NULL);
-  if(-1 == rc){
-    printf("Failed to recieve from message queue, error: %s\n",strerror(errno));
-    return -1;
+    capture_file_header header = {0};
+    strncpy(header.magic, CLOUD_RECORDING_MAGIC, sizeof(header.magic));
+    header.version = CLOUD_RECORDING_VERSION;
+    fwrite(&header, sizeof(header), 1, radar_fp);
+    return radar_fp;
   }
+
+  printf("Radar dump log file_name = radar_%d.dump\n", time);
+  snprintf(buff, MESSAGE_QUEUE_SIZE, "radar_%d.dump", time);
+  FILE * radar_fp = fopen(buff, "w+");
+
+  // Write the header
+  snprintf(buff, MESSAGE_QUEUE_SIZE, "TIME(mS), frame, X,Z,Y\n");
+  fwrite(buff, 1, strlen(buff), radar_fp);
+  return radar_fp;
 }
 
-static int time_arg;
-void init_radar_thread(int time){
+void init_radar_thread(int time, bool quantized_dump){
   open_radar_mq();
-  time_arg = time;
-  
-  int rc = pthread_create(&radar_th, NULL, radar_thread, &time_arg);
+  radar_dump_quantized = quantized_dump;
+  radar_dump_fp = open_radar_dump(time);
+
+#ifdef TLV_INPROC
+  // Clouds come in through radar_handle_cloud, on the tlv-processor thread
+  return;
+#endif
+
+  int rc = pthread_create(&radar_th, NULL, radar_thread, NULL);
   if(rc != 0){
     printf("Failed to start radar_thread with error %s\n", strerror(rc));
     assert(0);
   } 
 }
 
+// In process mode (TLV_INPROC) the tlv-processor thread calls this with
+// the cloud still in its parse buffer
+void radar_handle_cloud(const PointCloudWire* cloud){
+  process_radar_frame(cloud, radar_dump_fp);
+}
+
 static void* radar_thread(void* arg){
-  printf("Radar thread staring, dump log file_name = radar_%d.dump\n", *(int*)(arg));
-  char buff[MESSAGE_QUEUE_SIZE];
-  snprintf(buff, MESSAGE_QUEUE_SIZE, "radar_%d.dump", *(int*)(arg));
-  FILE * radar_fp = fopen(buff, "w+");
+  printf("Radar thread staring.\n");
+
+  // Room for a version 1 or 3 cloud converted to the current format
+  static union {
+    PointCloudWire cloud;
+    uint8_t        buff[RADAR_RING_SLOT_SIZE];
+  } converted;
 
-  // Write the header
-  snprintf(buff, MESSAGE_QUEUE_SIZE, "TIME(mS), frame, X,Z,Y\n");
-  fwrite(buff, 1, strlen(buff), radar_fp);
-  
   while(1){
-    get_radar_point_cloud(buff);
-    process_radar_frame(buff, radar_fp);
+    uint32_t len;
+    const void* frame = shm_ring_peek(&radar_ring, &len, -1);
+
+    switch(point_cloud_wire_version(frame, len)){
+      case POINT_CLOUD_WIRE_VERSION:
+        radar_handle_cloud(frame);
+        break;
+      case 1:
+        if(((const PointCloudMetaData*)frame)->points <= RADAR_RING_MAX_POINTS){
+          point_cloud_wire_from_v1(frame, &converted.cloud);
+          radar_handle_cloud(&converted.cloud);
+        }
+        break;
+      case POINT_CLOUD_WIRE_Q16_VERSION:
+        // Smaller points, a full slot holds more than converted has room for
+        if(((const PointCloudWireQ16*)frame)->meta_data.points <= RADAR_RING_MAX_POINTS){
+          point_cloud_q16_to_wire(frame, &converted.cloud);
+          radar_handle_cloud(&converted.cloud);
+        }
+        break;
+      default:
+        printf("Dropping radar cloud of %u bytes in an unknown format\n", len);
+        break;
+    }
+    shm_ring_release(&radar_ring);
   }
 }
@@ -5,7 +5,7 @@
 
 #define RADAR_HISTORY_CIRC_BUFFER_LEN (60)
 #define TRACKING_IMPLEMENTATION
-#define RADAR_CALIBRATED_MQ_PATH ("/mq_radar_calibrated")
+#define RADAR_CALIBRATED_MAILBOX_PATH ("/shm_radar_calibrated")
 #define RADAR_CHECK_NUMBER_OF_FRAMES_PERIOD_MS 3500
 #define RADAR_MINIMUM_NUMBER_OF_RECENT_FRAMES 5
 
@@ -19,18 +19,25 @@ typedef struct{
   int16_t noise; 
 } point_cartesian_t;
 
+// Holds every point of a ring slot, only meta_data.points of them get
+// written to (and read from) the calibrated mailbox. Not packed, the
+// padding keeps every point 16 byte aligned (mailboxes are).
 typedef struct {
   PointCloudMetaData meta_data;
-  point_cartesian_t points[MAX_CLOUD_POINTS];
+  uint32_t           reserved[3];
+  point_cartesian_t  points[RADAR_RING_MAX_POINTS];
 } cartesian_point_cloud_and_meta_t; 
 
+_Static_assert(sizeof(point_cartesian_t) == 16, "calibrated point layout changed");
+_Static_assert(offsetof(cartesian_point_cloud_and_meta_t, points) == 32, "calibrated cloud layout changed");
+
 typedef struct{
   int total_frames;
   int total_points;
 } radar_history_t;
 
-void            init_radar_thread(int);
-int             get_radar_frame(char*, size_t);
+void            init_radar_thread(int, bool);
+void            radar_handle_cloud(const PointCloudWire*);
 bool            radar_received_sufficient_frames_recently(void);  
 radar_history_t fetch_radar_history(void);
 
@@ -0,0 +1,113 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "reactor.h"
+
+#define REACTOR_MAX_EVENTS (8)
+
+typedef struct{
+  int              fd;
+  bool             is_timer;
+  reactor_callback callback;
+} reactor_source_t;
+
+static int epoll_fd = -1;
+static pthread_t reactor_th;
+
+static void* reactor_thread(void*);
+
+void init_reactor_thread(){
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if(-1 == epoll_fd){
+    printf("epoll_create1 failed with error %s\n", strerror(errno));
+    assert(0);
+  }
+
+  int rc = pthread_create(&reactor_th, NULL, reactor_thread, NULL);
+  if(rc != 0){
+    printf("Failed to start reactor thread with error %s\n", strerror(rc));
+    assert(0);
+  }
+}
+
+// Sources are never removed, they live as long as smartscope
+static void watch(int fd, bool is_timer, reactor_callback callback){
+  assert(-1 != epoll_fd && callback);
+
+  reactor_source_t* source = malloc(sizeof(reactor_source_t));
+  assert(source);
+  *source = (reactor_source_t){fd, is_timer, callback};
+
+  struct epoll_event ev = {0};
+  ev.events   = EPOLLIN;
+  ev.data.ptr = source;
+  if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev)){
+    printf("Failed to watch fd %d with error %s\n", fd, strerror(errno));
+    assert(0);
+  }
+}
+
+void reactor_watch(int fd, reactor_callback callback){
+  watch(fd, false, callback);
+}
+
+int reactor_add_timer(reactor_callback callback){
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if(-1 == timer_fd){
+    printf("timerfd_create failed with error %s\n", strerror(errno));
+    assert(0);
+  }
+
+  watch(timer_fd, true, callback);
+  return timer_fd;
+}
+
+void reactor_arm_timer(int timer_fd, int delay_ms, int period_ms){
+  struct itimerspec spec = {0};
+  spec.it_value.tv_sec     = delay_ms / 1000;
+  spec.it_value.tv_nsec    = (delay_ms % 1000) * 1000000L;
+  spec.it_interval.tv_sec  = period_ms / 1000;
+  spec.it_interval.tv_nsec = (period_ms % 1000) * 1000000L;
+
+  if(timerfd_settime(timer_fd, 0, &spec, NULL)){
+    printf("timerfd_settime failed with error %s\n", strerror(errno));
+    assert(0);
+  }
+}
+
+static void* reactor_thread(void* arg){
+  printf("Reactor thread starting\n");
+  struct epoll_event events[REACTOR_MAX_EVENTS];
+
+  while(1){
+    int ready = epoll_wait(epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+    if(-1 == ready){
+      if(EINTR == errno){
+        continue;
+      }
+      printf("epoll_wait failed with error %s\n", strerror(errno));
+      assert(0);
+    }
+
+    for(int i = 0; i < ready; i++){
+      reactor_source_t* source = events[i].data.ptr;
+
+      if(source->is_timer){
+        // Nothing to read if an earlier handler of this batch re-armed it
+        uint64_t expirations;
+        if(sizeof(expirations) != read(source->fd, &expirations, sizeof(expirations))){
+          continue;
+        }
+      }
+      source->callback(source->fd);
+    }
+  }
+}
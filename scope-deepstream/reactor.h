@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+
+// One epoll thread that runs a handler whenever one of its fds becomes
+// readable: message queues (mqd_t is an fd on Linux), timerfds, ...
+// Handlers run on the reactor thread one at a time, so state only they
+// touch needs no locking. They must not block.
+//
+// The shared memory mailboxes and the radar ring wake their readers with
+// a futex, not an fd, those keep their own (blocking) threads.
+
+typedef void (*reactor_callback)(int fd);
+
+void init_reactor_thread(void);
+
+// Level triggered, the handler has to read what woke it up
+void reactor_watch(int fd, reactor_callback);
+
+// CLOCK_MONOTONIC timerfd, starts disarmed. The reactor reads the
+// expiration count before calling the handler.
+int  reactor_add_timer(reactor_callback);
+
+// Fires after delay_ms and then every period_ms (0 = once). A delay of 0
+// disarms the timer.
+void reactor_arm_timer(int timer_fd, int delay_ms, int period_ms);
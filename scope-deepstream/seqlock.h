@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sched.h>
+
+// Seqlock for values shared between threads of one process, one writer
+// and any number of readers. Same protocol as shm_mailbox.h without the
+// shared memory and the futex: the writer never waits, readers retry
+// while the value changes under them and never hold anything the writer
+// needs.
+//
+// Made for values a thread publishes for others to look at whenever they
+// like, the OSD probe reading orientation, distance and aim state on the
+// GStreamer thread while the IMU, radar and aim threads keep updating
+// them. A reader can miss updates, it only ever gets the latest.
+//
+// SEQLOCK_SNAPSHOT(type) is a seqlock and a value on cache lines of their
+// own, so two snapshots written by different threads never share one.
+//
+//   static SEQLOCK_SNAPSHOT(float) distance;
+//   SEQLOCK_PUBLISH(&distance, new_distance);  // writer
+//   SEQLOCK_LOAD(&distance, current);          // any thread
+
+#define SEQLOCK_CACHE_LINE (64)
+
+typedef struct {
+  uint32_t seq;  // odd while the value is being written
+} seqlock;
+
+#define SEQLOCK_SNAPSHOT(type) \
+  struct { seqlock lock; type value; } __attribute__((aligned(SEQLOCK_CACHE_LINE)))
+
+// Writer only
+static inline void seqlock_write(seqlock* lock, void* value, const void* in, size_t len) {
+  uint32_t seq = lock->seq;
+  __atomic_store_n(&lock->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(value, in, len);
+  __atomic_store_n(&lock->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Any thread, returns the sequence number of what it read (counts up by
+// one per write)
+static inline uint32_t seqlock_read(const seqlock* lock, const void* value, void* out, size_t len) {
+  uint32_t before, after;
+
+  do {
+    before = __atomic_load_n(&lock->seq, __ATOMIC_ACQUIRE);
+    if(before & 1) {
+      // Mid write, a memcpy away from done unless the writer got switched
+      // out, let it finish
+      sched_yield();
+      after = before + 1;
+      continue;
+    }
+    memcpy(out, value, len);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&lock->seq, __ATOMIC_RELAXED);
+  } while(before != after);
+
+  return before / 2;
+}
+
+#define SEQLOCK_PUBLISH(snapshot, in) \
+  seqlock_write(&(snapshot)->lock, &(snapshot)->value, &(in), sizeof((snapshot)->value))
+
+#define SEQLOCK_LOAD(snapshot, out) \
+  seqlock_read(&(snapshot)->lock, &(snapshot)->value, &(out), sizeof((snapshot)->value))
@@ -29,3 +29,9 @@ uint32_t get_time_monotonic(){
   clock_gettime(CLOCK_MONOTONIC, &monotime);
   return monotime.tv_sec;
 }
+
+uint64_t get_ns_monotonic(){
+  struct timespec monotime;
+  clock_gettime(CLOCK_MONOTONIC, &monotime);
+  return monotime.tv_sec * 1000000000ULL + monotime.tv_nsec;
+}
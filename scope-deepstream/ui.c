@@ -11,14 +11,14 @@
 
 #include "sensor_board_tlv.h"
 #include "ui.h"
+#include "reactor.h"
 
-static mqd_t     ui_mq;
-static pthread_t ui_th;
+static mqd_t ui_mq;
 
 static pthread_mutex_t ui_mutex = PTHREAD_MUTEX_INITIALIZER;
 static tlv_message_type_e event = TOTAL_EVENT_COUNT;
 
-static void* ui_thread(void*);
+static void get_ui_event(int);
 
 bool fetch_new_event(ui_event_e* event_ret){
   bool ret = false;
@@ -41,30 +41,22 @@ static void set_new_event(ui_event_e new_event){
 }
 
 static void open_ui_mq(){
-  ui_mq = open_mq(MESSAGE_QUEUE_NAME_UI, O_RDONLY | O_CREAT);
+  // Non blocking, read from the reactor thread
+  ui_mq = open_mq(MESSAGE_QUEUE_NAME_UI, O_RDONLY | O_CREAT | O_NONBLOCK);
 }
 
-void init_ui_thread(){
+void init_ui(){
+#ifdef TLV_INPROC
+  // Events come in through ui_handle_event, on the tlv-processor thread
+  return;
+#endif
   open_ui_mq();
-  
-  int rc = pthread_create(&ui_th, NULL, ui_thread, NULL);
-  if(rc != 0){
-    printf("Failed to start ui_thread with error %s\n", strerror(rc));
-    assert(0);
-  }
+  reactor_watch(ui_mq, get_ui_event);
 }
 
-static void get_ui_event(){
-  char mq_buff[MESSAGE_QUEUE_SIZE]; 
-  
-  int rc = mq_receive(ui_mq, mq_buff, MESSAGE_QUEUE_SIZE, NULL);
-  if(-1 == rc){
-    printf("Failed to recieve from UI message queue, error: %s\n", strerror(errno));
-    return;
-  }
-
-  // UI event is a single byte
-  ui_event event = mq_buff[0];
+// Called on the reactor thread or, in process mode (TLV_INPROC), straight from the
+// tlv-processor thread
+void ui_handle_event(ui_event event){
   bool send_event = false;
   switch(event){
     case(ROTARY_BUTTON):
@@ -86,10 +78,16 @@ static void get_ui_event(){
   }
 }
 
-static void* ui_thread(void* arg){
-  printf("UI thread staring.\n");
-
-  while(1){
-    get_ui_event();
+// Reactor handler, the queue has at least one event
+static void get_ui_event(int fd){
+  char mq_buff[MESSAGE_QUEUE_SIZE]; 
+  
+  int rc = mq_receive(ui_mq, mq_buff, MESSAGE_QUEUE_SIZE, NULL);
+  if(-1 == rc){
+    printf("Failed to recieve from UI message queue, error: %s\n", strerror(errno));
+    return;
   }
+
+  // UI event is a single byte
+  ui_handle_event(mq_buff[0]);
 }
@@ -13,4 +13,5 @@
 #define MESSAGE_QUEUE_NAME_UI "/mq_ui"
 
 bool fetch_new_event(ui_event_e* event_arg);
-void init_ui_thread(void);
+void init_ui(void);
+void ui_handle_event(ui_event);
@@ -0,0 +1,173 @@
+#pragma once
+
+// Mean, variance, min and max over the last capacity samples of a stream,
+// updated in O(1) per sample (min/max amortized, a sample enters and
+// leaves each wedge once). Built for the 800Hz IMU path, the gyro
+// variance check used to walk all 550 samples twice per call.
+//
+// - The sum is Kahan (Neumaier) compensated, adding the new sample and
+//   removing the evicted one are both compensated, so the mean does not
+//   drift no matter how long the window slides.
+// - M2 (sum of squared deviations) uses the sliding window form of
+//   Welford's update, in double.
+// - Min/max keep a monotonic wedge of slots each.
+//
+// One writer (window_stats_add) and any number of readers
+// (window_stats_read) on other threads. Every add publishes a snapshot
+// under a seqlock (seqlock.h), readers never block the writer and the
+// writer never waits on a reader.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "seqlock.h"
+
+typedef struct {
+  uint32_t count;     // samples in the window, up to capacity
+  double   mean;
+  double   variance;  // population variance, like the two pass version
+  float    min;
+  float    max;
+} window_stats_snapshot;
+
+// Wedges are rings of slots in samples, oldest first. Slots of a wedge
+// are all in the window so the oldest one is only reused by the sample
+// that evicts it.
+typedef struct {
+  uint32_t* slots;
+  uint32_t  head;
+  uint32_t  len;
+} window_stats_wedge;
+
+typedef struct {
+  uint32_t capacity;
+  uint32_t count;
+  uint32_t next;            // slot the next sample goes to
+  float*   samples;         // ring of the window
+
+  double   sum;
+  double   sum_comp;        // Kahan compensation of sum
+  double   mean;
+  double   m2;
+
+  window_stats_wedge min_wedge;  // values increase from head to tail
+  window_stats_wedge max_wedge;  // values decrease from head to tail
+
+  seqlock               lock;
+  window_stats_snapshot published;
+} window_stats;
+
+// Returns 0 on success, -1 (after printing why) otherwise
+static inline int window_stats_init(window_stats* stats, uint32_t capacity) {
+  memset(stats, 0, sizeof(*stats));
+  if(0 == capacity) {
+    printf("window stats: capacity can't be 0\n");
+    return -1;
+  }
+
+  stats->capacity        = capacity;
+  stats->samples         = (float*)calloc(capacity, sizeof(float));
+  stats->min_wedge.slots = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+  stats->max_wedge.slots = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+  if(!stats->samples || !stats->min_wedge.slots || !stats->max_wedge.slots) {
+    printf("window stats: failed to allocate a window of %u samples\n", capacity);
+    free(stats->samples);
+    free(stats->min_wedge.slots);
+    free(stats->max_wedge.slots);
+    return -1;
+  }
+  return 0;
+}
+
+static inline void window_stats_free(window_stats* stats) {
+  free(stats->samples);
+  free(stats->min_wedge.slots);
+  free(stats->max_wedge.slots);
+  stats->samples = NULL;
+  stats->min_wedge.slots = stats->max_wedge.slots = NULL;
+}
+
+// Neumaier's variant, also exact when value is bigger than the sum so far
+static inline void window_stats_kahan_add(window_stats* stats, double value) {
+  double t = stats->sum + value;
+  if((stats->sum < 0 ? -stats->sum : stats->sum) >= (value < 0 ? -value : value)) {
+    stats->sum_comp += (stats->sum - t) + value;
+  } else {
+    stats->sum_comp += (value - t) + stats->sum;
+  }
+  stats->sum = t;
+}
+
+static inline uint32_t window_stats_wrap(const window_stats* stats, uint32_t index) {
+  return index >= stats->capacity ? index - stats->capacity : index;
+}
+
+static inline float window_stats_wedge_front(const window_stats* stats, const window_stats_wedge* wedge) {
+  return stats->samples[wedge->slots[wedge->head]];
+}
+
+// Drops the sample value just evicted, then every sample from the tail
+// that can no longer be the extreme (is_min picks the order). Call after
+// value is in its slot.
+static inline void window_stats_wedge_push(window_stats* stats, window_stats_wedge* wedge, uint32_t slot, float value, int is_min) {
+  if(wedge->len && wedge->slots[wedge->head] == slot) {
+    wedge->head = window_stats_wrap(stats, wedge->head + 1);
+    wedge->len--;
+  }
+
+  while(wedge->len) {
+    float tail = stats->samples[wedge->slots[window_stats_wrap(stats, wedge->head + wedge->len - 1)]];
+    if(is_min ? tail < value : tail > value) {
+      break;
+    }
+    wedge->len--;
+  }
+  wedge->slots[window_stats_wrap(stats, wedge->head + wedge->len)] = slot;
+  wedge->len++;
+}
+
+// Writer only
+static inline void window_stats_add(window_stats* stats, float value) {
+  uint32_t slot = stats->next;
+  double   x    = value;
+  double   mean = stats->mean;
+
+  window_stats_kahan_add(stats, x);
+  if(stats->count < stats->capacity) {
+    stats->count++;
+    stats->mean = (stats->sum + stats->sum_comp) / stats->count;
+    stats->m2  += (x - mean) * (x - stats->mean);
+  } else {
+    // x replaces the oldest sample y, same count
+    double y = stats->samples[slot];
+    window_stats_kahan_add(stats, -y);
+    stats->mean = (stats->sum + stats->sum_comp) / stats->count;
+    stats->m2  += (x - y) * (x - stats->mean + y - mean);
+  }
+  if(stats->m2 < 0) {
+    stats->m2 = 0;
+  }
+  stats->samples[slot] = value;
+  stats->next = window_stats_wrap(stats, slot + 1);
+
+  window_stats_wedge_push(stats, &stats->min_wedge, slot, value, 1);
+  window_stats_wedge_push(stats, &stats->max_wedge, slot, value, 0);
+
+  window_stats_snapshot snapshot;
+  snapshot.count    = stats->count;
+  snapshot.mean     = stats->mean;
+  snapshot.variance = stats->m2 / stats->count;
+  snapshot.min      = window_stats_wedge_front(stats, &stats->min_wedge);
+  snapshot.max      = window_stats_wedge_front(stats, &stats->max_wedge);
+  seqlock_write(&stats->lock, &stats->published, &snapshot, sizeof(snapshot));
+}
+
+// Any thread, never blocks the writer. A window nothing was added to yet
+// reads as all zeros.
+static inline window_stats_snapshot window_stats_read(const window_stats* stats) {
+  window_stats_snapshot snapshot;
+  seqlock_read(&stats->lock, &stats->published, &snapshot, sizeof(snapshot));
+  return snapshot;
+}
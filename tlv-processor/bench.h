@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include <vector>
+#include <algorithm>
+
+// What every bench_*.cpp needs: the clock, pacing a loop to a rate and
+// latency percentiles. The scope-deepstream benches use it too.
+
+// Results of timed loops go here so the work can't be optimized away
+static volatile double sink;
+
+static inline uint64_t now_ns() {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+static inline double now_s() {
+  return now_ns() / 1e9;
+}
+
+static inline void sleep_until_ns(uint64_t deadline) {
+  struct timespec tp = { (time_t)(deadline / 1000000000ULL), (long)(deadline % 1000000000ULL) };
+  while(EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL));
+}
+
+// Moves next on by one period of rate_hz and sleeps until then, next
+// starts out as now_ns() before the loop
+static inline void pace(uint64_t& next, uint32_t rate_hz) {
+  next += 1000000000ULL / rate_hz;
+  sleep_until_ns(next);
+}
+
+typedef struct {
+  double p50_us;
+  double p99_us;
+  double p999_us;
+  double max_us;
+} latency_percentiles;
+
+// Sorts latencies_ns, all 0 if there are none
+static inline latency_percentiles summarize_latencies(std::vector<uint64_t>& latencies_ns) {
+  latency_percentiles result = {0};
+  size_t n = latencies_ns.size();
+  if(n) {
+    std::sort(latencies_ns.begin(), latencies_ns.end());
+    result.p50_us  = latencies_ns[n * 50 / 100] / 1e3;
+    result.p99_us  = latencies_ns[n * 99 / 100] / 1e3;
+    result.p999_us = latencies_ns[n * 999 / 1000] / 1e3;
+    result.max_us  = latencies_ns.back() / 1e3;
+  }
+  return result;
+}
@@ -0,0 +1,248 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "tty.h"
+#include "tlv_synth.h"
+#include "bench.h"
+#include "tlv_processor.h"
+#include "message_queue.h"
+#include "shm_ring.h"
+#include "shm_mailbox.h"
+#include "imu_batch.h"
+
+// Cost of getting IMU samples from the sensor program to imu.c:
+//   mailbox    - what imu.c used to read, /shm_imu_display, one wake up
+//                per sample and samples it was too slow for are lost
+//   ring N/Mms - /shm_imu_batch, batches of up to N samples or M ms
+//
+// Samples built by tlv_synth are written to a pipe standing in for the
+// sensor board at BENCH_IMU_RATE_HZ, the sensor program parses them in a
+// child process. The consumer thread does what imu.c does minus the
+// filters. Wake ups are the futex waits that returned a sample, CPU time
+// is user + system of the sensor process and of the consumer thread.
+// Latency runs from the write() of the sample until the consumer has it.
+//
+// The board then goes quiet for BENCH_IMU_QUIET_MS before the pipe is
+// closed, the last partial batch has to go out on its deadline.
+//
+// Exits with 1 if a sample goes missing without the ring having been full
+// or reaches the consumer later than the batch deadline plus one sample
+// period. The writer's
+// worst wake up delay is added to that, a machine that stalls everything
+// for a while (a busy VM host) delays samples no batching could help.
+//
+// Uses the real /shm_imu_batch ring, don't run it next to smartscope.
+
+#define BENCH_IMU_SAMPLES  (4000)
+#define BENCH_IMU_RATE_HZ  (800)
+#define BENCH_IMU_MAILBOX  "/shm_imu_display"
+#define BENCH_IMU_QUIET_MS (100)
+
+using std::vector;
+using std::unique_ptr;
+
+typedef struct {
+  size_t received;
+  size_t wakeups;
+  double producer_cpu_ms;
+  double consumer_cpu_ms;
+  latency_percentiles latency;
+  double stall_us;    // worst wake up delay of the writer
+  uint32_t dropped;   // batches the ring had no room for
+} imu_result;
+
+static uint64_t written_ns[BENCH_IMU_SAMPLES];
+static uint64_t writer_stall_ns;
+
+static double cpu_ms(const struct rusage& usage) {
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+}
+
+static void write_samples(int fd) {
+  tlv_synth synth(synth_default_config());
+  vector<uint8_t> frame;
+
+  uint64_t next = now_ns();
+  for(size_t i = 0; i < BENCH_IMU_SAMPLES; i++) {
+    frame.clear();
+    synth.append_imu_frame(frame);
+
+    pace(next, BENCH_IMU_RATE_HZ);
+
+    written_ns[i]   = now_ns();
+    writer_stall_ns = std::max(writer_stall_ns, written_ns[i] - next);
+    size_t written = 0;
+    while(written < frame.size()) {
+      written += write(fd, frame.data() + written, frame.size() - written);
+    }
+  }
+  usleep(BENCH_IMU_QUIET_MS * 1000);
+}
+
+// tlv_synth stamps sample i with i * (32768 / 800) board cycles
+static void record_latency(const imu_t& sample, vector<uint64_t>& latencies) {
+  uint32_t index = sample.cpu_cycles_since_boot / (32768 / 800);
+  if(index < BENCH_IMU_SAMPLES && written_ns[index]) {
+    latencies.push_back(now_ns() - written_ns[index]);
+  }
+}
+
+// The sensor program, in a child so its CPU time can be told apart
+static pid_t start_sensor_program(int data_port[2], uint32_t batch_samples, uint32_t batch_ms) {
+  pid_t sensor = fork();
+  if(0 == sensor) {
+    close(data_port[1]);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    set_imu_batch(batch_samples, batch_ms);
+
+    unique_ptr<tty_handler> handler(new tty_handler(data_port[0]));
+    while(REQUEST_RESET != serve_sensor_board(*handler));
+    _exit(0);
+  }
+  return sensor;
+}
+
+template<typename Consume>
+static imu_result run(uint32_t batch_samples, uint32_t batch_ms, Consume consume) {
+  int data_port[2];
+  assert(0 == pipe(data_port));
+  pid_t sensor = start_sensor_program(data_port, batch_samples, batch_ms);
+  close(data_port[0]);
+
+  memset(written_ns, 0, sizeof(written_ns));
+  writer_stall_ns = 0;
+  imu_result result = {0};
+  vector<uint64_t> latencies;
+  std::atomic<bool> done{false};
+  std::thread consumer([&]() {
+    struct rusage start, end;
+    getrusage(RUSAGE_THREAD, &start);
+    while(!done) {
+      result.wakeups += consume(latencies);
+    }
+    getrusage(RUSAGE_THREAD, &end);
+    result.consumer_cpu_ms = cpu_ms(end) - cpu_ms(start);
+  });
+
+  write_samples(data_port[1]);
+  close(data_port[1]);
+
+  struct rusage usage;
+  wait4(sensor, NULL, 0, &usage);
+  result.producer_cpu_ms = cpu_ms(usage);
+  usleep(100000);
+  done = true;
+  consumer.join();
+
+  result.stall_us = writer_stall_ns / 1e3;
+  result.received = latencies.size();
+  result.latency  = summarize_latencies(latencies);
+  return result;
+}
+
+static imu_result run_mailbox() {
+  shm_mailbox mailbox = {0};
+  if(shm_mailbox_open(&mailbox, BENCH_IMU_MAILBOX, sizeof(imu_t))) {
+    assert(0);
+  }
+  mq_topic subscription = mq_topic_subscribe(mq_registry_instance(), BENCH_IMU_MAILBOX, MQ_TOPIC_MAILBOX);
+
+  imu_result result = run(1, 0, [&](vector<uint64_t>& latencies) {
+    imu_t sample;
+    if(shm_mailbox_wait(&mailbox, &sample, sizeof(sample), NULL, 100)) {
+      record_latency(sample, latencies);
+      return 1;
+    }
+    return 0;
+  });
+
+  mq_topic_unsubscribe(mq_registry_instance(), &subscription);
+  shm_mailbox_close(&mailbox);
+  return result;
+}
+
+static imu_result run_ring(uint32_t batch_samples, uint32_t batch_ms) {
+  shm_ring ring = {0};
+  if(shm_ring_open(&ring, IMU_BATCH_RING_PATH, IMU_BATCH_RING_SLOTS, sizeof(imu_batch))) {
+    assert(0);
+  }
+  shm_ring_skip_to_latest(&ring);
+  uint32_t dropped = shm_ring_dropped(&ring);
+  mq_topic subscription = mq_topic_subscribe(mq_registry_instance(), IMU_BATCH_RING_PATH, MQ_TOPIC_RING);
+
+  imu_result result = run(batch_samples, batch_ms, [&](vector<uint64_t>& latencies) {
+    uint32_t len;
+    const imu_batch* batch = static_cast<const imu_batch*>(shm_ring_peek(&ring, &len, 100));
+    if(!batch) {
+      return 0;
+    }
+    for(uint32_t i = 0; i < batch->count; i++) {
+      record_latency(batch->samples[i], latencies);
+    }
+    shm_ring_release(&ring);
+    return 1;
+  });
+
+  result.dropped = shm_ring_dropped(&ring) - dropped;
+  mq_topic_unsubscribe(mq_registry_instance(), &subscription);
+  shm_ring_close(&ring);
+  return result;
+}
+
+static void print_result(const char* transport, const imu_result& r) {
+  double seconds = (double)BENCH_IMU_SAMPLES / BENCH_IMU_RATE_HZ;
+  printf("%-14s | %8d %8zu | %9.1f | %9.2f %9.2f | %8.1f %8.1f | %8.1f\n", transport, BENCH_IMU_SAMPLES, r.received,
+         r.wakeups / seconds, r.producer_cpu_ms / seconds / 10, r.consumer_cpu_ms / seconds / 10, r.latency.p50_us, r.latency.max_us,
+         r.stall_us);
+}
+
+// Every sample, none later than the deadline and the sample after it
+static bool check_ring(uint32_t batch_ms, const imu_result& r) {
+  double bound_us = batch_ms * 1e3 + 1e6 / BENCH_IMU_RATE_HZ + r.stall_us;
+  if(r.dropped) {
+    printf("  ring was full, %u batches dropped\n", r.dropped);
+  }
+  if((BENCH_IMU_SAMPLES != r.received && 0 == r.dropped) || r.latency.max_us > bound_us) {
+    printf("  expected %d samples within %.0f us (writer stalled up to %.0f us)\n", BENCH_IMU_SAMPLES, bound_us,
+           r.stall_us);
+    return false;
+  }
+  return true;
+}
+
+int main() {
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  shm_unlink(IMU_BATCH_RING_PATH);
+  shm_unlink(BENCH_IMU_MAILBOX);
+
+  printf("IMU samples to the consumer, %d samples at %d Hz per run\n", BENCH_IMU_SAMPLES, BENCH_IMU_RATE_HZ);
+  printf("%-14s | %8s %8s | %9s | %9s %9s | %8s %8s | %8s\n", "transport", "sent", "received", "wakeups/s", "sensor %",
+         "imu thr %", "p50 us", "max us", "stall us");
+  print_result("mailbox", run_mailbox());
+
+  bool ok = true;
+  const uint32_t configs[][2] = { {1, 0}, {8, 2}, {8, 10}, {32, 40} };
+  for(const auto& config : configs) {
+    char name[32];
+    snprintf(name, sizeof(name), "ring %u/%ums", config[0], config[1]);
+    imu_result result = run_ring(config[0], config[1]);
+    print_result(name, result);
+    ok &= check_ring(config[1], result);
+  }
+  shm_unlink(IMU_BATCH_RING_PATH);
+  shm_unlink(BENCH_IMU_MAILBOX);
+  return ok ? 0 : 1;
+}
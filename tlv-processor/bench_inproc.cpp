@@ -0,0 +1,262 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "tty.h"
+#include "tlv_synth.h"
+#include "bench.h"
+#include "tlv_processor.h"
+#include "message_queue.h"
+#include "shm_ring.h"
+#include "shm_mailbox.h"
+
+// Radar latency of the two smartscope layouts:
+//   multi process - radar program -> /shm_radar ring -> radar_thread
+//                   (cartesian conversion) -> mailbox -> distance thread
+//   in process    - parser thread (libtlvproc) -> sink (cartesian
+//                   conversion) -> mailbox -> distance thread
+//
+// Frames built by tlv_synth are written to a pipe standing in for the
+// data port at BENCH_INPROC_RATE_HZ. Latency runs from the write() of the
+// frame until the distance thread has the calibrated cloud.
+//
+// Doubles as the stress test for big clouds, up to about the most points a
+// data port frame can hold (MAX_TLV_SIZE). Clipped counts clouds that got
+// to the distance thread with fewer points than the frame had.
+//
+// Uses the real /shm_radar ring, don't run it next to the radar program.
+
+#define BENCH_INPROC_FRAMES  (1000)
+#define BENCH_INPROC_RATE_HZ (200)
+#define BENCH_INPROC_MAILBOX "/bench_inproc_calibrated"
+
+using std::vector;
+using std::unique_ptr;
+
+// Same layout as cartesian_point_cloud_and_meta_t in scope-deepstream
+typedef struct {
+  float x;
+  float y;
+  float z;
+  int16_t snr;
+  int16_t noise;
+} bench_point_cartesian;
+
+typedef struct {
+  PointCloudMetaData    meta_data;
+  uint32_t              reserved[3];
+  bench_point_cartesian points[RADAR_RING_MAX_POINTS];
+} bench_cartesian_cloud;
+
+typedef struct {
+  size_t received;
+  size_t clipped;
+  latency_percentiles latency;
+} latency_result;
+
+static synth_config frame_config(int points) {
+  synth_config cfg = synth_default_config();
+  cfg.points       = points;
+  cfg.noise_points = points / 4;
+  return cfg;
+}
+
+static shm_mailbox calibrated_writer;
+static shm_mailbox calibrated_reader;
+static uint64_t    written_ns[BENCH_INPROC_FRAMES];
+static uint32_t    frame_points;
+
+// What radar.c does to every cloud (minus the dump file)
+static void calibrate(const PointCloudWire* cloud) {
+  static bench_cartesian_cloud cart_cloud;
+  const DPIF_PointCloudSpherical* spheres = point_cloud_wire_points(cloud);
+  const DPIF_PointCloudSideInfo*  side    = point_cloud_wire_side_info(cloud);
+
+  uint32_t points = cloud->meta_data.points;
+  for(uint32_t i = 0; i < points; i++) {
+    float R     = spheres[i].range;
+    float phi   = spheres[i].elevAngle;
+    float theta = spheres[i].azimuthAngle;
+    cart_cloud.points[i] = { R * cosf(phi) * sinf(theta) * -1, R * cosf(phi) * cosf(theta), R * sinf(phi) * -1,
+                             side[i].snr, side[i].noise };
+  }
+  cart_cloud.meta_data = cloud->meta_data;
+  shm_mailbox_write(&calibrated_writer, &cart_cloud, offsetof(bench_cartesian_cloud, points) + points * sizeof(bench_point_cartesian));
+}
+
+// Stands in for algo.c's distance thread
+static void distance_thread(std::atomic<bool>* done, vector<uint64_t>* latencies, size_t* clipped) {
+  static bench_cartesian_cloud cloud;
+  while(!*done) {
+    uint32_t len = shm_mailbox_wait(&calibrated_reader, &cloud, sizeof(cloud), NULL, 100);
+    if(len) {
+      uint32_t frame = cloud.meta_data.frameNumber;
+      if(frame < BENCH_INPROC_FRAMES) {
+        latencies->push_back(now_ns() - written_ns[frame]);
+      }
+      if(cloud.meta_data.points != frame_points ||
+         len != offsetof(bench_cartesian_cloud, points) + frame_points * sizeof(bench_point_cartesian)) {
+        (*clipped)++;
+      }
+    }
+  }
+}
+
+// Frames are built as they go out, a run of the biggest ones would not
+// fit in memory up front. Same config, same frames for both layouts.
+static void write_frames(int fd, const synth_config& cfg) {
+  tlv_synth synth(cfg);
+  vector<uint8_t> frame;
+
+  uint64_t next = now_ns();
+  for(size_t i = 0; i < BENCH_INPROC_FRAMES; i++) {
+    frame.clear();
+    synth.append_frame(frame);
+    pace(next, BENCH_INPROC_RATE_HZ);
+
+    // Stamped first, the parser may well be done before write() returns
+    written_ns[i] = now_ns();
+    size_t written = 0;
+    while(written < frame.size()) {
+      written += write(fd, frame.data() + written, frame.size() - written);
+    }
+  }
+}
+
+static void parse_until_eof(int fd) {
+  unique_ptr<tty_handler> handler(new tty_handler(fd));
+  while(REQUEST_RESET != handler->tty_read_frame()) {
+    handle_radar_frame(handler->get_last_processed_tlv());
+  }
+}
+
+static latency_result summarize(vector<uint64_t>& latencies, size_t clipped) {
+  latency_result result = {0};
+  result.received = latencies.size();
+  result.clipped  = clipped;
+  result.latency  = summarize_latencies(latencies);
+  return result;
+}
+
+static latency_result run_multi_process(const synth_config& cfg) {
+  shm_unlink(RADAR_RING_PATH);
+  shm_ring ring = {0};
+  if(shm_ring_open(&ring, RADAR_RING_PATH, RADAR_RING_SLOTS, RADAR_RING_SLOT_SIZE)) {
+    assert(0);
+  }
+  mq_topic subscription = mq_topic_subscribe(mq_registry_instance(), RADAR_RING_PATH, MQ_TOPIC_RING);
+
+  int data_port[2];
+  assert(0 == pipe(data_port));
+
+  // The radar program
+  pid_t radar = fork();
+  if(0 == radar) {
+    close(data_port[1]);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    parse_until_eof(data_port[0]);
+    _exit(0);
+  }
+  close(data_port[0]);
+
+  // radar_thread
+  std::atomic<bool> done{false};
+  std::thread consumer([&]() {
+    while(!done) {
+      uint32_t len;
+      const void* cloud = shm_ring_peek(&ring, &len, 100);
+      if(cloud) {
+        calibrate(static_cast<const PointCloudWire*>(cloud));
+        shm_ring_release(&ring);
+      }
+    }
+  });
+
+  vector<uint64_t> latencies;
+  size_t clipped = 0;
+  std::thread distance(distance_thread, &done, &latencies, &clipped);
+
+  write_frames(data_port[1], cfg);
+  close(data_port[1]);
+  waitpid(radar, NULL, 0);
+  usleep(100000);
+  done = true;
+  consumer.join();
+  distance.join();
+
+  mq_topic_unsubscribe(mq_registry_instance(), &subscription);
+  shm_ring_close(&ring);
+  shm_unlink(RADAR_RING_PATH);
+  return summarize(latencies, clipped);
+}
+
+static latency_result run_in_process(const synth_config& cfg) {
+  int data_port[2];
+  assert(0 == pipe(data_port));
+
+  // The parser prints per frame, like it does in smartscope
+  int stdout_fd = dup(STDOUT_FILENO);
+  int null_fd   = open("/dev/null", O_WRONLY);
+  fflush(stdout);
+  dup2(null_fd, STDOUT_FILENO);
+
+  set_radar_cloud_sink(calibrate);
+  std::thread parser(parse_until_eof, data_port[0]);
+
+  std::atomic<bool> done{false};
+  vector<uint64_t> latencies;
+  size_t clipped = 0;
+  std::thread distance(distance_thread, &done, &latencies, &clipped);
+
+  write_frames(data_port[1], cfg);
+  close(data_port[1]);
+  parser.join();
+  usleep(100000);
+  done = true;
+  distance.join();
+  set_radar_cloud_sink(nullptr);
+
+  fflush(stdout);
+  dup2(stdout_fd, STDOUT_FILENO);
+  close(null_fd);
+  close(stdout_fd);
+  return summarize(latencies, clipped);
+}
+
+static void print_result(const char* mode, int points, const latency_result& r) {
+  printf("%-14s %6d | %8zu %8zu %8zu | %8.1f %8.1f %8.1f\n", mode, points, (size_t)BENCH_INPROC_FRAMES, r.received,
+         r.clipped, r.latency.p50_us, r.latency.p99_us, r.latency.max_us);
+}
+
+int main() {
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  shm_unlink(BENCH_INPROC_MAILBOX);
+  if(shm_mailbox_open(&calibrated_writer, BENCH_INPROC_MAILBOX, sizeof(bench_cartesian_cloud)) ||
+     shm_mailbox_open(&calibrated_reader, BENCH_INPROC_MAILBOX, sizeof(bench_cartesian_cloud))) {
+    return 1;
+  }
+
+  printf("Radar frame to distance thread, %d frames at %d Hz per run\n", BENCH_INPROC_FRAMES, BENCH_INPROC_RATE_HZ);
+  printf("%-14s %6s | %8s %8s %8s | %8s %8s %8s\n", "layout", "points", "sent", "received", "clipped", "p50 us", "p99 us", "max us");
+  for(int points : {64, 325, 1000, 4000, 10000}) {
+    frame_points = points;
+    print_result("multi process", points, run_multi_process(frame_config(points)));
+    print_result("in process", points, run_in_process(frame_config(points)));
+  }
+
+  shm_mailbox_close(&calibrated_writer);
+  shm_mailbox_close(&calibrated_reader);
+  shm_unlink(BENCH_INPROC_MAILBOX);
+}
@@ -0,0 +1,224 @@
+#include <fcntl.h>
+#include <mqueue.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "shm_ring.h"
+#include "radar_tlv.h"
+#include "message_queue.h"
+#include "bench.h"
+
+// Radar cloud transport benchmark: POSIX mqueue (what /mq_radar used to
+// be) vs shm_ring (/shm_radar). A producer thread publishes clouds at
+// BENCH_IPC_RATE_HZ, a consumer thread reads every point of each cloud.
+//
+// Latency is from the producer stamping the cloud (right before it is
+// handed to the transport, like enque_to_python_radar) until the consumer
+// has it. Copies count every memcpy of the cloud between the parser's
+// TLV buffer and the consumer: mqueue = build + mq_send + mq_receive,
+// shm_ring = build (straight into the slot).
+
+#define BENCH_IPC_FRAMES  (3000)
+#define BENCH_IPC_RATE_HZ (1000)
+#define BENCH_IPC_MQ      "/bench_ipc_mq"
+#define BENCH_IPC_RING    "/bench_ipc_ring"
+
+using std::vector;
+
+typedef struct {
+  size_t received;
+  size_t dropped;
+  latency_percentiles latency;
+  double copied_per_frame;
+} ipc_result;
+
+// Cloud is PointCloudSpherical or PointCloudWire
+template<typename Cloud>
+static void stamp(Cloud* cloud, uint32_t frame, uint32_t points) {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  cloud->meta_data.frameNumber = frame;
+  cloud->meta_data.points      = points;
+  cloud->meta_data.seconds     = tp.tv_sec;
+  cloud->meta_data.nanoseconds = tp.tv_nsec;
+}
+
+template<typename Cloud>
+static uint64_t age_ns(const Cloud* cloud) {
+  return now_ns() - (cloud->meta_data.seconds * 1000000000ULL + cloud->meta_data.nanoseconds);
+}
+
+// Stands in for radar.c, touches every point like the cartesian conversion
+static float consume(const PointCloudSpherical* cloud) {
+  float sum = 0;
+  for(uint32_t i = 0; i < cloud->meta_data.points; i++) {
+    sum += cloud->points[i].sphere.range;
+  }
+  return sum;
+}
+
+static float consume(const PointCloudWire* cloud) {
+  const DPIF_PointCloudSpherical* spheres = point_cloud_wire_points(cloud);
+  float sum = 0;
+  for(uint32_t i = 0; i < cloud->meta_data.points; i++) {
+    sum += spheres[i].range;
+  }
+  return sum;
+}
+
+static void summarize(vector<uint64_t>& latencies, ipc_result& result) {
+  result.received = latencies.size();
+  result.latency  = summarize_latencies(latencies);
+}
+
+static ipc_result bench_mq(const vector<SphericalPointAndSnr>& tlv_points) {
+  static PointCloudSpherical cloud;
+  uint32_t points = tlv_points.size();
+  size_t   len    = sizeof(PointCloudMetaData) + points * sizeof(SphericalPointAndSnr);
+
+  struct mq_attr attr = {0};
+  attr.mq_maxmsg  = MESSAGE_QUEUE_LEN;
+  attr.mq_msgsize = MESSAGE_QUEUE_SIZE;
+  mq_unlink(BENCH_IPC_MQ);
+  mqd_t producer = mq_open(BENCH_IPC_MQ, O_CREAT | O_WRONLY | O_NONBLOCK, 0600, &attr);
+  mqd_t consumer = mq_open(BENCH_IPC_MQ, O_RDONLY);
+  assert(-1 != producer && -1 != consumer);
+
+  ipc_result result = {0};
+  vector<uint64_t> latencies;
+  std::thread reader([&]() {
+    static char buff[MESSAGE_QUEUE_SIZE];
+    while(true) {
+      mq_receive(consumer, buff, sizeof(buff), NULL);
+      const PointCloudSpherical* received = reinterpret_cast<const PointCloudSpherical*>(buff);
+      if(received->meta_data.frameNumber == UINT32_MAX) {
+        return;
+      }
+      latencies.push_back(age_ns(received));
+      consume(received);
+    }
+  });
+
+  uint64_t next = now_ns();
+  for(uint32_t frame = 0; frame < BENCH_IPC_FRAMES; frame++) {
+    pace(next, BENCH_IPC_RATE_HZ);
+    memcpy(reinterpret_cast<uint8_t*>(&cloud) + sizeof(PointCloudMetaData), tlv_points.data(), points * sizeof(SphericalPointAndSnr));
+    stamp(&cloud, frame, points);
+    if(mq_send(producer, reinterpret_cast<char*>(&cloud), len, 0)) {
+      result.dropped++;
+    }
+  }
+
+  cloud.meta_data.frameNumber = UINT32_MAX;
+  while(mq_send(producer, reinterpret_cast<char*>(&cloud), sizeof(PointCloudMetaData), 0)) {
+    usleep(100);
+  }
+  reader.join();
+
+  mq_close(producer);
+  mq_close(consumer);
+  mq_unlink(BENCH_IPC_MQ);
+
+  summarize(latencies, result);
+  result.copied_per_frame = 3.0 * len;
+  return result;
+}
+
+static ipc_result bench_ring(const vector<SphericalPointAndSnr>& tlv_points) {
+  uint32_t points = tlv_points.size();
+  size_t   len    = point_cloud_wire_size(points);
+
+  // The parser gets the points and the side info as two TLVs
+  vector<DPIF_PointCloudSpherical> tlv_spheres(points);
+  vector<DPIF_PointCloudSideInfo>  tlv_side(points);
+  for(uint32_t i = 0; i < points; i++) {
+    tlv_spheres[i] = tlv_points[i].sphere;
+    tlv_side[i]    = tlv_points[i].side;
+  }
+
+  shm_unlink(BENCH_IPC_RING);
+  shm_ring producer = {0};
+  shm_ring consumer = {0};
+  if(shm_ring_open(&producer, BENCH_IPC_RING, RADAR_RING_SLOTS, RADAR_RING_SLOT_SIZE) ||
+     shm_ring_open(&consumer, BENCH_IPC_RING, RADAR_RING_SLOTS, RADAR_RING_SLOT_SIZE)) {
+    assert(0);
+  }
+
+  ipc_result result = {0};
+  vector<uint64_t> latencies;
+  std::thread reader([&]() {
+    while(true) {
+      uint32_t received_len;
+      const PointCloudWire* received = static_cast<const PointCloudWire*>(shm_ring_peek(&consumer, &received_len, -1));
+      if(received->meta_data.frameNumber == UINT32_MAX) {
+        shm_ring_release(&consumer);
+        return;
+      }
+      latencies.push_back(age_ns(received));
+      consume(received);
+      shm_ring_release(&consumer);
+    }
+  });
+
+  uint64_t next = now_ns();
+  for(uint32_t frame = 0; frame <= BENCH_IPC_FRAMES; frame++) {
+    if(frame < BENCH_IPC_FRAMES) {
+      pace(next, BENCH_IPC_RATE_HZ);
+    }
+    PointCloudWire* cloud = static_cast<PointCloudWire*>(shm_ring_claim(&producer));
+    if(!cloud) {
+      if(frame == BENCH_IPC_FRAMES) {
+        // Don't lose the end marker
+        usleep(100);
+        frame--;
+      }
+      continue;
+    }
+    stamp(cloud, frame == BENCH_IPC_FRAMES ? UINT32_MAX : frame, points);
+    cloud->version = POINT_CLOUD_WIRE_VERSION;
+    memcpy(point_cloud_wire_points(cloud), tlv_spheres.data(), points * sizeof(DPIF_PointCloudSpherical));
+    memcpy(point_cloud_wire_side_info(cloud), tlv_side.data(), points * sizeof(DPIF_PointCloudSideInfo));
+    shm_ring_publish(&producer, len);
+  }
+  reader.join();
+
+  result.dropped = shm_ring_dropped(&producer);
+  shm_ring_close(&producer);
+  shm_ring_close(&consumer);
+  shm_unlink(BENCH_IPC_RING);
+
+  summarize(latencies, result);
+  result.copied_per_frame = len;
+  return result;
+}
+
+static void print_result(const char* transport, uint32_t points, const ipc_result& r) {
+  printf("%-9s %6u | %8zu %8zu | %8.2f %8.2f %8.2f | %12.0f\n", transport, points, r.received, r.dropped,
+         r.latency.p50_us, r.latency.p99_us, r.latency.max_us, r.copied_per_frame);
+}
+
+int main() {
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  printf("Radar cloud transport, %d frames at %d Hz per run\n", BENCH_IPC_FRAMES, BENCH_IPC_RATE_HZ);
+  printf("%-9s %6s | %8s %8s | %8s %8s %8s | %12s\n", "transport", "points", "received", "dropped",
+         "p50 us", "p99 us", "max us", "copied/frame");
+
+  for(uint32_t points : {16, 64, 325, 1000, 4000, 10000}) {
+    vector<SphericalPointAndSnr> tlv_points(points);
+    for(uint32_t i = 0; i < points; i++) {
+      tlv_points[i].sphere.range = i * 0.1f;
+    }
+
+    // A message can't hold more than MAX_CLOUD_POINTS
+    if(points <= MAX_CLOUD_POINTS) {
+      print_result("mqueue", points, bench_mq(tlv_points));
+    }
+    print_result("shm_ring", points, bench_ring(tlv_points));
+  }
+}
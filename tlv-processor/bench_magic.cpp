@@ -0,0 +1,142 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <iostream>
+#include <vector>
+
+#include "magic_scan.h"
+#include "bench.h"
+
+// Throughput benchmark for the magic word scanner. Builds a synthetic
+// stream that looks like the radar after a USB hiccup: random noise, a lot
+// of partial magic words and a real magic word every BENCH_FRAME_GAP bytes,
+// then resyncs on it over and over with every implementation available.
+
+#define BENCH_STREAM_SIZE (1024*1024*16)
+#define BENCH_FRAME_GAP   (1024*64)
+#define BENCH_ITERATIONS  (20)
+
+using std::vector;
+
+typedef size_t (*find_magic_fn)(const uint8_t*, size_t);
+
+static const uint8_t magic_key[] = {2,1,4,3,6,5,8,7};
+
+// What tty_read_frame used to do, one byte per iteration
+static size_t find_magic_bytewise(const uint8_t* buff, size_t len) {
+  size_t matched = 0;
+  for(size_t i = 0; i < len; i++) {
+    if(magic_key[matched] == buff[i]) {
+      matched++;
+      if(sizeof(magic_key) == matched) {
+        return i + 1 - matched;
+      }
+    } else {
+      i -= matched;
+      matched = 0;
+    }
+  }
+  return len - matched;
+}
+
+// noise_pct is how often (in %) a partial magic word is dropped in the noise
+static vector<uint8_t> build_stream(int noise_pct, vector<size_t>& expected) {
+  vector<uint8_t> stream(BENCH_STREAM_SIZE);
+  srand(noise_pct + 1);
+
+  for(size_t i = 0; i < stream.size(); i++) {
+    stream[i] = rand() & 0xFF;
+  }
+
+  // Partial matches, these are what the old byte by byte matcher choked on
+  for(size_t i = 0; i + sizeof(magic_key) < stream.size(); i += 64) {
+    if(rand() % 100 < noise_pct) {
+      memcpy(&stream[i], magic_key, 1 + rand() % (sizeof(magic_key) - 1));
+    }
+  }
+
+  for(size_t i = BENCH_FRAME_GAP; i + sizeof(magic_key) < stream.size(); i += BENCH_FRAME_GAP) {
+    memcpy(&stream[i], magic_key, sizeof(magic_key));
+  }
+
+  // Noise could have produced a magic word on its own, work out the truth
+  // the slow way
+  for(size_t i = 0; i + sizeof(magic_key) <= stream.size(); i++) {
+    if(0 == memcmp(&stream[i], magic_key, sizeof(magic_key))) {
+      expected.push_back(i);
+    }
+  }
+  return stream;
+}
+
+// Walks the stream in read() sized chunks just like the parser does,
+// carrying partial matches over into the next chunk
+static size_t scan_stream(find_magic_fn fn, const vector<uint8_t>& stream, size_t chunk, vector<size_t>* found) {
+  size_t pos     = 0;
+  size_t buffered_end = 0;
+  size_t matches = 0;
+
+  while(pos < stream.size()) {
+    buffered_end = (buffered_end + chunk < stream.size()) ? buffered_end + chunk : stream.size();
+    while(true) {
+      size_t skip = fn(&stream[pos], buffered_end - pos);
+      pos += skip;
+      if(pos + sizeof(magic_key) > buffered_end) {
+        break;
+      }
+      if(found) {
+        found->push_back(pos);
+      }
+      matches++;
+      pos++;
+    }
+    if(buffered_end == stream.size()) {
+      break;
+    }
+  }
+  return matches;
+}
+
+static void bench(const char* name, find_magic_fn fn, const vector<uint8_t>& stream, const vector<size_t>& expected, size_t chunk) {
+  vector<size_t> found;
+  scan_stream(fn, stream, chunk, &found);
+  if(found != expected) {
+    printf("  %-8s MISMATCH! found %zu magic words, expected %zu\n", name, found.size(), expected.size());
+    exit(1);
+  }
+
+  double start = now_s();
+  for(int i = 0; i < BENCH_ITERATIONS; i++) {
+    scan_stream(fn, stream, chunk, NULL);
+  }
+  double elapsed = now_s() - start;
+  double mb = (double)stream.size() * BENCH_ITERATIONS / (1024 * 1024);
+
+  printf("  %-8s %9.1f MB/s\n", name, mb / elapsed);
+}
+
+int main() {
+  printf("find_magic() dispatches to: %s\n", find_magic_impl_name());
+
+  for(int noise_pct : {0, 10, 50, 100}) {
+    vector<size_t> expected;
+    vector<uint8_t> stream = build_stream(noise_pct, expected);
+
+    for(size_t chunk : {64, 2048, 65536}) {
+      printf("partial magic in %3d%% of 64B blocks, %zu byte reads, %zu magic words\n", noise_pct, chunk, expected.size());
+      bench("bytewise", find_magic_bytewise, stream, expected, chunk);
+      bench("scalar", find_magic_scalar, stream, expected, chunk);
+#if defined(__x86_64__) || defined(__i386__)
+      bench("sse2", find_magic_sse2, stream, expected, chunk);
+      if(find_magic_avx2_supported()) {
+        bench("avx2", find_magic_avx2, stream, expected, chunk);
+      }
+#endif
+#if defined(__ARM_NEON)
+      bench("neon", find_magic_neon, stream, expected, chunk);
+#endif
+    }
+  }
+}
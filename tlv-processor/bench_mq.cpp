@@ -0,0 +1,108 @@
+#include <fcntl.h>
+#include <mqueue.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <map>
+#include <string>
+
+#include "sensor_board_tlv.h"
+#include "message_queue.h"
+#include "bench.h"
+
+// Per send cost of publishing an IMU sample:
+//   legacy        - mq_enqueue as it used to be: path by value, a fresh
+//                   message_queue and a std::map<std::string, mqd_t> lookup
+//   mq_enqueue    - the wrapper over mq_publisher (path by reference)
+//   mq_publisher  - a handle resolved once, what sensor.cpp uses
+//   unsubscribed  - mq_publisher on a topic nobody subscribed to (the
+//                   send is skipped, like /mq_imu_tracking on the scope)
+//
+// Sends are timed in batches of MESSAGE_QUEUE_LEN, the queue is drained
+// (untimed) in between so every mq_send succeeds. The mq_send syscall
+// alone is measured on a raw mqd_t for reference.
+
+#define BENCH_MQ_ROUNDS (100000)
+#define BENCH_MQ_PATH   "/bench_mq_imu_tracking"
+
+using std::string;
+
+static std::map<string, mqd_t> legacy_store;
+
+static int legacy_enqueue(string mq_path, uint8_t* buff, size_t len) {
+  mqd_t mq;
+
+  if(0 == legacy_store.count(mq_path)) {
+    struct mq_attr attr = {0};
+    attr.mq_maxmsg = MESSAGE_QUEUE_LEN;
+    attr.mq_msgsize = MESSAGE_QUEUE_SIZE;
+    mq = mq_open(mq_path.c_str(), O_CREAT | O_WRONLY | O_NONBLOCK, 0600, &attr);
+    legacy_store.insert({mq_path, mq});
+  } else {
+    mq = legacy_store[mq_path];
+  }
+  return mq_send(mq, reinterpret_cast<char*>(buff), len, 0);
+}
+
+// Same as sensor.cpp, a path that doesn't fit std::string's small buffer
+static string path{BENCH_MQ_PATH};
+static imu_t  sample;
+
+template<typename Send>
+static double ns_per_send(mqd_t drain, Send send) {
+  char buff[MESSAGE_QUEUE_SIZE];
+  uint64_t timed = 0;
+
+  for(int round = 0; round < BENCH_MQ_ROUNDS; round++) {
+    uint64_t start = now_ns();
+    for(int i = 0; i < MESSAGE_QUEUE_LEN; i++) {
+      if(send()) {
+        printf("send failed: %s\n", strerror(errno));
+        return -1;
+      }
+    }
+    timed += now_ns() - start;
+
+    for(int i = 0; i < MESSAGE_QUEUE_LEN; i++) {
+      mq_receive(drain, buff, sizeof(buff), NULL);
+    }
+  }
+  return (double)timed / (BENCH_MQ_ROUNDS * MESSAGE_QUEUE_LEN);
+}
+
+int main() {
+  mq_unlink(BENCH_MQ_PATH);
+  mq_publisher publisher(path);
+
+  struct mq_attr attr = {0};
+  attr.mq_maxmsg  = MESSAGE_QUEUE_LEN;
+  attr.mq_msgsize = MESSAGE_QUEUE_SIZE;
+  mqd_t drain = mq_open(BENCH_MQ_PATH, O_CREAT | O_RDONLY | O_NONBLOCK, 0600, &attr);
+  mqd_t raw   = mq_open(BENCH_MQ_PATH, O_WRONLY | O_NONBLOCK);
+  uint8_t* bytes = reinterpret_cast<uint8_t*>(&sample);
+
+  double unsubscribed_ns = ns_per_send(drain, [&]() { return publisher.publish(sample); });
+
+  // From here on the drain counts as a subscriber
+  mq_topic subscription = mq_topic_subscribe(mq_registry_instance(), BENCH_MQ_PATH, MQ_TOPIC_MQUEUE);
+
+  double raw_ns       = ns_per_send(drain, [&]() { return mq_send(raw, reinterpret_cast<char*>(bytes), sizeof(sample), 0); });
+  double legacy_ns    = ns_per_send(drain, [&]() { return legacy_enqueue(path, bytes, sizeof(sample)); });
+  double wrapper_ns   = ns_per_send(drain, [&]() { return mq_enqueue(path, bytes, sizeof(sample)); });
+  double publisher_ns = ns_per_send(drain, [&]() { return publisher.publish(sample); });
+
+  printf("IMU sample (%zu bytes), %d sends each\n", sizeof(sample), BENCH_MQ_ROUNDS * MESSAGE_QUEUE_LEN);
+  printf("%-14s %10s %12s\n", "path", "ns/send", "over mq_send");
+  printf("%-14s %10.1f %12s\n",   "raw mq_send",  raw_ns, "-");
+  printf("%-14s %10.1f %12.1f\n", "legacy",       legacy_ns, legacy_ns - raw_ns);
+  printf("%-14s %10.1f %12.1f\n", "mq_enqueue",   wrapper_ns, wrapper_ns - raw_ns);
+  printf("%-14s %10.1f %12.1f\n", "mq_publisher", publisher_ns, publisher_ns - raw_ns);
+  printf("%-14s %10.1f %12.1f\n", "unsubscribed", unsubscribed_ns, unsubscribed_ns - raw_ns);
+
+  mq_topic_unsubscribe(mq_registry_instance(), &subscription);
+  mq_close(raw);
+  mq_close(drain);
+  mq_unlink(BENCH_MQ_PATH);
+}
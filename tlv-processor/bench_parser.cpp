@@ -0,0 +1,176 @@
+#include <fcntl.h>
+#include <mqueue.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "tty.h"
+#include "tlv_synth.h"
+#include "tlv_processor.h"
+#include "message_queue.h"
+#include "bench.h"
+
+// Throughput/latency benchmark of the host side parse path:
+// tty_handler::tty_read_frame + process_radar_tlv / process_sensor_board_tlv
+// over in-memory (memfd) streams built by tlv_synth.
+//
+// Latency is measured per frame, from the call to tty_read_frame until the
+// parser returns, so it includes the read() calls that completed the frame.
+//
+// Frames are only copied out of the ring when they wrap around its end,
+// at most one frame per lap of the ring. Exits with 1 if a run copies more
+// than that bound, (laps + 1) * its largest frame.
+
+#define BENCH_RADAR_STREAM_BYTES (1024*1024*32)
+#define BENCH_IMU_FRAMES         (200000)
+
+using std::vector;
+using std::unique_ptr;
+
+typedef struct {
+  size_t   frames;
+  size_t   bytes;
+  double   seconds;
+  latency_percentiles latency;
+  size_t   max_frame_len;
+  tty_stats stats;
+} bench_result;
+
+static int stdout_fd;
+static bool copies_ok = true;
+
+// The parsers print per frame, keep that out of the report but still
+// pay for it like the real programs do
+static void quiet_stdout(bool quiet) {
+  fflush(stdout);
+  if(quiet) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+  } else {
+    dup2(stdout_fd, STDOUT_FILENO);
+  }
+}
+
+static int memfd_stream(const vector<uint8_t>& bytes) {
+  int fd = memfd_create("bench_stream", 0);
+  size_t written = 0;
+  while(written < bytes.size()) {
+    written += write(fd, bytes.data() + written, bytes.size() - written);
+  }
+  lseek(fd, 0, SEEK_SET);
+  return fd;
+}
+
+static bench_result run(const vector<uint8_t>& stream, size_t chunk, void (*parse)(processed_tlv)) {
+  unique_ptr<tty_handler> handler(new tty_handler(memfd_stream(stream)));
+  handler->set_read_chunk_size(chunk);
+
+  vector<uint64_t> latencies;
+  latencies.reserve(BENCH_IMU_FRAMES);
+  size_t max_frame_len = 0;
+
+  quiet_stdout(true);
+  uint64_t start = now_ns();
+  while(true) {
+    uint64_t frame_start = now_ns();
+    if(REQUEST_RESET == handler->tty_read_frame()) {
+      break;
+    }
+    processed_tlv frame = handler->get_last_processed_tlv();
+    parse(frame);
+    latencies.push_back(now_ns() - frame_start);
+    max_frame_len = std::max(max_frame_len, frame.len);
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  bench_result result = {0};
+  result.frames  = latencies.size();
+  result.bytes   = stream.size();
+  result.seconds = elapsed / 1e9;
+  result.stats   = handler->get_stats();
+  result.max_frame_len = max_frame_len;
+
+  handler.reset();
+  quiet_stdout(false);
+  result.latency = summarize_latencies(latencies);
+  return result;
+}
+
+static void print_header(const char* first_column) {
+  printf("%-8s %6s %8s | %8s %9s %8s %8s %8s %8s | %12s %12s\n", first_column, "chunk", "corrupt", "MB/s", "frames/s",
+         "p50 us", "p99 us", "p999 us", "max us", "copied/frame", "bound/frame");
+}
+
+static void print_result(int first_column, size_t chunk, double corrupt_pct, const bench_result& r) {
+  uint64_t bound = (r.stats.bytes_read / TLV_RING_SIZE + 1) * r.max_frame_len;
+  bool ok = r.frames && r.stats.bytes_copied <= bound;
+  copies_ok &= ok;
+
+  printf("%-8d %6zu %7.1f%% | %8.1f %9.0f %8.2f %8.2f %8.2f %8.2f | %12.1f %12.1f%s\n", first_column, chunk,
+         corrupt_pct, r.bytes / r.seconds / (1024 * 1024), r.frames / r.seconds, r.latency.p50_us, r.latency.p99_us,
+         r.latency.p999_us, r.latency.max_us, r.frames ? (double)r.stats.bytes_copied / r.frames : 0.0,
+         r.frames ? (double)bound / r.frames : 0.0, ok ? "" : "  copies more than wrapping frames");
+}
+
+static void parse_radar(processed_tlv tlv) {
+  process_radar_tlv(tlv);
+}
+
+static void bench_radar() {
+  puts("\nRadar: tty_read_frame + process_radar_tlv");
+  print_header("points");
+
+  for(int points : {16, 64, 325, 1000}) {
+    for(double corrupt_pct : {0.0, 1.0, 10.0}) {
+      synth_config cfg  = synth_default_config();
+      cfg.points        = points;
+      cfg.noise_points  = points / 4;
+      cfg.corrupt_pct   = corrupt_pct;
+
+      tlv_synth synth(cfg);
+      vector<uint8_t> stream;
+      while(stream.size() < BENCH_RADAR_STREAM_BYTES) {
+        synth.append_frame(stream);
+      }
+
+      for(size_t chunk : {64, MAX_TLV_READ_SIZE, 16384}) {
+        print_result(points, chunk, corrupt_pct, run(stream, chunk, parse_radar));
+      }
+    }
+  }
+}
+
+static void bench_sensor() {
+  // Nobody subscribes here, so the mailbox write and mqueue send are
+  // skipped (same as /mq_imu_tracking on the scope)
+  puts("\nSensor board: tty_read_frame + process_sensor_board_tlv (topics unsubscribed)");
+
+  synth_config cfg = synth_default_config();
+  tlv_synth synth(cfg);
+  vector<uint8_t> stream;
+  for(int i = 0; i < BENCH_IMU_FRAMES; i++) {
+    synth.append_imu_frame(stream);
+  }
+
+  print_header("samples");
+  for(size_t chunk : {64, MAX_TLV_READ_SIZE, 16384}) {
+    print_result(BENCH_IMU_FRAMES, chunk, 0, run(stream, chunk, process_sensor_board_tlv));
+  }
+}
+
+int main() {
+  stdout_fd = dup(STDOUT_FILENO);
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  bench_radar();
+  bench_sensor();
+  return copies_ok ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "radar_tlv.h"
+#include "point_cloud_q16.h"
+#include "bench.h"
+
+// Per point cost of reading a radar cloud off the ring in the old and the
+// new wire format. Runs two kernels over the same cloud:
+//   load      - reads every field of every point, the bare decode cost
+//   calibrate - the cartesian conversion radar.c does
+//
+// Version 1 sits where it used to in the ring: payload 8 bytes into a 64
+// byte aligned slot, so the packed points start 4 bytes off a 16 byte
+// boundary and straddle cache lines. Misaligned is the same cloud one
+// byte further along, what a plain char buffer could end up with.
+//
+// On x86 unaligned loads are close to free, the numbers that matter come
+// from the Jetson.
+//
+// Then the quantized format (version 3): bytes per cloud, encode and
+// decode cost, and the worst error quantizing put on every field.
+
+#define BENCH_WIRE_POINTS     (1000)
+#define BENCH_WIRE_ITERATIONS (20000)
+
+typedef struct {
+  float x;
+  float y;
+  float z;
+  int16_t snr;
+  int16_t noise;
+} bench_point_cartesian;
+
+static bench_point_cartesian cartesian[BENCH_WIRE_POINTS];
+
+static float load_v1(const PointCloudSphericalSlot* cloud) {
+  float acc = 0;
+  for(uint32_t i = 0; i < cloud->meta_data.points; i++) {
+    const SphericalPointAndSnr& p = cloud->points[i];
+    acc += p.sphere.range + p.sphere.azimuthAngle + p.sphere.elevAngle + p.sphere.velocity;
+    acc += p.side.snr + p.side.noise;
+  }
+  return acc;
+}
+
+static float load_v2(const PointCloudWire* cloud) {
+  const DPIF_PointCloudSpherical* spheres = point_cloud_wire_points(cloud);
+  const DPIF_PointCloudSideInfo*  side    = point_cloud_wire_side_info(cloud);
+  float acc = 0;
+  for(uint32_t i = 0; i < cloud->meta_data.points; i++) {
+    acc += spheres[i].range + spheres[i].azimuthAngle + spheres[i].elevAngle + spheres[i].velocity;
+    acc += side[i].snr + side[i].noise;
+  }
+  return acc;
+}
+
+static inline bench_point_cartesian to_cartesian(float R, float phi, float theta, int16_t snr, int16_t noise) {
+  return { R * cosf(phi) * sinf(theta) * -1, R * cosf(phi) * cosf(theta), R * sinf(phi) * -1, snr, noise };
+}
+
+static float calibrate_v1(const PointCloudSphericalSlot* cloud) {
+  for(uint32_t i = 0; i < cloud->meta_data.points; i++) {
+    const SphericalPointAndSnr& p = cloud->points[i];
+    cartesian[i] = to_cartesian(p.sphere.range, p.sphere.elevAngle, p.sphere.azimuthAngle, p.side.snr, p.side.noise);
+  }
+  return cartesian[0].x;
+}
+
+static float calibrate_v2(const PointCloudWire* cloud) {
+  const DPIF_PointCloudSpherical* spheres = point_cloud_wire_points(cloud);
+  const DPIF_PointCloudSideInfo*  side    = point_cloud_wire_side_info(cloud);
+  for(uint32_t i = 0; i < cloud->meta_data.points; i++) {
+    cartesian[i] = to_cartesian(spheres[i].range, spheres[i].elevAngle, spheres[i].azimuthAngle, side[i].snr,
+                                side[i].noise);
+  }
+  return cartesian[0].x;
+}
+
+template <typename F>
+static double ns_per_point(F&& kernel) {
+  double start = now_s();
+  for(int i = 0; i < BENCH_WIRE_ITERATIONS; i++) {
+    sink = kernel();
+  }
+  return (now_s() - start) * 1e9 / BENCH_WIRE_ITERATIONS / BENCH_WIRE_POINTS;
+}
+
+int main() {
+  // Slots as the ring lays them out, version 1 behind its old 8 byte header
+  size_t slot_size = 64 * ((point_cloud_wire_size(BENCH_WIRE_POINTS) + 64) / 64 + 1);
+  uint8_t* v1_slot = static_cast<uint8_t*>(aligned_alloc(64, slot_size));
+  uint8_t* v2_slot = static_cast<uint8_t*>(aligned_alloc(64, slot_size));
+  uint8_t* odd_buf = static_cast<uint8_t*>(aligned_alloc(64, slot_size));
+
+  PointCloudSphericalSlot* v1  = reinterpret_cast<PointCloudSphericalSlot*>(v1_slot + 8);
+  PointCloudSphericalSlot* odd = reinterpret_cast<PointCloudSphericalSlot*>(odd_buf + 9);
+  PointCloudWire*          v2  = reinterpret_cast<PointCloudWire*>(v2_slot + 16);
+
+  srand(1);
+  v1->meta_data = { 1, 0, BENCH_WIRE_POINTS, 0, 0 };
+  for(int i = 0; i < BENCH_WIRE_POINTS; i++) {
+    v1->points[i].sphere.range        = (rand() % 1000) / 100.0f;
+    v1->points[i].sphere.azimuthAngle = ((rand() % 200) - 100) / 100.0f;
+    v1->points[i].sphere.elevAngle    = ((rand() % 200) - 100) / 200.0f;
+    v1->points[i].sphere.velocity     = ((rand() % 200) - 100) / 20.0f;
+    v1->points[i].side.snr            = rand() % 300;
+    v1->points[i].side.noise          = rand() % 100;
+  }
+  memcpy(odd, v1, sizeof(PointCloudMetaData) + BENCH_WIRE_POINTS * sizeof(SphericalPointAndSnr));
+  point_cloud_wire_from_v1(v1, v2);
+
+  printf("%d points, %d iterations per run\n", BENCH_WIRE_POINTS, BENCH_WIRE_ITERATIONS);
+  printf("%-22s %12s %12s\n", "layout", "load ns/pt", "calib ns/pt");
+  printf("%-22s %12.2f %12.2f\n", "v1 packed (ring)", ns_per_point([&]() { return load_v1(v1); }),
+         ns_per_point([&]() { return calibrate_v1(v1); }));
+  printf("%-22s %12.2f %12.2f\n", "v1 packed misaligned", ns_per_point([&]() { return load_v1(odd); }),
+         ns_per_point([&]() { return calibrate_v1(odd); }));
+  printf("%-22s %12.2f %12.2f\n", "v2 aligned", ns_per_point([&]() { return load_v2(v2); }),
+         ns_per_point([&]() { return calibrate_v2(v2); }));
+
+  // What a version 1 producer costs the consumer on top
+  double convert_ns = ns_per_point([&]() {
+    point_cloud_wire_from_v1(v1, v2);
+    return (float)v2->meta_data.points;
+  });
+  printf("%-22s %12.2f\n", "v1 -> v2 conversion", convert_ns);
+
+  uint8_t* q16_slot = static_cast<uint8_t*>(aligned_alloc(64, slot_size));
+  uint8_t* decoded_slot = static_cast<uint8_t*>(aligned_alloc(64, slot_size));
+  PointCloudWireQ16* q16     = reinterpret_cast<PointCloudWireQ16*>(q16_slot + 16);
+  PointCloudWire*    decoded = reinterpret_cast<PointCloudWire*>(decoded_slot + 16);
+
+  double encode_ns = ns_per_point([&]() { return (float)point_cloud_q16_from_wire(v2, q16); });
+  double decode_ns = ns_per_point([&]() { return (float)point_cloud_q16_to_wire(q16, decoded); });
+
+  // Worst error per field, relative to the field's biggest value
+  static const char* fields[4] = { "range", "azimuth", "elevation", "velocity" };
+  float max_abs[4], max_err[4] = {0};
+  point_cloud_q16_max_abs(point_cloud_wire_points(v2), BENCH_WIRE_POINTS, max_abs);
+  const float* in  = reinterpret_cast<const float*>(point_cloud_wire_points(v2));
+  const float* out = reinterpret_cast<const float*>(point_cloud_wire_points(decoded));
+  for(int i = 0; i < 4 * BENCH_WIRE_POINTS; i++) {
+    max_err[i % 4] = fmaxf(max_err[i % 4], fabsf(in[i] - out[i]));
+  }
+  bool side_ok = 0 == memcmp(point_cloud_wire_side_info(v2), point_cloud_wire_side_info(decoded),
+                             BENCH_WIRE_POINTS * sizeof(DPIF_PointCloudSideInfo));
+
+  printf("\n%-22s %12s %12s %12s\n", "quantized", "bytes/cloud", "encode ns/pt", "decode ns/pt");
+  printf("%-22s %12u %12s %12s\n", "v2 aligned", point_cloud_wire_size(BENCH_WIRE_POINTS), "-", "-");
+  printf("%-22s %12u %12.2f %12.2f\n", "v3 q16", point_cloud_q16_size(BENCH_WIRE_POINTS), encode_ns, decode_ns);
+  for(int k = 0; k < 4; k++) {
+    printf("%-22s max %8.5f  error %10.7f\n", fields[k], max_abs[k], max_err[k]);
+  }
+  printf("side info %s\n", side_ok ? "unchanged" : "CHANGED");
+
+  free(q16_slot);
+  free(decoded_slot);
+
+  free(v1_slot);
+  free(v2_slot);
+  free(odd_buf);
+}
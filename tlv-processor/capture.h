@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+// On disk format of a raw UART capture, written by tty_handler when
+// capture is enabled and played back by the replay tool.
+//
+// <capture_file_header> { <capture_record_header> [len bytes] }*
+//
+// One record per read_stream() chunk, time stamped with CLOCK_MONOTONIC
+// so the replay can reproduce the original timing
+//
+// The file is appended to across recoveries and runs, the header is only
+// written once. A record stamped earlier than the one before it comes
+// after a reboot, the replay plays it straight after.
+
+#define CAPTURE_MAGIC   "SSCAPTR"
+#define CAPTURE_VERSION (1)
+
+// Which program recorded it, tells the replay which port variable the
+// reader takes. Files from before this was written read as radar.
+typedef enum {
+  CAPTURE_SOURCE_RADAR  = 0,
+  CAPTURE_SOURCE_SENSOR = 1,
+} capture_source_e;
+
+typedef struct {
+  char     magic[8];    // CAPTURE_MAGIC, null terminated
+  uint32_t version;
+  uint32_t source;      // capture_source_e
+} __attribute__((packed)) capture_file_header;
+
+typedef struct {
+  uint64_t monotonic_ns;
+  uint32_t len;
+} __attribute__((packed)) capture_record_header;
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+#include <deque>
+
+// Streaming matcher for the mmWave demo CLI acks. The demo answers every
+// command with a line holding "Done" (or "Error" when it rejects it).
+// Bytes are fed as they come off the port, a keyword split across two
+// reads is still found and nothing read so far is ever re-scanned.
+
+typedef enum { CLI_ACK_DONE, CLI_ACK_ERROR } cli_ack_e;
+
+class cli_matcher {
+ private:
+  static constexpr const char* keywords[] = {"Done", "Error"};
+  static constexpr int         keyword_count = 2;
+
+  size_t matched[keyword_count] = {0};
+  std::deque<cli_ack_e> acks;
+
+ public:
+  void reset() {
+    for(int k = 0; k < keyword_count; k++) {
+      matched[k] = 0;
+    }
+    acks.clear();
+  }
+
+  void feed(const char* buff, size_t len) {
+    for(size_t i = 0; i < len; i++) {
+      for(int k = 0; k < keyword_count; k++) {
+        // Neither keyword repeats its first letter, so on a mismatch
+        // the only possible restart is at the current byte
+        if(keywords[k][matched[k]] != buff[i]) {
+          matched[k] = 0;
+        }
+        if(keywords[k][matched[k]] == buff[i]) {
+          matched[k]++;
+          if('\0' == keywords[k][matched[k]]) {
+            acks.push_back(static_cast<cli_ack_e>(k));
+            matched[k] = 0;
+          }
+        }
+      }
+    }
+  }
+
+  // Oldest ack not handed out yet, returns false if there is none
+  bool pop(cli_ack_e& ack) {
+    if(acks.empty()) {
+      return false;
+    }
+    ack = acks.front();
+    acks.pop_front();
+    return true;
+  }
+};
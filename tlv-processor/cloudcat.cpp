@@ -0,0 +1,78 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "point_cloud_q16.h"
+
+// Prints a quantized radar recording (smartscope -q, radar_<time>.q16) as
+// text, one line per point:
+//
+//   $ ./cloudcat radar_1700000000.q16
+//   time(ms), frame, range, azimuth, elevation, velocity, snr, noise
+//   0.000, 5121, 4.217, -0.112, 0.031, 0.000, 211, 74
+//
+// Time is relative to the first cloud of the recording.
+
+using std::vector;
+
+int main(int argc, char** argv) {
+  if(argc != 2) {
+    puts("usage: cloudcat <recording>");
+    return 1;
+  }
+
+  FILE* fp = fopen(argv[1], "r");
+  if(!fp) {
+    printf("Failed to open %s with errno: %s\n", argv[1], strerror(errno));
+    return 1;
+  }
+
+  capture_file_header header;
+  if(1 != fread(&header, sizeof(header), 1, fp) || strncmp(header.magic, CLOUD_RECORDING_MAGIC, sizeof(header.magic)) ||
+     CLOUD_RECORDING_VERSION != header.version) {
+    printf("%s is not a radar recording\n", argv[1]);
+    return 1;
+  }
+
+  // Records are read into 16 byte aligned buffers, the codec expects them
+  vector<PointCloudWireQ16> record_buff;
+  vector<PointCloudWire>    cloud_buff;
+  uint64_t first_ns = 0;
+
+  puts("time(ms), frame, range, azimuth, elevation, velocity, snr, noise");
+  capture_record_header record;
+  while(1 == fread(&record, sizeof(record), 1, fp)) {
+    record_buff.resize(record.len / sizeof(PointCloudWireQ16) + 1);
+    if(record.len != fread(record_buff.data(), 1, record.len, fp)) {
+      fputs("Recording is truncated\n", stderr);
+      break;
+    }
+
+    const PointCloudWireQ16* quantized = record_buff.data();
+    if(POINT_CLOUD_WIRE_Q16_VERSION != point_cloud_wire_version(quantized, record.len)) {
+      fprintf(stderr, "Skipping a record of %u bytes that is not a quantized cloud\n", record.len);
+      continue;
+    }
+
+    uint32_t points = quantized->meta_data.points;
+    cloud_buff.resize(point_cloud_wire_size(points) / sizeof(PointCloudWire) + 1);
+    PointCloudWire* cloud = cloud_buff.data();
+    point_cloud_q16_to_wire(quantized, cloud);
+
+    if(0 == first_ns) {
+      first_ns = record.monotonic_ns;
+    }
+    double ms = (record.monotonic_ns - first_ns) / 1e6;
+    const DPIF_PointCloudSpherical* spheres = point_cloud_wire_points(cloud);
+    const DPIF_PointCloudSideInfo*  side    = point_cloud_wire_side_info(cloud);
+    for(uint32_t i = 0; i < points; i++) {
+      printf("%.3f, %u, %.3f, %.3f, %.3f, %.3f, %d, %d\n", ms, cloud->meta_data.frameNumber, spheres[i].range,
+             spheres[i].azimuthAngle, spheres[i].elevAngle, spheres[i].velocity, side[i].snr, side[i].noise);
+    }
+  }
+  fclose(fp);
+}
@@ -0,0 +1,146 @@
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/epoll.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cassert>
+
+#include "event_loop.h"
+
+using std::string;
+using std::unique_ptr;
+
+tty_event_loop::tty_event_loop() {
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if(-1 == epoll_fd) {
+    printf("epoll_create1 failed with errno: %s\n", strerror(errno));
+    assert(0);
+  }
+}
+
+tty_event_loop::~tty_event_loop() {
+  close(epoll_fd);
+}
+
+void tty_event_loop::watch(unique_ptr<device> dev) {
+  struct epoll_event ev = {0};
+  ev.events   = EPOLLIN;
+  ev.data.ptr = dev.get();
+
+  if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, dev->fd, &ev)) {
+    printf("Failed to watch %s with errno: %s\n", dev->name.c_str(), strerror(errno));
+    assert(0);
+  }
+  devices.push_back(std::move(dev));
+}
+
+void tty_event_loop::add_device(const string& name, tty_handler& handler, frame_callback on_frame) {
+  if(-1 != handler.get_data_fd()) {
+    watch(unique_ptr<device>(new device{name + " data", &handler, handler.get_data_fd(), true, on_frame}));
+  }
+  if(-1 != handler.get_cfg_fd()) {
+    watch(unique_ptr<device>(new device{name + " cfg", &handler, handler.get_cfg_fd(), false, nullptr}));
+  }
+}
+
+void tty_event_loop::remove_device(tty_handler& handler) {
+  auto iter = devices.begin();
+  while(iter != devices.end()) {
+    if((*iter)->handler == &handler) {
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, (*iter)->fd, NULL);
+      iter = devices.erase(iter);
+    } else {
+      iter++;
+    }
+  }
+}
+
+void tty_event_loop::add_wakeup(const string& name, int fd, wakeup_callback on_wakeup) {
+  watch(unique_ptr<device>(new device{name, nullptr, fd, false, nullptr, on_wakeup}));
+}
+
+void tty_event_loop::add_deadline(deadline_timeout timeout_ms, deadline_callback on_due) {
+  deadlines.push_back(deadline{timeout_ms, on_due});
+}
+
+// Earliest stall deadline of all data ports and of the added deadlines,
+// -1 if there is none
+int tty_event_loop::next_timeout() {
+  int timeout = -1;
+  for(auto& dev : devices) {
+    if(!dev->is_data_port) {
+      continue;
+    }
+    int left = dev->handler->tty_stall_timeout_ms();
+    if(left >= 0 && (timeout < 0 || left < timeout)) {
+      timeout = left;
+    }
+  }
+  for(auto& due : deadlines) {
+    int left = due.timeout_ms();
+    if(left >= 0 && (timeout < 0 || left < timeout)) {
+      timeout = left;
+    }
+  }
+  return timeout;
+}
+
+tty_handler* tty_event_loop::run() {
+  struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+  while(true) {
+    int ready = epoll_wait(epoll_fd, events, EVENT_LOOP_MAX_EVENTS, next_timeout());
+    if(-1 == ready) {
+      if(EINTR == errno) {
+        continue;
+      }
+      printf("epoll_wait failed with errno: %s\n", strerror(errno));
+      assert(0);
+    }
+
+    for(int i = 0; i < ready; i++) {
+      device* dev = static_cast<device*>(events[i].data.ptr);
+
+      if(dev->on_wakeup) {
+        dev->on_wakeup();
+        continue;
+      }
+
+      // Device went away (USB unplugged, radar crashed...). Either port,
+      // a dead fd stays readable and would spin the loop.
+      if(events[i].events & (EPOLLHUP | EPOLLERR)) {
+        printf("%s hung up\n", dev->name.c_str());
+        return dev->handler;
+      }
+
+      if(false == dev->is_data_port) {
+        dev->handler->tty_read_cfg_output();
+        continue;
+      }
+
+      // Level triggered, a single read() per wakeup is enough
+      if(REQUEST_RESET == dev->handler->tty_read_available()) {
+        return dev->handler;
+      }
+      while(dev->handler->tty_next_frame()) {
+        dev->on_frame(dev->handler->get_last_processed_tlv());
+      }
+    }
+
+    for(auto& due : deadlines) {
+      if(0 == due.timeout_ms()) {
+        due.on_due();
+      }
+    }
+
+    // A radar that stops talking never shows up in epoll
+    for(auto& dev : devices) {
+      if(dev->is_data_port && dev->handler->tty_stalled()) {
+        return dev->handler;
+      }
+    }
+  }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <sys/epoll.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "tty.h"
+
+#define EVENT_LOOP_MAX_EVENTS (8)
+
+typedef std::function<void(processed_tlv)> frame_callback;
+
+// Milliseconds until something is due (-1 if nothing is), and what to do
+// once it is
+typedef std::function<int()>  deadline_timeout;
+typedef std::function<void()> deadline_callback;
+
+// Called on the loop thread when a wakeup fd (an eventfd written by
+// another thread) is readable, has to drain it
+typedef std::function<void()> wakeup_callback;
+
+// Single epoll loop over every serial device (radar data + cfg port,
+// sensor board, ...). Each tty_handler keeps its own frame state machine,
+// frames are handed to that device's callback as soon as they complete.
+class tty_event_loop {
+ private:
+  typedef struct {
+    std::string    name;
+    tty_handler*   handler;
+    int            fd;
+    bool           is_data_port;
+    frame_callback on_frame;
+    wakeup_callback on_wakeup;  // only set for add_wakeup() fds
+  } device;
+
+  typedef struct {
+    deadline_timeout  timeout_ms;
+    deadline_callback on_due;
+  } deadline;
+
+  int epoll_fd;
+  std::vector<std::unique_ptr<device>> devices;
+  std::vector<deadline> deadlines;
+
+  void watch(std::unique_ptr<device>);
+  int  next_timeout();
+
+ public:
+  tty_event_loop();
+  tty_event_loop(const tty_event_loop&) = delete;
+  tty_event_loop& operator=(const tty_event_loop&) = delete;
+  ~tty_event_loop();
+
+  // Registers the data port (and the cfg port if it has one) of handler
+  void add_device(const std::string& name, tty_handler& handler, frame_callback on_frame);
+  void remove_device(tty_handler& handler);
+
+  // Wakes the loop up when timeout_ms says and calls on_due, for work
+  // that has to happen whether or not a device has anything to read
+  void add_deadline(deadline_timeout timeout_ms, deadline_callback on_due);
+
+  // Watches fd and calls on_wakeup when it is readable, for other threads
+  // handing work back to the loop. May add devices from on_wakeup.
+  void add_wakeup(const std::string& name, int fd, wakeup_callback on_wakeup);
+
+  // Serves every device until one of them needs to be reset (hung up,
+  // zero length reads or missed its stall deadline), returns the handler
+  // of that device
+  tty_handler* run();
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "sensor_board_tlv.h"
+
+// IMU samples go to scope-deepstream in batches over a shm_ring (see
+// shm_ring.h), one imu_batch per slot. The sensor program sends a batch
+// once it holds SENSOR_IMU_BATCH samples or its first sample has waited
+// SENSOR_IMU_BATCH_MS, whichever comes first. At 800Hz the defaults
+// (8 samples or 2ms) wake the IMU thread about 400 times a second instead
+// of 800, a 10ms deadline gets the full 8 samples (100 a second).
+//
+// The deadline is a timeout of whatever loop reads the board (see
+// serve_sensor_board and tty_event_loop::add_deadline), a batch goes out
+// on time even if no sample follows it. Unlike the display mailbox
+// nothing is skipped, imu.c sees every sample as long as it is less than
+// IMU_BATCH_RING_SLOTS batches behind (room for a USB burst even with
+// batches of 1).
+#define IMU_BATCH_RING_PATH        "/shm_imu_batch"
+#define IMU_BATCH_RING_SLOTS       (64)
+#define IMU_BATCH_MAX_SAMPLES      (32)
+#define IMU_BATCH_DEFAULT_SAMPLES  (8)
+#define IMU_BATCH_DEFAULT_MS       (2)
+
+// Every sample keeps its own time stamp, cpu_cycles_since_boot (32768 a
+// second) from the sensor board. received_ns is when the first one came
+// in (CLOCK_MONOTONIC), to line the board clock up with ours.
+typedef struct {
+  uint32_t count;
+  uint32_t reserved;
+  uint64_t received_ns;
+  imu_t    samples[IMU_BATCH_MAX_SAMPLES];
+} imu_batch;
+
+static inline uint32_t imu_batch_size(uint32_t count)
+{
+  return sizeof(imu_batch) - (IMU_BATCH_MAX_SAMPLES - count) * sizeof(imu_t);
+}
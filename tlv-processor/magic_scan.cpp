@@ -0,0 +1,162 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "magic_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define MAGIC_LEN        (8)
+#define MAGIC_FIRST_BYTE (0x02)
+#define MAGIC_LAST_BYTE  (0x07)
+
+// {2,1,4,3,6,5,8,7} read as a little endian uint64_t
+static const uint64_t magic_word = 0x0708050603040102ULL;
+static const uint8_t  magic_bytes[MAGIC_LEN] = {2,1,4,3,6,5,8,7};
+
+static inline bool is_magic_at(const uint8_t* buff) {
+  uint64_t candidate;
+  memcpy(&candidate, buff, sizeof(candidate));
+  return candidate == magic_word;
+}
+
+// Handles whatever the vector loops could not, including a magic word
+// that got cut off at the end of the buffer
+static size_t finish_scalar(const uint8_t* buff, size_t len, size_t i) {
+  while(i + MAGIC_LEN <= len) {
+    const uint8_t* first = static_cast<const uint8_t*>(memchr(buff + i, MAGIC_FIRST_BYTE, len - MAGIC_LEN + 1 - i));
+    if(!first) {
+      i = len - MAGIC_LEN + 1;
+      break;
+    }
+    i = first - buff;
+    if(is_magic_at(first)) {
+      return i;
+    }
+    i++;
+  }
+
+  // Fewer than 8 bytes left, look for a partial match
+  for(; i < len; i++) {
+    if(0 == memcmp(buff + i, magic_bytes, len - i)) {
+      return i;
+    }
+  }
+  return len;
+}
+
+size_t find_magic_scalar(const uint8_t* buff, size_t len) {
+  return finish_scalar(buff, len, 0);
+}
+
+// The vector versions compare 16/32 positions at once against the first
+// and the last byte of the magic word, only positions matching both get
+// a full 8 byte compare. Random noise almost never gets that far.
+#if defined(__x86_64__) || defined(__i386__)
+size_t find_magic_sse2(const uint8_t* buff, size_t len) {
+  const __m128i first_byte = _mm_set1_epi8(MAGIC_FIRST_BYTE);
+  const __m128i last_byte  = _mm_set1_epi8(MAGIC_LAST_BYTE);
+  size_t i = 0;
+
+  for(; i + 16 + MAGIC_LEN - 1 <= len; i += 16) {
+    __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buff + i));
+    __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buff + i + MAGIC_LEN - 1));
+    uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first_byte),
+                                                    _mm_cmpeq_epi8(tail, last_byte)));
+    while(mask) {
+      size_t bit = __builtin_ctz(mask);
+      if(is_magic_at(buff + i + bit)) {
+        return i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+  return finish_scalar(buff, len, i);
+}
+
+__attribute__((target("avx2")))
+size_t find_magic_avx2(const uint8_t* buff, size_t len) {
+  const __m256i first_byte = _mm256_set1_epi8(MAGIC_FIRST_BYTE);
+  const __m256i last_byte  = _mm256_set1_epi8(MAGIC_LAST_BYTE);
+  size_t i = 0;
+
+  for(; i + 32 + MAGIC_LEN - 1 <= len; i += 32) {
+    __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buff + i));
+    __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buff + i + MAGIC_LEN - 1));
+    uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(head, first_byte),
+                                                          _mm256_cmpeq_epi8(tail, last_byte)));
+    while(mask) {
+      size_t bit = __builtin_ctz(mask);
+      if(is_magic_at(buff + i + bit)) {
+        return i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+  return finish_scalar(buff, len, i);
+}
+
+bool find_magic_avx2_supported() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+#if defined(__ARM_NEON)
+size_t find_magic_neon(const uint8_t* buff, size_t len) {
+  const uint8x16_t first_byte = vdupq_n_u8(MAGIC_FIRST_BYTE);
+  const uint8x16_t last_byte  = vdupq_n_u8(MAGIC_LAST_BYTE);
+  size_t i = 0;
+
+  for(; i + 16 + MAGIC_LEN - 1 <= len; i += 16) {
+    uint8x16_t head = vld1q_u8(buff + i);
+    uint8x16_t tail = vld1q_u8(buff + i + MAGIC_LEN - 1);
+    uint8x16_t eq   = vandq_u8(vceqq_u8(head, first_byte), vceqq_u8(tail, last_byte));
+
+    // No movemask on NEON, narrow each byte down to a nibble instead
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+    while(mask) {
+      size_t nibble = __builtin_ctzll(mask) >> 2;
+      if(is_magic_at(buff + i + nibble)) {
+        return i + nibble;
+      }
+      mask &= ~(0xFULL << (nibble * 4));
+    }
+  }
+  return finish_scalar(buff, len, i);
+}
+#endif
+
+typedef size_t (*find_magic_fn)(const uint8_t*, size_t);
+
+static find_magic_fn pick_find_magic(const char** name) {
+#if defined(__x86_64__) || defined(__i386__)
+  if(find_magic_avx2_supported()) {
+    *name = "avx2";
+    return find_magic_avx2;
+  }
+  *name = "sse2";
+  return find_magic_sse2;
+#elif defined(__ARM_NEON)
+  *name = "neon";
+  return find_magic_neon;
+#else
+  *name = "scalar";
+  return find_magic_scalar;
+#endif
+}
+
+static const char*   find_magic_name;
+static find_magic_fn find_magic_impl = pick_find_magic(&find_magic_name);
+
+size_t find_magic(const uint8_t* buff, size_t len) {
+  return find_magic_impl(buff, len);
+}
+
+const char* find_magic_impl_name() {
+  return find_magic_name;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Searches buff for the 8 byte magic word {2,1,4,3,6,5,8,7} that starts
+// every radar/sensor board frame.
+//
+// Returns the offset of the first byte that can't be ruled out as the start
+// of a magic word:
+//   - if (ret + 8 <= len) a full magic word starts at buff[ret]
+//   - otherwise buff[ret..len) is a prefix of the magic word (or ret == len),
+//     the caller should keep those bytes around, the rest of the magic word
+//     might arrive with the next read()
+size_t find_magic(const uint8_t* buff, size_t len);
+
+// Name of the implementation find_magic() dispatches to
+const char* find_magic_impl_name();
+
+// Individual implementations, exposed for benchmarking
+size_t find_magic_scalar(const uint8_t* buff, size_t len);
+#if defined(__x86_64__) || defined(__i386__)
+size_t find_magic_sse2(const uint8_t* buff, size_t len);
+size_t find_magic_avx2(const uint8_t* buff, size_t len);
+bool   find_magic_avx2_supported();
+#endif
+#if defined(__ARM_NEON)
+size_t find_magic_neon(const uint8_t* buff, size_t len);
+#endif
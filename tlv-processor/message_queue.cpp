@@ -3,7 +3,13 @@
 
 using std::string;
 
-int mq_enqueue(string mq_path, uint8_t * buff, size_t size) {
+// Kept for existing callers, hot paths should hold on to a mq_publisher
+int mq_enqueue(const string& mq_path, uint8_t * buff, size_t size) {
   message_queue mq; 
   return mq.enqueue_message(mq_path, reinterpret_cast<char*>(buff), size);
 }
+
+bool mq_has_subscribers(const string& mq_path) {
+  message_queue mq;
+  return mq.has_subscribers(mq_path);
+}
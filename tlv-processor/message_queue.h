@@ -10,48 +10,205 @@
 #include <errno.h>
 #include <assert.h>
 #include <string.h>
+#include <time.h>
 
 #include <iostream>
 #include <cstdint>
 #include <string>
 #include <map>
 
+#include "shm_mailbox.h"
+#include "mq_registry.h"
+
+// Subscriber registry shared by every publisher in the process, nullptr
+// if it couldn't be mapped (then every topic counts as subscribed)
+inline mq_registry_header* mq_registry_instance() {
+  static mq_registry_header* registry = mq_registry_open();
+  return registry;
+}
+
+// Handle to a single topic: send() is a plain mq_send with no lookup or
+// allocation, and nothing at all while the topic has no subscribers (the
+// queue isn't even opened until the first one shows up). Move only,
+// closes the queue when it goes away.
+class mq_publisher {
+  private:
+    mqd_t mq{-1};
+    std::string path;
+    mq_topic topic{};
+    uint64_t last_error_ms{0};
+
+    void close() {
+      if(mq != -1) {
+        mq_close(mq);
+        mq = -1;
+      }
+    }
+
+    void open() {
+      struct mq_attr attr = {0};
+      attr.mq_maxmsg = MESSAGE_QUEUE_LEN;
+      attr.mq_msgsize = MESSAGE_QUEUE_SIZE;
+
+      mq = mq_open(path.c_str(), O_CREAT | O_WRONLY | O_NONBLOCK, 0600, &attr);
+      if(mq == -1) {
+        std::cout << "mq_open failed with error: " <<  strerror(errno) << std::endl;
+        assert(0);
+      }
+    }
+
+  public:
+    mq_publisher() = default;
+
+    explicit mq_publisher(const std::string& mq_path) : path(mq_path) {
+      topic = mq_topic_publish(mq_registry_instance(), path.c_str(), MQ_TOPIC_MQUEUE);
+    }
+
+    mq_publisher(mq_publisher&& other) noexcept : mq(other.mq), path(std::move(other.path)), topic(other.topic) {
+      other.mq = -1;
+    }
+
+    mq_publisher& operator=(mq_publisher&& other) noexcept {
+      if(this != &other) {
+        close();
+        mq    = other.mq;
+        path  = std::move(other.path);
+        topic = other.topic;
+        other.mq = -1;
+      }
+      return *this;
+    }
+
+    mq_publisher(const mq_publisher&) = delete;
+    mq_publisher& operator=(const mq_publisher&) = delete;
+
+    ~mq_publisher() {
+      close();
+    }
+
+    const std::string& get_path() const { return path; }
+
+    // True if anybody is subscribed, check before building a message that
+    // is expensive to put together. Counts the message as skipped if not.
+    bool wanted() {
+      return mq_topic_wanted(mq_registry_instance(), &topic);
+    }
+
+    // Returns 0 if the message was sent or nobody wanted it
+    int send(const void* buff, size_t len) {
+      assert(MESSAGE_QUEUE_SIZE > len);
+
+      if(!wanted()) {
+        return 0;
+      }
+      if(mq == -1) {
+        open();
+      }
+
+      int rc = mq_send(mq, static_cast<const char*>(buff), len, 0);
+      mq_topic_sent(&topic, 0 == rc);
+
+      // A subscriber that stopped reading fills the queue, complain once a
+      // second instead of for every message (mqstat has the drop count)
+      if(rc && mq_registry_now_ms() - last_error_ms >= MQ_SUBSCRIBER_RECHECK_MS) {
+        last_error_ms = mq_registry_now_ms();
+        std::cout << "mq_send to " << path << " failed: Errno " << strerror(errno) << std::endl;
+      }
+      return rc;
+    }
+
+    // Sends message as is, T has to be the wire format
+    template<typename T>
+    int publish(const T& message) {
+      return send(&message, sizeof(T));
+    }
+};
+
+// Writer side of a shm_mailbox (latest value channel, see shm_mailbox.h).
+// Same idea as mq_publisher, but a write always succeeds and replaces
+// whatever the readers haven't picked up yet.
+class mq_mailbox {
+  private:
+    shm_mailbox mailbox{};
+    mq_topic topic{};
+
+  public:
+    mq_mailbox() = default;
+
+    mq_mailbox(const std::string& path, uint32_t size) {
+      if(shm_mailbox_open(&mailbox, path.c_str(), size)) {
+        assert(0);
+      }
+      topic = mq_topic_publish(mq_registry_instance(), path.c_str(), MQ_TOPIC_MAILBOX);
+    }
+
+    mq_mailbox(mq_mailbox&& other) noexcept : mailbox(other.mailbox), topic(other.topic) {
+      other.mailbox.header = nullptr;
+    }
+
+    mq_mailbox& operator=(mq_mailbox&& other) noexcept {
+      if(this != &other) {
+        shm_mailbox_close(&mailbox);
+        mailbox = other.mailbox;
+        topic   = other.topic;
+        other.mailbox.header = nullptr;
+      }
+      return *this;
+    }
+
+    mq_mailbox(const mq_mailbox&) = delete;
+    mq_mailbox& operator=(const mq_mailbox&) = delete;
+
+    ~mq_mailbox() {
+      shm_mailbox_close(&mailbox);
+    }
+
+    bool wanted() {
+      return mq_topic_wanted(mq_registry_instance(), &topic);
+    }
+
+    void send(const void* buff, size_t len) {
+      assert(mailbox.header->size >= len);
+      if(wanted()) {
+        shm_mailbox_write(&mailbox, buff, len);
+        mq_topic_sent(&topic, 1);
+      }
+    }
+
+    template<typename T>
+    void publish(const T& message) {
+      send(&message, sizeof(T));
+    }
+};
+
+// Publishers by path, for callers that don't keep a mq_publisher around
 class message_queue {
   private:
-    static inline std::map<std::string, mqd_t> mq_store;
+    static inline std::map<std::string, mq_publisher, std::less<>> mq_store;
 
   public:
     message_queue() = default;
     message_queue (const message_queue&) = delete;
     message_queue& operator= (const message_queue&) = delete;
 
-    int enqueue_message(std::string mq_path, char* buff, size_t len) {
-      assert(MESSAGE_QUEUE_SIZE > len);
-      mqd_t mq;
-
-      if(0 == message_queue::mq_store.count(mq_path)) {
-        struct mq_attr attr = {0};
-        attr.mq_maxmsg = MESSAGE_QUEUE_LEN;
-        attr.mq_msgsize = MESSAGE_QUEUE_SIZE;
-
-        mq = mq_open (mq_path.c_str(), O_CREAT | O_WRONLY | O_NONBLOCK, 0600, &attr);
-        if(mq == -1) {
-          std::cout << "mq_open failed with error: " <<  strerror(errno) << std::endl;
-          assert(0);
-        }
-        mq_store.insert({mq_path, mq});
-      } else {
-        mq = mq_store[mq_path];
-      }
-       
-      int rc = mq_send(mq, buff, len, 0);
-      if(rc) {
-        std::cout << "mq_send len: " << len << std::endl;
-        std::cout << "mq_send failed: Errno" << strerror(errno)  << std::endl;
+    // See mq_publisher::wanted()
+    bool has_subscribers(const std::string& mq_path) {
+      return publisher(mq_path).wanted();
+    }
+
+    mq_publisher& publisher(const std::string& mq_path) {
+      auto iter = mq_store.find(mq_path);
+      if(iter == mq_store.end()) {
+        iter = mq_store.emplace(mq_path, mq_publisher(mq_path)).first;
       }
-      return rc;
+      return iter->second;
+    }
+
+    int enqueue_message(const std::string& mq_path, const char* buff, size_t len) {
+      return publisher(mq_path).send(buff, len);
     }
 };
 
-int mq_enqueue(std::string, uint8_t*, size_t);
+int  mq_enqueue(const std::string&, uint8_t*, size_t);
+bool mq_has_subscribers(const std::string&);
 #endif
@@ -0,0 +1,282 @@
+#pragma once
+
+// Process wide table of IPC topics in POSIX shared memory: who publishes
+// each topic, which processes are subscribed to it and how many messages
+// were published, dropped (channel full) or skipped (nobody subscribed).
+//
+// Consumers subscribe when they open a topic, publishers check
+// mq_topic_wanted() before building a message and skip the work (and the
+// send) entirely for topics nobody reads. Subscribers that died without
+// unsubscribing are pruned by pid. mqstat prints the table.
+//
+// Plain C so both sides can use it, scope-deepstream (C) and
+// tlv-processor (C++)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "shm_region.h"
+
+#define MQ_REGISTRY_PATH        "/shm_mq_registry"
+#define MQ_REGISTRY_MAGIC       (0x4D515247) // "MQRG"
+#define MQ_REGISTRY_VERSION     (1)
+#define MQ_REGISTRY_TOPICS      (32)
+#define MQ_REGISTRY_SUBSCRIBERS (8)
+#define MQ_REGISTRY_NAME_LEN    (48)
+
+// How often a publisher looks for subscribers that went away
+#define MQ_SUBSCRIBER_RECHECK_MS (1000)
+
+typedef enum {
+  MQ_TOPIC_MQUEUE  = 1,
+  MQ_TOPIC_MAILBOX = 2,
+  MQ_TOPIC_RING    = 3,
+} mq_topic_kind;
+
+// One topic, own cache line(s) so publishers of different topics don't
+// share. subscribers mirrors the non zero entries of subscriber_pids, it
+// is all a publisher looks at on the hot path.
+typedef struct {
+  char     name[MQ_REGISTRY_NAME_LEN];  // empty: free entry
+  uint32_t kind;
+  int32_t  publisher_pid;
+  uint32_t subscribers;
+  int32_t  subscriber_pids[MQ_REGISTRY_SUBSCRIBERS];
+  uint64_t published;
+  uint64_t dropped;
+  uint64_t skipped;
+} __attribute__((aligned(64))) mq_topic_entry;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t topic_count;
+  int32_t  lock;                         // pid of the holder, 0 when free
+  mq_topic_entry topics[MQ_REGISTRY_TOPICS];
+} mq_registry_header;
+
+// Per process handle to one topic. A NULL entry (registry full or not
+// available) behaves like a topic that always has subscribers.
+typedef struct {
+  mq_topic_entry* entry;
+  uint64_t        last_prune_ms;
+} mq_topic;
+
+static inline uint64_t mq_registry_now_ms(void) {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &tp);
+  return tp.tv_sec * 1000ULL + tp.tv_nsec / 1000000;
+}
+
+static inline int mq_registry_pid_alive(int32_t pid) {
+  return 0 == kill(pid, 0) || EPERM == errno;
+}
+
+// Maps the registry, creating it on first use. NULL (after printing why)
+// if it can't be had, callers carry on without subscriber tracking.
+static inline mq_registry_header* mq_registry_open(void) {
+  int created;
+  mq_registry_header* registry = (mq_registry_header*)shm_region_open(MQ_REGISTRY_PATH, sizeof(mq_registry_header), &created);
+  if(!registry) {
+    return NULL;
+  }
+
+  if(created) {
+    registry->version     = MQ_REGISTRY_VERSION;
+    registry->topic_count = MQ_REGISTRY_TOPICS;
+    shm_region_publish(&registry->magic, MQ_REGISTRY_MAGIC);
+    return registry;
+  }
+
+  if(shm_region_wait(MQ_REGISTRY_PATH, &registry->magic, MQ_REGISTRY_MAGIC) ||
+     MQ_REGISTRY_VERSION != registry->version || MQ_REGISTRY_TOPICS != registry->topic_count) {
+    printf("mq registry has a different version or size, remove /dev/shm%s\n", MQ_REGISTRY_PATH);
+    munmap(registry, sizeof(mq_registry_header));
+    return NULL;
+  }
+  return registry;
+}
+
+// Only taken to add topics and (un)subscribe, never on the publish path.
+// A holder that died is detected by pid and the lock taken over.
+static inline void mq_registry_lock(mq_registry_header* registry) {
+  int32_t self = getpid();
+  while(1) {
+    int32_t holder = 0;
+    if(__atomic_compare_exchange_n(&registry->lock, &holder, self, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      return;
+    }
+    if(!mq_registry_pid_alive(holder) &&
+       __atomic_compare_exchange_n(&registry->lock, &holder, self, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      return;
+    }
+    sched_yield();
+  }
+}
+
+static inline void mq_registry_unlock(mq_registry_header* registry) {
+  __atomic_store_n(&registry->lock, 0, __ATOMIC_RELEASE);
+}
+
+// Registry lock held
+static inline void mq_registry_prune_locked(mq_topic_entry* entry) {
+  uint32_t alive = 0;
+  for(int i = 0; i < MQ_REGISTRY_SUBSCRIBERS; i++) {
+    int32_t pid = entry->subscriber_pids[i];
+    if(pid && !mq_registry_pid_alive(pid)) {
+      entry->subscriber_pids[i] = 0;
+    } else if(pid) {
+      alive++;
+    }
+  }
+  __atomic_store_n(&entry->subscribers, alive, __ATOMIC_RELEASE);
+}
+
+// Registry lock held. Nobody publishes or subscribes to it anymore.
+static inline int mq_registry_stale_locked(mq_topic_entry* entry) {
+  mq_registry_prune_locked(entry);
+  return 0 == entry->subscribers && (0 == entry->publisher_pid || !mq_registry_pid_alive(entry->publisher_pid));
+}
+
+// Registry lock held. Finds the topic, adding it if it isn't there yet (in
+// a free entry or one left behind by processes that are gone). NULL if the
+// table is full.
+static inline mq_topic_entry* mq_registry_find_locked(mq_registry_header* registry, const char* name, mq_topic_kind kind) {
+  mq_topic_entry* found = NULL;
+
+  for(int i = 0; i < MQ_REGISTRY_TOPICS && !found; i++) {
+    if(0 == strncmp(registry->topics[i].name, name, MQ_REGISTRY_NAME_LEN)) {
+      found = &registry->topics[i];
+    }
+  }
+  for(int i = 0; i < MQ_REGISTRY_TOPICS && !found; i++) {
+    if(0 == registry->topics[i].name[0]) {
+      found = &registry->topics[i];
+    }
+  }
+  for(int i = 0; i < MQ_REGISTRY_TOPICS && !found; i++) {
+    if(mq_registry_stale_locked(&registry->topics[i])) {
+      found = &registry->topics[i];
+    }
+  }
+  if(found && 0 != strncmp(found->name, name, MQ_REGISTRY_NAME_LEN)) {
+    memset(found, 0, sizeof(*found));
+    strncpy(found->name, name, MQ_REGISTRY_NAME_LEN - 1);
+  }
+  if(found) {
+    found->kind = kind;
+  } else {
+    printf("mq registry is full, %s is not tracked\n", name);
+  }
+  return found;
+}
+
+// Publisher side, marks this process as the topic's publisher
+static inline mq_topic mq_topic_publish(mq_registry_header* registry, const char* name, mq_topic_kind kind) {
+  mq_topic topic = { NULL, 0 };
+  if(!registry) {
+    return topic;
+  }
+
+  mq_registry_lock(registry);
+  topic.entry = mq_registry_find_locked(registry, name, kind);
+  if(topic.entry) {
+    topic.entry->publisher_pid = getpid();
+  }
+  mq_registry_unlock(registry);
+  return topic;
+}
+
+// Subscriber side, stays subscribed until mq_topic_unsubscribe() or the
+// process exits
+static inline mq_topic mq_topic_subscribe(mq_registry_header* registry, const char* name, mq_topic_kind kind) {
+  mq_topic topic = { NULL, 0 };
+  if(!registry) {
+    return topic;
+  }
+
+  mq_registry_lock(registry);
+  topic.entry = mq_registry_find_locked(registry, name, kind);
+  if(!topic.entry) {
+    mq_registry_unlock(registry);
+    return topic;
+  }
+
+  // Dead subscribers free up their slot
+  mq_registry_prune_locked(topic.entry);
+  int slot = -1;
+  for(int i = 0; i < MQ_REGISTRY_SUBSCRIBERS && slot < 0; i++) {
+    if(0 == topic.entry->subscriber_pids[i]) {
+      slot = i;
+    }
+  }
+  if(slot < 0) {
+    printf("%s has too many subscribers, not tracked\n", name);
+  } else {
+    topic.entry->subscriber_pids[slot] = getpid();
+  }
+  mq_registry_prune_locked(topic.entry);
+  mq_registry_unlock(registry);
+  return topic;
+}
+
+static inline void mq_topic_unsubscribe(mq_registry_header* registry, mq_topic* topic) {
+  if(!registry || !topic->entry) {
+    return;
+  }
+
+  int32_t self = getpid();
+  mq_registry_lock(registry);
+  for(int i = 0; i < MQ_REGISTRY_SUBSCRIBERS; i++) {
+    if(self == topic->entry->subscriber_pids[i]) {
+      topic->entry->subscriber_pids[i] = 0;
+      break;
+    }
+  }
+  mq_registry_prune_locked(topic->entry);
+  mq_registry_unlock(registry);
+  topic->entry = NULL;
+}
+
+// Publisher hot path: a shared memory load, plus a check for dead
+// subscribers every MQ_SUBSCRIBER_RECHECK_MS while there are any. A
+// message that isn't wanted is counted as skipped.
+static inline int mq_topic_wanted(mq_registry_header* registry, mq_topic* topic) {
+  mq_topic_entry* entry = topic->entry;
+  if(!entry) {
+    return 1;
+  }
+
+  if(__atomic_load_n(&entry->subscribers, __ATOMIC_ACQUIRE)) {
+    uint64_t now = mq_registry_now_ms();
+    if(now - topic->last_prune_ms < MQ_SUBSCRIBER_RECHECK_MS) {
+      return 1;
+    }
+    topic->last_prune_ms = now;
+
+    mq_registry_lock(registry);
+    mq_registry_prune_locked(entry);
+    mq_registry_unlock(registry);
+    if(__atomic_load_n(&entry->subscribers, __ATOMIC_ACQUIRE)) {
+      return 1;
+    }
+  }
+
+  __atomic_fetch_add(&entry->skipped, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+// Publisher: outcome of a message that was wanted
+static inline void mq_topic_sent(mq_topic* topic, int delivered) {
+  if(topic->entry) {
+    __atomic_fetch_add(delivered ? &topic->entry->published : &topic->entry->dropped, 1, __ATOMIC_RELAXED);
+  }
+}
@@ -0,0 +1,130 @@
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "mq_registry.h"
+
+// Lists every IPC topic in the registry (see mq_registry.h) with its
+// publisher, live subscribers and message rates over an interval:
+//
+//   $ ./mqstat
+//   topic                  kind        pub subs  subscriber pids     pub/s   skip/s   drop/s   published     skipped     dropped
+//   /mq_imu_tracking       mqueue      812    0  -                     0.0    800.0      0.0           0       96000           0
+//   /shm_imu_display       mailbox     812    1  815                 800.0      0.0      0.0       96000           0           0
+//
+// A publisher pid followed by ? has exited.
+
+using std::string;
+using std::vector;
+
+static void usage() {
+  puts("usage: mqstat [-i interval_ms] [-w]");
+  puts("  -i N  measure rates over N ms (default 1000)");
+  puts("  -w    keep printing every interval");
+  exit(1);
+}
+
+static const char* kind_name(uint32_t kind) {
+  switch(kind) {
+    case MQ_TOPIC_MQUEUE:  return "mqueue";
+    case MQ_TOPIC_MAILBOX: return "mailbox";
+    case MQ_TOPIC_RING:    return "ring";
+  }
+  return "?";
+}
+
+// Copy of the table with dead subscribers pruned, so the counters of a
+// topic are read at (about) the same time
+static vector<mq_topic_entry> snapshot(mq_registry_header* registry) {
+  vector<mq_topic_entry> topics;
+
+  mq_registry_lock(registry);
+  for(int i = 0; i < MQ_REGISTRY_TOPICS; i++) {
+    mq_topic_entry* entry = &registry->topics[i];
+    if(entry->name[0]) {
+      mq_registry_prune_locked(entry);
+      topics.push_back(*entry);
+    }
+  }
+  mq_registry_unlock(registry);
+  return topics;
+}
+
+static double per_second(uint64_t now, uint64_t before, int interval_ms) {
+  return (now - before) * 1000.0 / interval_ms;
+}
+
+static void print_topics(const vector<mq_topic_entry>& before, const vector<mq_topic_entry>& now, int interval_ms) {
+  printf("%-22s %-8s %6s %4s  %-16s %8s %8s %8s %11s %11s %11s\n", "topic", "kind", "pub", "subs", "subscriber pids",
+         "pub/s", "skip/s", "drop/s", "published", "skipped", "dropped");
+
+  for(const mq_topic_entry& topic : now) {
+    // A topic that showed up during the interval counts from zero
+    mq_topic_entry start = {};
+    for(const mq_topic_entry& old : before) {
+      if(0 == strncmp(old.name, topic.name, MQ_REGISTRY_NAME_LEN)) {
+        start = old;
+      }
+    }
+
+    string pids;
+    for(int i = 0; i < MQ_REGISTRY_SUBSCRIBERS; i++) {
+      if(topic.subscriber_pids[i]) {
+        pids += (pids.empty() ? "" : ",") + std::to_string(topic.subscriber_pids[i]);
+      }
+    }
+
+    string publisher = "-";
+    if(topic.publisher_pid) {
+      publisher = std::to_string(topic.publisher_pid) + (mq_registry_pid_alive(topic.publisher_pid) ? "" : "?");
+    }
+
+    printf("%-22s %-8s %6s %4u  %-16s %8.1f %8.1f %8.1f %11llu %11llu %11llu\n", topic.name, kind_name(topic.kind),
+           publisher.c_str(), topic.subscribers, pids.empty() ? "-" : pids.c_str(),
+           per_second(topic.published, start.published, interval_ms),
+           per_second(topic.skipped, start.skipped, interval_ms),
+           per_second(topic.dropped, start.dropped, interval_ms),
+           (unsigned long long)topic.published, (unsigned long long)topic.skipped, (unsigned long long)topic.dropped);
+  }
+}
+
+int main(int argc, char** argv) {
+  int interval_ms = 1000;
+  bool watch = false;
+
+  int opt;
+  while((opt = getopt(argc, argv, "i:w")) != -1) {
+    switch(opt) {
+      case 'i': interval_ms = atoi(optarg); break;
+      case 'w': watch = true; break;
+      default:  usage();
+    }
+  }
+  if(interval_ms <= 0) {
+    usage();
+  }
+
+  mq_registry_header* registry = mq_registry_open();
+  if(!registry) {
+    return 1;
+  }
+
+  vector<mq_topic_entry> before = snapshot(registry);
+  do {
+    struct timespec interval = { interval_ms / 1000, (interval_ms % 1000) * 1000000L };
+    while(EINTR == clock_nanosleep(CLOCK_MONOTONIC, 0, &interval, &interval));
+
+    vector<mq_topic_entry> now = snapshot(registry);
+    print_topics(before, now, interval_ms);
+    before = now;
+    if(watch) {
+      puts("");
+    }
+  } while(watch);
+}
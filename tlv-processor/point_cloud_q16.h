@@ -0,0 +1,207 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "radar_tlv.h"
+#include "capture.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Codec for PointCloudWireQ16 (see radar_tlv.h), shared by the radar
+// program (encodes into the ring slot) and smartscope (decodes, and
+// encodes for recordings). C and C++, header only like the shm_* headers.
+//
+// A DPIF_PointCloudSpherical is 4 floats, one vector register: encoding
+// is a multiply, a round and a saturating narrow to int16, decoding a
+// widen, a convert and a multiply. SSE2 on x86, NEON on the Jetson, plain
+// C anywhere else.
+//
+// Recordings (smartscope -q) use the capture.h framing with
+// CLOUD_RECORDING_MAGIC, one record per cloud, each a PointCloudWireQ16.
+
+#define POINT_CLOUD_Q16_MAX        (32767.0f)
+#define CLOUD_RECORDING_MAGIC      "SSCLOUD"
+#define CLOUD_RECORDING_VERSION    (1)
+
+POINT_CLOUD_WIRE_ASSERT(sizeof(DPIF_PointCloudSpherical) == 4 * sizeof(float), "codec works on 4 floats a point");
+
+static inline int16_t* point_cloud_q16_points(const PointCloudWireQ16* cloud)
+{
+  return (int16_t*)(cloud + 1);
+}
+
+static inline DPIF_PointCloudSideInfo* point_cloud_q16_side_info(const PointCloudWireQ16* cloud)
+{
+  return (DPIF_PointCloudSideInfo*)(point_cloud_q16_points(cloud) + 4 * cloud->meta_data.points);
+}
+
+// Largest magnitude of every field over the cloud, NaNs are skipped
+static inline void point_cloud_q16_max_abs(const DPIF_PointCloudSpherical* points, uint32_t count, float max_abs[4])
+{
+  const float* in = (const float*)points;
+  uint32_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+  // Two accumulators, one alone is bound by the latency of maxps
+  __m128 acc  = _mm_setzero_ps();
+  __m128 acc2 = _mm_setzero_ps();
+  for(; i + 2 <= count; i += 2) {
+    // maxps returns its second operand if either one is a NaN
+    acc  = _mm_max_ps(_mm_and_ps(_mm_loadu_ps(in + 4 * i), abs_mask), acc);
+    acc2 = _mm_max_ps(_mm_and_ps(_mm_loadu_ps(in + 4 * i + 4), abs_mask), acc2);
+  }
+  if(i < count) {
+    acc = _mm_max_ps(_mm_and_ps(_mm_loadu_ps(in + 4 * i), abs_mask), acc);
+  }
+  _mm_storeu_ps(max_abs, _mm_max_ps(acc, acc2));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  float32x4_t acc  = vdupq_n_f32(0);
+  float32x4_t acc2 = vdupq_n_f32(0);
+  for(; i + 2 <= count; i += 2) {
+    acc  = vmaxnmq_f32(acc, vabsq_f32(vld1q_f32(in + 4 * i)));
+    acc2 = vmaxnmq_f32(acc2, vabsq_f32(vld1q_f32(in + 4 * i + 4)));
+  }
+  if(i < count) {
+    acc = vmaxnmq_f32(acc, vabsq_f32(vld1q_f32(in + 4 * i)));
+  }
+  vst1q_f32(max_abs, vmaxnmq_f32(acc, acc2));
+#else
+  memset(max_abs, 0, 4 * sizeof(float));
+  for(; i < count; i++) {
+    for(int k = 0; k < 4; k++) {
+      float v = fabsf(in[4 * i + k]);
+      if(v > max_abs[k]) {
+        max_abs[k] = v;
+      }
+    }
+  }
+#endif
+}
+
+// Quantizes count points with the given scales into out (4 int16 a point)
+static inline void point_cloud_q16_encode_points(const DPIF_PointCloudSpherical* points, uint32_t count,
+                                                 const float scale[4], int16_t* out)
+{
+  const float* in = (const float*)points;
+  float inv[4];
+  for(int k = 0; k < 4; k++) {
+    inv[k] = 1.0f / scale[k];
+  }
+  uint32_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128 inv_v = _mm_loadu_ps(inv);
+  // Two points at a time, packs saturates to int16
+  for(; i + 2 <= count; i += 2) {
+    __m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + 4 * i), inv_v));
+    __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + 4 * i + 4), inv_v));
+    _mm_storeu_si128((__m128i*)(out + 4 * i), _mm_packs_epi32(a, b));
+  }
+  if(i < count) {
+    __m128i a = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + 4 * i), inv_v));
+    _mm_storel_epi64((__m128i*)(out + 4 * i), _mm_packs_epi32(a, a));
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const float32x4_t inv_v = vld1q_f32(inv);
+  for(; i < count; i++) {
+    int32x4_t q = vcvtnq_s32_f32(vmulq_f32(vld1q_f32(in + 4 * i), inv_v));
+    vst1_s16(out + 4 * i, vqmovn_s32(q));
+  }
+#else
+  for(; i < count; i++) {
+    for(int k = 0; k < 4; k++) {
+      float q = rintf(in[4 * i + k] * inv[k]);
+      q = q > POINT_CLOUD_Q16_MAX ? POINT_CLOUD_Q16_MAX : q;
+      q = q < -POINT_CLOUD_Q16_MAX - 1 ? -POINT_CLOUD_Q16_MAX - 1 : q;
+      out[4 * i + k] = (int16_t)q;
+    }
+  }
+#endif
+}
+
+static inline void point_cloud_q16_decode_points(const int16_t* in, uint32_t count, const float scale[4],
+                                                 DPIF_PointCloudSpherical* points)
+{
+  float* out = (float*)points;
+  uint32_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128 scale_v = _mm_loadu_ps(scale);
+  // Two points at a time, unpacking a register with itself and shifting
+  // back down sign extends (SSE2 has no pmovsxwd)
+  for(; i + 2 <= count; i += 2) {
+    __m128i q  = _mm_loadu_si128((const __m128i*)(in + 4 * i));
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(q, q), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(q, q), 16);
+    _mm_storeu_ps(out + 4 * i,     _mm_mul_ps(_mm_cvtepi32_ps(lo), scale_v));
+    _mm_storeu_ps(out + 4 * i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale_v));
+  }
+  if(i < count) {
+    __m128i q  = _mm_loadl_epi64((const __m128i*)(in + 4 * i));
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(q, q), 16);
+    _mm_storeu_ps(out + 4 * i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale_v));
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const float32x4_t scale_v = vld1q_f32(scale);
+  for(; i < count; i++) {
+    int32x4_t q = vmovl_s16(vld1_s16(in + 4 * i));
+    vst1q_f32(out + 4 * i, vmulq_f32(vcvtq_f32_s32(q), scale_v));
+  }
+#else
+  for(; i < count; i++) {
+    for(int k = 0; k < 4; k++) {
+      out[4 * i + k] = in[4 * i + k] * scale[k];
+    }
+  }
+#endif
+}
+
+// Picks the scales and quantizes the points of a cloud, set
+// cloud->meta_data.points first. Side info is left to the caller.
+static inline void point_cloud_q16_encode(const DPIF_PointCloudSpherical* points, PointCloudWireQ16* cloud)
+{
+  float max_abs[4];
+  point_cloud_q16_max_abs(points, cloud->meta_data.points, max_abs);
+
+  // A field that is 0 all over (velocity with a static scene) still needs
+  // a usable scale
+  for(int k = 0; k < 4; k++) {
+    cloud->scale[k] = (max_abs[k] > 0 && isfinite(max_abs[k])) ? max_abs[k] / POINT_CLOUD_Q16_MAX : 1.0f;
+  }
+  point_cloud_q16_encode_points(points, cloud->meta_data.points, cloud->scale, point_cloud_q16_points(cloud));
+}
+
+// Version 2 -> 3, out needs room for point_cloud_q16_size(points) bytes.
+// Returns the size of the quantized cloud.
+static inline uint32_t point_cloud_q16_from_wire(const PointCloudWire* cloud, PointCloudWireQ16* out)
+{
+  uint32_t points = cloud->meta_data.points;
+
+  memset(out, 0, sizeof(PointCloudWireQ16));
+  out->meta_data = cloud->meta_data;
+  out->version   = POINT_CLOUD_WIRE_Q16_VERSION;
+  point_cloud_q16_encode(point_cloud_wire_points(cloud), out);
+  memcpy(point_cloud_q16_side_info(out), point_cloud_wire_side_info(cloud), points * sizeof(DPIF_PointCloudSideInfo));
+  return point_cloud_q16_size(points);
+}
+
+// Version 3 -> 2, out needs room for point_cloud_wire_size(points) bytes.
+// Returns the size of the decoded cloud.
+static inline uint32_t point_cloud_q16_to_wire(const PointCloudWireQ16* cloud, PointCloudWire* out)
+{
+  uint32_t points = cloud->meta_data.points;
+
+  memset(out, 0, sizeof(PointCloudWire));
+  out->meta_data = cloud->meta_data;
+  out->version   = POINT_CLOUD_WIRE_VERSION;
+  point_cloud_q16_decode_points(point_cloud_q16_points(cloud), points, cloud->scale, point_cloud_wire_points(out));
+  memcpy(point_cloud_wire_side_info(out), point_cloud_q16_side_info(cloud), points * sizeof(DPIF_PointCloudSideInfo));
+  return point_cloud_wire_size(points);
+}
@@ -0,0 +1,91 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+
+#include <string>
+#include <atomic>
+#include <cassert>
+
+#include "pty.h"
+
+using std::string;
+
+int open_pty(string& slave_path) {
+  int master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if(-1 == master_fd || grantpt(master_fd) || unlockpt(master_fd)) {
+    printf("Failed to open pty with errno: %s\n", strerror(errno));
+    assert(0);
+  }
+  slave_path = ptsname(master_fd);
+
+  // Raw until the program under test sets up its own line discipline,
+  // otherwise canonical mode would mangle the first bytes we write
+  struct termios tty;
+  tcgetattr(master_fd, &tty);
+  cfmakeraw(&tty);
+  tcsetattr(master_fd, TCSANOW, &tty);
+
+  return master_fd;
+}
+
+int watch_pty_open(const string& slave_path) {
+  int fd = inotify_init1(IN_CLOEXEC);
+  if(-1 == fd || -1 == inotify_add_watch(fd, slave_path.c_str(), IN_OPEN)) {
+    printf("Failed to watch %s with errno: %s\n", slave_path.c_str(), strerror(errno));
+    assert(0);
+  }
+  return fd;
+}
+
+void wait_for_pty_open(int fd, const string& slave_path) {
+  char event_buff[sizeof(struct inotify_event) + 256];
+  if(read(fd, event_buff, sizeof(event_buff)) <= 0) {
+    printf("Failed waiting on %s with errno: %s\n", slave_path.c_str(), strerror(errno));
+    assert(0);
+  }
+  close(fd);
+}
+
+void serve_fake_cli(int master_fd, std::atomic<bool>* sensor_started) {
+  char cli_buff[256];
+  string line;
+  const char done[] = "\nDone\nmmwDemo:/>";
+
+  while(true) {
+    int rc = read(master_fd, cli_buff, sizeof(cli_buff));
+    if(rc <= 0) {
+      return;
+    }
+    // The radar program terminates every command with '\r'
+    for(int i = 0; i < rc; i++) {
+      if('\r' != cli_buff[i]) {
+        line += cli_buff[i];
+        continue;
+      }
+      if(0 == line.compare(0, strlen("sensorStart"), "sensorStart")) {
+        *sensor_started = true;
+      }
+      line.clear();
+      write(master_fd, done, sizeof(done) - 1);
+    }
+  }
+}
+
+void pty_write_all(int fd, const uint8_t* buff, size_t len) {
+  while(len) {
+    int rc = write(fd, buff, len);
+    if(rc < 0) {
+      if(EINTR == errno) {
+        continue;
+      }
+      printf("Failed to write to pty with errno: %s\n", strerror(errno));
+      exit(1);
+    }
+    buff += rc;
+    len  -= rc;
+  }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <atomic>
+
+// Helpers for the replay and generator tools, these pretend to be a radar
+// or sensor board by writing into the master side of a pseudo-terminal.
+// The programs under test open the slave side like any other tty.
+
+// Opens a raw pty pair, returns the master fd and fills in slave_path
+int  open_pty(std::string& slave_path);
+
+// Starts watching slave_path for opens, returns the fd to wait on. Call
+// it before telling anyone the path, or an early open is missed.
+int  watch_pty_open(const std::string& slave_path);
+
+// Blocks until somebody other than us opens the path watch_fd watches
+// (see watch_pty_open), closes watch_fd
+void wait_for_pty_open(int watch_fd, const std::string& slave_path);
+
+// Emulates the mmWave demo CLI on a pty: every command line gets
+// answered with "Done", runs until the pty is closed. sensor_started
+// is set once the radar program sends sensorStart.
+void serve_fake_cli(int master_fd, std::atomic<bool>* sensor_started);
+
+// write() that doesn't give up on short writes
+void pty_write_all(int fd, const uint8_t* buff, size_t len);
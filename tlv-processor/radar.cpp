@@ -15,6 +15,10 @@
 #include "tty.h"
 #include "radar_tlv.h"
 #include "message_queue.h"
+#include "tlv_processor.h"
+#include "tlv_walker.h"
+#include "shm_ring.h"
+#include "point_cloud_q16.h"
 
 using std::make_tuple;
 using std::string;
@@ -25,22 +29,74 @@ using std::fstream;
 using std::regex;
 using std::regex_search;
 using std::tuple;
+using std::unique_ptr;
 
-static PointCloudSpherical radar_point_cloud;
+static shm_ring radar_ring;
+static mq_topic radar_topic;
 
-tty_handler setup_radar() {
+// Set in process mode, clouds go straight to it instead of the ring
+static radar_cloud_sink cloud_sink;
+
+// RADAR_WIRE_Q16=1 puts quantized clouds (PointCloudWireQ16) on the ring
+static bool wire_q16;
+
+// Cloud of the frame being parsed, the TLV handlers write straight into
+// a claimed ring slot. If the ring is full, or nobody is subscribed, the
+// frame is parsed into scratch_cloud and dropped. A PointCloudWireQ16 when
+// cloud_q16 is set, the headers match up to the version.
+static PointCloudWire* radar_point_cloud;
+static bool cloud_wanted;
+static bool cloud_in_ring;
+static bool cloud_q16;
+alignas(PointCloudWire) static uint8_t scratch_cloud[RADAR_RING_SLOT_SIZE];
+
+static_assert(RADAR_RING_MAX_POINTS * (sizeof(DPIF_PointCloudSpherical) + sizeof(DPIF_PointCloudSideInfo)) >= MAX_TLV_SIZE,
+              "a data port frame can hold more points than a ring slot");
+
+static void claim_cloud() {
+  if(cloud_sink) {
+    cloud_wanted      = true;
+    cloud_in_ring     = false;
+    cloud_q16         = false;
+    radar_point_cloud = reinterpret_cast<PointCloudWire*>(scratch_cloud);
+    radar_point_cloud->meta_data.points = 0;
+    radar_point_cloud->version          = POINT_CLOUD_WIRE_VERSION;
+    return;
+  }
+
+  if(nullptr == radar_ring.header) {
+    if(shm_ring_open(&radar_ring, RADAR_RING_PATH, RADAR_RING_SLOTS, RADAR_RING_SLOT_SIZE)) {
+      assert(0);
+    }
+    radar_topic = mq_topic_publish(mq_registry_instance(), RADAR_RING_PATH, MQ_TOPIC_RING);
+  }
+
+  cloud_wanted = mq_topic_wanted(mq_registry_instance(), &radar_topic);
+  void* slot   = cloud_wanted ? shm_ring_claim(&radar_ring) : nullptr;
+  cloud_in_ring     = (nullptr != slot);
+  cloud_q16         = wire_q16;
+  radar_point_cloud = reinterpret_cast<PointCloudWire*>(cloud_in_ring ? slot : scratch_cloud);
+  radar_point_cloud->meta_data.points = 0;
+  radar_point_cloud->version          = cloud_q16 ? POINT_CLOUD_WIRE_Q16_VERSION : POINT_CLOUD_WIRE_VERSION;
+}
+
+void set_radar_cloud_sink(radar_cloud_sink sink) {
+  cloud_sink = sink;
+}
+
+unique_ptr<tty_handler> setup_radar() {
   vector<tuple<string, string, speed_t, string, int>> radar_ports;
 
   // Control Plane
-  radar_ports.push_back(make_tuple("/dev/ttyUSB0",
+  radar_ports.push_back(make_tuple(env_or_default("RADAR_CFG_PORT", "/dev/ttyUSB0"),
     "canonical", 
     B115200,
-    "./configs/68xx_traffic_monitoring_70m_MIMO_2D.cfg",
+    env_or_default("RADAR_CFG_FILE", "./configs/68xx_traffic_monitoring_70m_MIMO_2D.cfg"),
     IS_CFG_PORT)
   );
 
   // Radar data plane
-  radar_ports.push_back(make_tuple("/dev/ttyUSB1",
+  radar_ports.push_back(make_tuple(env_or_default("RADAR_DATA_PORT", "/dev/ttyUSB1"),
     "not_canonical",
     B921600, 
     "",
@@ -48,112 +104,161 @@ tty_handler setup_radar() {
   );
 
   // Either opens radar successfully or asserts
-  tty_handler radar(radar_ports);
+  unique_ptr<tty_handler> radar(new tty_handler(radar_ports));
 
+  // RADAR_STALL_FRAMES=<n> frame periods without a frame before recovering
+  string stall_frames = env_or_default("RADAR_STALL_FRAMES", "");
+  if(stall_frames != "") {
+    radar->set_stall_missed_frames(std::stoi(stall_frames));
+  }
+
+  // RADAR_CAPTURE=<file> records the raw data port, see the replay tool
+  string capture = env_or_default("RADAR_CAPTURE", "");
+  if(capture != "") {
+    radar->enable_capture(capture, CAPTURE_SOURCE_RADAR);
+  }
+
+  // RADAR_WIRE_Q16=1 quantizes clouds on the ring, never in process mode
+  // where the cloud is not copied anyway
+  wire_q16 = (env_or_default("RADAR_WIRE_Q16", "") == "1");
+  if(wire_q16) {
+    puts("Sending quantized point clouds");
+  }
   return radar;
 }
 
+// Per frame state filled in by the TLV handlers
+static int points_in_tlv;
+static int points_in_side_info;
+
+static void on_spherical_points(const MmwDemo_output_message_header&, tlv_payload<DPIF_PointCloudSpherical> cloud) {
+  points_in_tlv = cloud.count;
+
+  // Can't happen for a frame that fit MAX_TLV_SIZE (see the static_assert),
+  // but the count comes off the wire
+  size_t points_in_cloud = cloud.count;
+  if(points_in_cloud > RADAR_RING_MAX_POINTS){
+    points_in_cloud = RADAR_RING_MAX_POINTS;
+    puts("WARNING: exceeed number of points in a frame, will clip!");
+  }
+
+  // The wire format keeps the points as one array, like the TLV
+  radar_point_cloud->meta_data.points = points_in_cloud;
+  if(cloud_q16) {
+    point_cloud_q16_encode(cloud.items, reinterpret_cast<PointCloudWireQ16*>(radar_point_cloud));
+    return;
+  }
+  memcpy(point_cloud_wire_points(radar_point_cloud), cloud.items, points_in_cloud * sizeof(DPIF_PointCloudSpherical));
+}
+
+static void on_side_info(const MmwDemo_output_message_header&, tlv_payload<DPIF_PointCloudSideInfo> side) {
+  points_in_side_info = side.count;
+
+  // Goes right behind the points, so it needs to know how many there are.
+  // A count that doesn't match drops the frame in process_radar_tlv.
+  if(side.count != (size_t)points_in_tlv) {
+    return;
+  }
+  void* out = cloud_q16 ? static_cast<void*>(point_cloud_q16_side_info(reinterpret_cast<PointCloudWireQ16*>(radar_point_cloud)))
+                        : static_cast<void*>(point_cloud_wire_side_info(radar_point_cloud));
+  memcpy(out, side.items, radar_point_cloud->meta_data.points * sizeof(DPIF_PointCloudSideInfo));
+}
+
+// Everything else is forwarded as is to its own topic, but only if
+// somebody is listening
+template<typename Payload, const char* Topic>
+static void forward_tlv(const MmwDemo_output_message_header& header, tlv_payload<Payload> payload) {
+  static uint8_t message[MESSAGE_QUEUE_SIZE - 1];
+
+  if(!mq_has_subscribers(Topic)) {
+    return;
+  }
+
+  size_t max_items = (sizeof(message) - sizeof(RadarTlvMessageHeader)) / sizeof(Payload);
+  RadarTlvMessageHeader* message_header = reinterpret_cast<RadarTlvMessageHeader*>(message);
+  message_header->frameNumber = header.frameNumber;
+  message_header->type        = payload.type;
+  message_header->count       = (payload.count > max_items) ? max_items : payload.count;
+  memcpy(message + sizeof(RadarTlvMessageHeader), payload.items, message_header->count * sizeof(Payload));
+
+  mq_enqueue(Topic, message, sizeof(RadarTlvMessageHeader) + message_header->count * sizeof(Payload));
+}
+
+static constexpr char range_profile_topic[]  = RADAR_RANGE_PROFILE_MQ_PATH;
+static constexpr char stats_topic[]          = RADAR_STATS_MQ_PATH;
+static constexpr char temperature_topic[]    = RADAR_TEMPERATURE_MQ_PATH;
+static constexpr char targets_topic[]        = RADAR_TARGETS_MQ_PATH;
+static constexpr char target_index_topic[]   = RADAR_TARGET_INDEX_MQ_PATH;
+static constexpr char target_height_topic[]  = RADAR_TARGET_HEIGHT_MQ_PATH;
+
+using radar_tlv_registry = tlv_registry<
+  tlv_handler<MMWDEMO_OUTPUT_MSG_SPHERICAL_POINTS,           DPIF_PointCloudSpherical,     on_spherical_points>,
+  tlv_handler<MMWDEMO_OUTPUT_MSG_DETECTED_POINTS_SIDE_INFO,  DPIF_PointCloudSideInfo,      on_side_info>,
+  tlv_handler<MMWDEMO_OUTPUT_MSG_RANGE_PROFILE,              MmwDemo_rangeProfileBin,      forward_tlv<MmwDemo_rangeProfileBin, range_profile_topic>>,
+  tlv_handler<MMWDEMO_OUTPUT_MSG_STATS,                      MmwDemo_output_message_stats, forward_tlv<MmwDemo_output_message_stats, stats_topic>>,
+  tlv_handler<MMWDEMO_OUTPUT_MSG_TEMPERATURE_STATS,          MmwDemo_temperatureStats,     forward_tlv<MmwDemo_temperatureStats, temperature_topic>>,
+  tlv_handler<MMWDEMO_OUTPUT_MSG_TRACKERPROC_3D_TARGET_LIST, DPIF_TrackerTarget3D,         forward_tlv<DPIF_TrackerTarget3D, targets_topic>>,
+  tlv_handler<MMWDEMO_OUTPUT_MSG_TRACKERPROC_TARGET_INDEX,   DPIF_TrackerTargetIndex,      forward_tlv<DPIF_TrackerTargetIndex, target_index_topic>>,
+  tlv_handler<MMWDEMO_OUTPUT_MSG_TRACKERPROC_TARGET_HEIGHT,  DPIF_TrackerTargetHeight,     forward_tlv<DPIF_TrackerTargetHeight, target_height_topic>>
+>;
+
 // TLV structure 
-// <header> <MMWDEMO_OUTPUT_MSG_SPHERICAL_POINTS> [ point cloud ] <MMWDEMO_OUTPUT_MSG_DETECTED_POINTS_SIDE_INFO> [ point cloud side info] <MISC TLVs> [MISC DATA] 
-// Returns size of package going to python OR -1 in case of error 
+// <header> { <TLV header> [payload] } * numTLVs
+// Every TLV is dispatched through radar_tlv_registry, the point cloud
+// (MMWDEMO_OUTPUT_MSG_SPHERICAL_POINTS + MMWDEMO_OUTPUT_MSG_DETECTED_POINTS_SIDE_INFO)
+// is assembled in radar_point_cloud (a ring slot).
+// Returns size of package going to python OR -1 if there is no point cloud to send
 int process_radar_tlv(processed_tlv tlv) {
-  // Read the First TLV
-  MmwDemo_output_message_tlv* tlv_ptr_spherical = reinterpret_cast<MmwDemo_output_message_tlv*> (tlv.buff + sizeof(MmwDemo_output_message_header_t));
-  // don't boher if we don't have any points
-  if(MMWDEMO_OUTPUT_MSG_SPHERICAL_POINTS != tlv_ptr_spherical->type) { 
-    // The code running on the IRW68XX will first send TLVs containing 
-    // point cloud information (which we are after).
-    // However, if nothing is detected, it will send out other meta data we don't care
-    // about, in that case we won't bother processing it.
-    // If points are detected, the first header will be of type MMWDEMO_OUTPUT_MSG_SPHERICAL_POINTS
+  points_in_tlv       = 0;
+  points_in_side_info = 0;
+  claim_cloud();
+
+  if(walk_tlvs<radar_tlv_registry>(tlv) < 0) {
     return -1;
   }
 
-  size_t cloud_payload_len = tlv_ptr_spherical->length; 
-  int points_in_cloud = tlv_ptr_spherical->length / sizeof(DPIF_PointCloudSpherical);
-  if(points_in_cloud > MAX_CLOUD_POINTS){
-    points_in_cloud = MAX_CLOUD_POINTS;
-    puts("WARNING: exceeed number of points in a frame, will clip!");
+  // If nothing is detected the IWR68XX only sends out meta data
+  if(0 == points_in_tlv) {
+    return -1;
   }
-  printf("Detected %u in the point cloud\n", points_in_cloud);
-
-  // This is badly named (by TI, so we won't updat it) 
-  // What we do here is extract individual points in the point 
-  // cloud and store them. Cld will contain an individual point
-  // in the point cloud, not the entire cloud
-  DPIF_PointCloudSpherical* cld;
-  for(int i = 0; i < points_in_cloud; i++) {
-    cld = reinterpret_cast<DPIF_PointCloudSpherical*>(tlv.buff                                + 
-                                                      sizeof(MmwDemo_output_message_header_t) +
-                                                      sizeof(MmwDemo_output_message_tlv_t)    +
-                                                      i*sizeof(DPIF_PointCloudSpherical)
-                                                     );
-    radar_point_cloud.points[i].sphere = *cld;
-  }
-
-  // Get the TLV for the SNR 
-  MmwDemo_output_message_tlv* tlv_ptr_snr = reinterpret_cast<MmwDemo_output_message_tlv*>(tlv.buff                                +
-                                                                                          sizeof(MmwDemo_output_message_header_t) + 
-                                                                                          sizeof(MmwDemo_output_message_tlv_t)    +
-                                                                                          cloud_payload_len);
-  if(MMWDEMO_OUTPUT_MSG_DETECTED_POINTS_SIDE_INFO != tlv_ptr_snr->type) {
-    printf("Error, unexpected TLV in place of SNR TLV: TLV for SNR == %d\n", tlv_ptr_snr->type);
+  if(points_in_tlv != points_in_side_info) {
+    printf("Error, SNR TLV does not match the point cloud: %d points vs %d\n", points_in_tlv, points_in_side_info);
     return -1;
   }
 
-  size_t side_info_payload_len = tlv_ptr_snr->length; 
-  int points_in_side_info = side_info_payload_len / sizeof(DPIF_PointCloudSideInfo);
-  assert(points_in_cloud == points_in_side_info);
-
-  for(int i = 0; i < points_in_side_info; i++) {
-    DPIF_PointCloudSideInfo* side_info = reinterpret_cast<DPIF_PointCloudSideInfo*>(tlv.buff                                +
-                                                                                    sizeof(MmwDemo_output_message_header_t) +
-                                                                                    sizeof(MmwDemo_output_message_tlv_t)    +
-                                                                                    cloud_payload_len                       +
-                                                                                    sizeof(MmwDemo_output_message_tlv_t)    +
-                                                                                    i*sizeof(DPIF_PointCloudSideInfo)
-                                                                                   );
-    radar_point_cloud.points[i].side = *side_info;
-  }  
+  const MmwDemo_output_message_header* header = reinterpret_cast<const MmwDemo_output_message_header*>(tlv.buff);
+  radar_point_cloud->meta_data.frameNumber   = header->frameNumber;
+  radar_point_cloud->meta_data.timeCpuCycles = header->timeCpuCycles;
 
-  radar_point_cloud.meta_data.points = points_in_cloud;
-  return sizeof(PointCloudMetaData) + points_in_cloud*sizeof(SphericalPointAndSnr);
+  printf("Detected %u in the point cloud\n", radar_point_cloud->meta_data.points);
+  uint32_t points = radar_point_cloud->meta_data.points;
+  return cloud_q16 ? point_cloud_q16_size(points) : point_cloud_wire_size(points);
 }
 
 void enque_to_python_radar(int buff_size){
   struct timespec tp;
   clock_gettime(CLOCK_MONOTONIC, &tp);
-  radar_point_cloud.meta_data.seconds     = tp.tv_sec;
-  radar_point_cloud.meta_data.nanoseconds = tp.tv_nsec;
-  mq_enqueue(RADAR_MQ_PATH, reinterpret_cast<uint8_t*>(&radar_point_cloud), buff_size);
-}
+  radar_point_cloud->meta_data.seconds     = tp.tv_sec;
+  radar_point_cloud->meta_data.nanoseconds = tp.tv_nsec;
 
-void program_loop() {
-  tty_handler radar = setup_radar();
-  while(true){
-    // Blocking read 
-    if(REQUEST_RESET == radar.tty_read_frame()){
-      break;
-    }
-
-    auto last_radar_tlv = radar.get_last_processed_tlv();
-    auto buff_size = process_radar_tlv(last_radar_tlv);
-    if(buff_size > 0) {
-      enque_to_python_radar(buff_size);
-    }
+  if(cloud_sink) {
+    cloud_sink(radar_point_cloud);
+    return;
   }
-
-  // tty_hanlders destructor will clean up the port
+  if(!cloud_wanted) {
+    return;
+  }
+  mq_topic_sent(&radar_topic, cloud_in_ring);
+  if(!cloud_in_ring) {
+    printf("Radar ring full, dropped frame %u (%u dropped so far)\n", radar_point_cloud->meta_data.frameNumber, shm_ring_dropped(&radar_ring));
+    return;
+  }
+  shm_ring_publish(&radar_ring, buff_size);
 }
 
-int main(){
-  while(true){
-    program_loop();
-    
-    // if we return from program_loop - it means we have a big 
-    // radar bug - do a hard reset of the radar system
-    usb_radar_reset();
-    
-    sleep(3); // give some time for the USB to re-enumerate
+void handle_radar_frame(processed_tlv tlv) {
+  auto buff_size = process_radar_tlv(tlv);
+  if(buff_size > 0) {
+    enque_to_python_radar(buff_size);
   }
 }
@@ -0,0 +1,25 @@
+#include <unistd.h>
+
+#include <memory>
+
+#include "tty.h"
+#include "tlv_processor.h"
+#include "radar_recovery.h"
+
+int main(){
+  auto radar = setup_radar();
+  if(!radar->tty_cfg_applied()) {
+    radar = recover_radar(std::move(radar));
+    handle_radar_frame(radar->get_last_processed_tlv());
+  }
+
+  while(true){
+    // Blocking read 
+    if(REQUEST_RESET == radar->tty_read_frame()){
+      // The radar stalled, only returns once frames flow again
+      radar = recover_radar(std::move(radar));
+    }
+
+    handle_radar_frame(radar->get_last_processed_tlv());
+  }
+}
@@ -0,0 +1,229 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <libgen.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <linux/usbdevice_fs.h>
+
+#include <set>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <memory>
+
+#include "tty.h"
+#include "tlv_processor.h"
+#include "radar_recovery.h"
+
+using std::set;
+using std::string;
+using std::vector;
+using std::unique_ptr;
+
+static const char* stage_names[RECOVERY_STAGE_COUNT] = {
+  "soft restart",
+  "reopen ports",
+  "usb reset",
+};
+
+// /dev/ttyUSB0 -> /sys/class/tty/ttyUSB0/device -> walk up to the USB
+// device (the directory holding busnum/devnum) -> /dev/bus/usb/BBB/DDD
+static string usb_node_of_tty(const string& tty_path) {
+  char real_tty[PATH_MAX];
+  char real_dev[PATH_MAX];
+
+  if(!realpath(tty_path.c_str(), real_tty)) {
+    return "";
+  }
+  string sysfs = string("/sys/class/tty/") + basename(real_tty) + "/device";
+  if(!realpath(sysfs.c_str(), real_dev)) {
+    return "";
+  }
+
+  string dir = real_dev;
+  while(dir.size() > strlen("/sys/devices")) {
+    int bus = 0, dev = 0;
+    FILE* busnum = fopen((dir + "/busnum").c_str(), "r");
+    FILE* devnum = fopen((dir + "/devnum").c_str(), "r");
+    bool found = busnum && devnum && 1 == fscanf(busnum, "%d", &bus) && 1 == fscanf(devnum, "%d", &dev);
+    if(busnum) fclose(busnum);
+    if(devnum) fclose(devnum);
+
+    if(found) {
+      char node[64];
+      snprintf(node, sizeof(node), "/dev/bus/usb/%03d/%03d", bus, dev);
+      return node;
+    }
+    dir = dir.substr(0, dir.rfind('/'));
+  }
+  return "";
+}
+
+static bool usb_reset_node(const string& node) {
+  int fd = open(node.c_str(), O_WRONLY);
+  if(-1 == fd) {
+    printf("Failed to open %s with errno: %s\n", node.c_str(), strerror(errno));
+    return false;
+  }
+  int rc = ioctl(fd, USBDEVFS_RESET, 0);
+  if(rc < 0) {
+    printf("USBDEVFS_RESET on %s failed with errno: %s\n", node.c_str(), strerror(errno));
+  }
+  close(fd);
+  return rc >= 0;
+}
+
+bool usb_reset_tty(const string& tty_path) {
+  string node = usb_node_of_tty(tty_path);
+  if(node == "") {
+    printf("%s is not a USB device, can't reset it\n", tty_path.c_str());
+    return false;
+  }
+  return usb_reset_node(node);
+}
+
+static bool ttys_ready(const vector<string>& paths) {
+  for(auto& path : paths) {
+    int fd = open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if(-1 == fd) {
+      return false;
+    }
+    close(fd);
+  }
+  return true;
+}
+
+bool wait_for_ttys(const vector<string>& paths, int timeout_ms) {
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if(-1 == fd) {
+    printf("Failed to init inotify with errno: %s\n", strerror(errno));
+    return false;
+  }
+
+  // Nodes are created by the kernel, udev then fixes up permissions
+  // and the /dev/serial symlinks, any of those can be the last step
+  for(auto& path : paths) {
+    char dir[PATH_MAX];
+    strncpy(dir, path.c_str(), sizeof(dir) - 1);
+    dir[sizeof(dir) - 1] = '\0';
+    inotify_add_watch(fd, dirname(dir), IN_CREATE | IN_ATTRIB | IN_MOVED_TO);
+  }
+
+  double deadline = tty_now_ms() + timeout_ms;
+  bool ready = ttys_ready(paths);
+  while(!ready) {
+    int timeout = deadline - tty_now_ms();
+    if(timeout <= 0) {
+      break;
+    }
+
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if(poll(&pfd, 1, timeout) > 0) {
+      char event_buff[4096];
+      while(read(fd, event_buff, sizeof(event_buff)) > 0);
+    }
+    ready = ttys_ready(paths);
+  }
+
+  close(fd);
+  return ready;
+}
+
+// A stage is done once a frame made it through
+static bool got_first_frame(recovery_stage_e stage, tty_handler& radar, double start) {
+  bool ok = radar.tty_cfg_applied() && radar.tty_wait_frame(RECOVERY_FIRST_FRAME_TIMEOUT_MS);
+  printf("Recovery stage '%s': %s after %.1f ms\n", stage_names[stage], ok ? "first frame" : "failed", tty_now_ms() - start);
+  return ok;
+}
+
+// Before the next USB reset. Goes on as soon as the ports show up if
+// they are gone, the radar was probably plugged back in.
+static void usb_reset_backoff(const vector<string>& paths, int usb_resets) {
+  int backoff_ms = std::min(RECOVERY_USB_RESET_BACKOFF_MS << std::min(usb_resets - 1, 6),
+                            RECOVERY_USB_RESET_MAX_BACKOFF_MS);
+  printf("Recovery stage '%s': try %d in %d ms\n", stage_names[RECOVERY_USB_RESET], usb_resets + 1, backoff_ms);
+  if(ttys_ready(paths)) {
+    usleep(backoff_ms * 1000);
+  } else {
+    wait_for_ttys(paths, backoff_ms);
+  }
+}
+
+unique_ptr<tty_handler> recover_radar(unique_ptr<tty_handler> radar) {
+  vector<string> paths = radar->get_port_paths();
+  int stage      = RECOVERY_SOFT_RESTART;
+  int usb_resets = 0;
+
+  while(true) {
+    double start = tty_now_ms();
+
+    switch(stage) {
+      case RECOVERY_SOFT_RESTART:
+        radar->tty_flush();
+        if(false == radar->tty_restart_sensor()) {
+          printf("Recovery stage '%s': radar CLI did not answer\n", stage_names[stage]);
+          break;
+        }
+        if(got_first_frame(RECOVERY_SOFT_RESTART, *radar, start)) {
+          return radar;
+        }
+        break;
+
+      case RECOVERY_REOPEN:
+        radar->tty_flush();
+        radar.reset();
+        // Ports vanished, nothing to reopen
+        if(false == ttys_ready(paths)) {
+          printf("Recovery stage '%s': ports are gone\n", stage_names[stage]);
+          break;
+        }
+        radar = setup_radar();
+        if(got_first_frame(RECOVERY_REOPEN, *radar, start)) {
+          return radar;
+        }
+        break;
+
+      case RECOVERY_USB_RESET: {
+        if(usb_resets > 0) {
+          usb_reset_backoff(paths, usb_resets);
+          start = tty_now_ms();
+        }
+        usb_resets++;
+
+        // Has to be looked up while the ports still exist
+        set<string> nodes;
+        for(auto& path : paths) {
+          nodes.insert(usb_node_of_tty(path));
+        }
+        nodes.erase("");
+
+        radar.reset();
+        // A reset radar boots without a config
+        cfg_cache_invalidate();
+
+        // The cfg and data ports usually share one USB device
+        for(auto& node : nodes) {
+          usb_reset_node(node);
+        }
+
+        if(false == wait_for_ttys(paths, RECOVERY_ENUMERATION_TIMEOUT_MS)) {
+          printf("Recovery stage '%s': ports did not come back after %.1f ms\n", stage_names[stage], tty_now_ms() - start);
+          continue;
+        }
+        radar = setup_radar();
+        if(got_first_frame(RECOVERY_USB_RESET, *radar, start)) {
+          return radar;
+        }
+        // Stay on the last stage until the radar comes back
+        continue;
+      }
+    }
+    stage++;
+  }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "tty.h"
+
+// How long a stage gets to produce a frame before the next one is tried,
+// the stall deadline of the data port still applies and is usually shorter
+#define RECOVERY_FIRST_FRAME_TIMEOUT_MS (1500)
+// How long the ports get to come back after a USB reset
+#define RECOVERY_ENUMERATION_TIMEOUT_MS (5000)
+// Wait before each USB reset after the first, doubling up to the max
+// while the radar stays away (unplugged or dead)
+#define RECOVERY_USB_RESET_BACKOFF_MS     (1000)
+#define RECOVERY_USB_RESET_MAX_BACKOFF_MS (60000)
+
+// Cheapest first, each stage is only tried if the one before it did not
+// get frames flowing again
+typedef enum {
+  RECOVERY_SOFT_RESTART, // sensorStop + sensorStart on the open ports
+  RECOVERY_REOPEN,       // tcflush, close and reopen the ports
+  RECOVERY_USB_RESET,    // USBDEVFS_RESET, wait for the ports to re-enumerate
+  RECOVERY_STAGE_COUNT
+} recovery_stage_e;
+
+// Walks the ladder until the radar streams again, never gives up on the
+// last stage but backs off between its tries. Blocks for as long as that
+// takes, tlvd runs it on a thread of its own. The first frame is left in
+// get_last_processed_tlv() of the returned handler.
+std::unique_ptr<tty_handler> recover_radar(std::unique_ptr<tty_handler> radar);
+
+// Resets the USB device behind a tty (/dev/ttyUSB0, /dev/serial/by-id/...)
+// returns false if it isn't a USB device or the ioctl failed
+bool usb_reset_tty(const std::string& tty_path);
+
+// Waits for every path to show up and be openable, uses inotify on the
+// parent directories instead of sleeping
+bool wait_for_ttys(const std::vector<std::string>& paths, int timeout_ms);
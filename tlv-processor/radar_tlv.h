@@ -1,6 +1,29 @@
 #pragma once
 
-#define RADAR_MQ_PATH "/mq_radar"
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Point clouds go to scope-deepstream through a shm_ring (see shm_ring.h),
+// one PointCloudWire per slot. Slots hold the largest cloud a
+// data port frame (MAX_TLV_SIZE, tty.h) has room for, every point takes
+// a DPIF_PointCloudSpherical and a DPIF_PointCloudSideInfo, so no frame
+// the parser accepts is ever clipped. Only the bytes a cloud fills get
+// written and read, a small cloud costs the same as before.
+#define RADAR_RING_PATH       "/shm_radar"
+#define RADAR_RING_SLOTS      (8)
+#define RADAR_RING_MAX_POINTS (10240)
+#define RADAR_RING_SLOT_SIZE  (sizeof(PointCloudWire) + RADAR_RING_MAX_POINTS * POINT_CLOUD_WIRE_POINT_SIZE)
+
+// Optional topics, the radar program only publishes these once a
+// consumer has created the queue. Messages are a RadarTlvMessageHeader
+// followed by the TLV payload as sent by the IWR.
+#define RADAR_RANGE_PROFILE_MQ_PATH "/mq_radar_range_profile"
+#define RADAR_STATS_MQ_PATH         "/mq_radar_stats"
+#define RADAR_TEMPERATURE_MQ_PATH   "/mq_radar_temperature"
+#define RADAR_TARGETS_MQ_PATH       "/mq_radar_targets"
+#define RADAR_TARGET_INDEX_MQ_PATH  "/mq_radar_target_index"
+#define RADAR_TARGET_HEIGHT_MQ_PATH "/mq_radar_target_height"
 
 #define VIRTUAL_UART_PORTS (2)
 enum port_e { cfg_port_e, data_port_e };
@@ -58,6 +81,68 @@ typedef struct DPIF_PointCloudCartesian_t
     float  velocity;
 } DPIF_PointCloudCartesian;
 
+// From TI, MMWDEMO_OUTPUT_MSG_STATS
+typedef struct MmwDemo_output_message_stats_t
+{
+    uint32_t interFrameProcessingTime;    // usec
+    uint32_t transmitOutputTime;          // usec
+    uint32_t interFrameProcessingMargin;  // usec
+    uint32_t interChirpProcessingMargin;  // usec
+    uint32_t activeFrameCPULoad;          // %
+    uint32_t interFrameCPULoad;           // %
+} MmwDemo_output_message_stats;
+
+// From TI, MMWDEMO_OUTPUT_MSG_TEMPERATURE_STATS (rlRfTempData_t inlined)
+typedef struct MmwDemo_temperatureStats_t
+{
+    int32_t  tempReportValid;
+    uint32_t time;                        // ms since the RF front end booted
+    int16_t  tmpRx0Sens;                  // degrees C
+    int16_t  tmpRx1Sens;
+    int16_t  tmpRx2Sens;
+    int16_t  tmpRx3Sens;
+    int16_t  tmpTx0Sens;
+    int16_t  tmpTx1Sens;
+    int16_t  tmpTx2Sens;
+    int16_t  tmpPmSens;
+    int16_t  tmpDig0Sens;
+    int16_t  tmpDig1Sens;
+} MmwDemo_temperatureStats;
+
+// From TI, MMWDEMO_OUTPUT_MSG_RANGE_PROFILE, one log magnitude (Q9) per range bin
+typedef uint16_t MmwDemo_rangeProfileBin;
+
+// From TI, tracker output (TLV 1010), one per tracked target
+typedef struct DPIF_TrackerTarget3D_t
+{
+    uint32_t tid;              // Track ID
+    float    posX;             // Target position in X, Y, Z (m)
+    float    posY;
+    float    posZ;
+    float    velX;             // Target velocity in X, Y, Z (m/s)
+    float    velY;
+    float    velZ;
+    float    accX;             // Target acceleration in X, Y, Z (m/s^2)
+    float    accY;
+    float    accZ;
+    float    ec[16];           // Error covariance matrix
+    float    g;                // Gating function gain
+    float    confidenceLevel;
+} DPIF_TrackerTarget3D;
+
+// From TI, tracker output (TLV 1011), one per point in the cloud,
+// holds the track ID the point got associated with
+typedef uint8_t DPIF_TrackerTargetIndex;
+#define TRACKER_INDEX_NOT_ASSOCIATED (253)
+
+// From TI, tracker output (TLV 1012), one per tracked target
+typedef struct DPIF_TrackerTargetHeight_t
+{
+    uint32_t tid;
+    float    maxZ;
+    float    minZ;
+} DPIF_TrackerTargetHeight;
+
 // From TI, TLV structure for side info of points
 typedef struct DPIF_PointCloudSideInfo_t
 {
@@ -65,6 +150,14 @@ typedef struct DPIF_PointCloudSideInfo_t
     int16_t  noise;
 } DPIF_PointCloudSideInfo;
 
+// Header of every message on the optional radar topics
+typedef struct RadarTlvMessageHeader_t
+{
+    uint32_t frameNumber;    // From IWR
+    uint32_t type;           // TLV type the payload came from
+    uint32_t count;          // elements in the payload (may be clipped to fit a message)
+} RadarTlvMessageHeader;
+
 typedef struct PointCloudMetaData_t
 {
     uint32_t frameNumber;    // From IWR
@@ -75,6 +168,9 @@ typedef struct PointCloudMetaData_t
     uint32_t nanoseconds;    // From TLV parser
 } PointCloudMetaData;
 
+// Point cloud wire format version 1, superseded by PointCloudWire below.
+// Still used by bench_ipc's message queue and by the converters.
+//
 // This is packed since it gets sent over the wire to python
 // This is a single point in a point cloud stored in 
 // spherical co-ordinates as well as side info for that 
@@ -89,9 +185,159 @@ typedef struct PointCloudSphericalAndSnr_t
 // The default size of a message queue is 8196 on our OS
 // the size of packed PointCloudCartesianAndSnr is 24 bytes
 // This means we can fit about ~325 points in a single message
+// Clouds don't go through message queues anymore, only bench_ipc still
+// compares against one.
 #define MAX_CLOUD_POINTS (325)
 typedef struct PointCloudWireFormatSpherical_t 
 {
   PointCloudMetaData   meta_data;
   SphericalPointAndSnr points[MAX_CLOUD_POINTS];
 } __attribute__((packed)) PointCloudSpherical;
+
+// Same layout as PointCloudSpherical, any number of points
+typedef struct PointCloudSphericalSlot_t
+{
+  PointCloudMetaData   meta_data;
+  SphericalPointAndSnr points[];
+} __attribute__((packed)) PointCloudSphericalSlot;
+
+#ifdef __cplusplus
+#define POINT_CLOUD_WIRE_ASSERT(cond, msg) static_assert(cond, msg)
+#else
+#define POINT_CLOUD_WIRE_ASSERT(cond, msg) _Static_assert(cond, msg)
+#endif
+
+// Point cloud wire format version 2, what the radar ring and the in
+// process sink carry. Nothing is packed. The 32 byte header is followed by
+// the points as two arrays, the same way the IWR sends them (one TLV each):
+//
+//   PointCloudWire | DPIF_PointCloudSpherical[points] | DPIF_PointCloudSideInfo[points]
+//
+// With the cloud 16 byte aligned (ring slots, mailboxes and the parser's
+// scratch cloud all are) every spherical point is one aligned 16 byte load
+// that never straddles a cache line, and the parser copies each TLV with
+// a single memcpy instead of interleaving point by point. Bump
+// POINT_CLOUD_WIRE_VERSION on any layout change.
+#define POINT_CLOUD_WIRE_VERSION    (2)
+#define POINT_CLOUD_WIRE_ALIGN      (16)
+#define POINT_CLOUD_WIRE_POINT_SIZE (sizeof(DPIF_PointCloudSpherical) + sizeof(DPIF_PointCloudSideInfo))
+
+typedef struct PointCloudWireFormatV2_t
+{
+  PointCloudMetaData meta_data;
+  uint32_t           version;      // POINT_CLOUD_WIRE_VERSION
+  uint32_t           reserved[2];  // points start 16 byte aligned
+} __attribute__((aligned(POINT_CLOUD_WIRE_ALIGN))) PointCloudWire;
+
+POINT_CLOUD_WIRE_ASSERT(sizeof(DPIF_PointCloudSpherical) == 16, "spherical point layout changed");
+POINT_CLOUD_WIRE_ASSERT(sizeof(DPIF_PointCloudSideInfo) == 4, "side info layout changed");
+POINT_CLOUD_WIRE_ASSERT(sizeof(PointCloudMetaData) == 20, "meta data layout changed");
+POINT_CLOUD_WIRE_ASSERT(offsetof(PointCloudWire, version) == 20, "wire header layout changed");
+POINT_CLOUD_WIRE_ASSERT(sizeof(PointCloudWire) == 32, "wire header layout changed");
+POINT_CLOUD_WIRE_ASSERT(sizeof(SphericalPointAndSnr) == 20, "version 1 point layout changed");
+
+static inline uint32_t point_cloud_wire_size(uint32_t points)
+{
+  return sizeof(PointCloudWire) + points * POINT_CLOUD_WIRE_POINT_SIZE;
+}
+
+// Like strchr, these take a const cloud but hand out writable arrays, the
+// producer fills them in place. Side info goes right after the points, set
+// meta_data.points first.
+static inline DPIF_PointCloudSpherical* point_cloud_wire_points(const PointCloudWire* cloud)
+{
+  return (DPIF_PointCloudSpherical*)(cloud + 1);
+}
+
+static inline DPIF_PointCloudSideInfo* point_cloud_wire_side_info(const PointCloudWire* cloud)
+{
+  return (DPIF_PointCloudSideInfo*)(point_cloud_wire_points(cloud) + cloud->meta_data.points);
+}
+
+// Point cloud wire format version 3, the radar program sends it instead
+// of version 2 when RADAR_WIRE_Q16 is set. Same header up to version,
+// then one scale per field, every point is the 4 fields of its
+// DPIF_PointCloudSpherical as int16 (value = q * scale), side info as is:
+//
+//   PointCloudWireQ16 | int16_t[points][4] | DPIF_PointCloudSideInfo[points]
+//
+// 12 bytes a point instead of 20. The scales are picked per frame so the
+// biggest value of each field uses the whole int16 range, at the 70m
+// config range steps are about 2mm. See point_cloud_q16.h for the codec.
+#define POINT_CLOUD_WIRE_Q16_VERSION    (3)
+#define POINT_CLOUD_WIRE_Q16_POINT_SIZE (4 * sizeof(int16_t) + sizeof(DPIF_PointCloudSideInfo))
+
+typedef struct PointCloudWireQ16_t
+{
+  PointCloudMetaData meta_data;
+  uint32_t           version;      // POINT_CLOUD_WIRE_Q16_VERSION
+  uint32_t           reserved[2];
+  float              scale[4];     // range, azimuth, elevation, velocity
+} __attribute__((aligned(POINT_CLOUD_WIRE_ALIGN))) PointCloudWireQ16;
+
+POINT_CLOUD_WIRE_ASSERT(offsetof(PointCloudWireQ16, version) == offsetof(PointCloudWire, version), "q16 header layout changed");
+POINT_CLOUD_WIRE_ASSERT(sizeof(PointCloudWireQ16) == 48, "q16 header layout changed");
+
+static inline uint32_t point_cloud_q16_size(uint32_t points)
+{
+  return sizeof(PointCloudWireQ16) + points * POINT_CLOUD_WIRE_Q16_POINT_SIZE;
+}
+
+// Which wire format a cloud of len bytes is in: 3, 2, 1 (PointCloudSphericalSlot)
+// or 0 if it's none of them. Version 1 has no version field, but its size
+// never matches one of the others for the same point count. buff has to
+// hold at least a PointCloudMetaData.
+static inline int point_cloud_wire_version(const void* buff, uint32_t len)
+{
+  const PointCloudMetaData* meta_data = (const PointCloudMetaData*)buff;
+  if(len < sizeof(PointCloudMetaData)) {
+    return 0;
+  }
+  if(len == sizeof(PointCloudMetaData) + meta_data->points * sizeof(SphericalPointAndSnr)) {
+    return 1;
+  }
+  if(len == point_cloud_wire_size(meta_data->points) &&
+     POINT_CLOUD_WIRE_VERSION == ((const PointCloudWire*)buff)->version) {
+    return POINT_CLOUD_WIRE_VERSION;
+  }
+  if(len == point_cloud_q16_size(meta_data->points) &&
+     POINT_CLOUD_WIRE_Q16_VERSION == ((const PointCloudWireQ16*)buff)->version) {
+    return POINT_CLOUD_WIRE_Q16_VERSION;
+  }
+  return 0;
+}
+
+// Version 1 -> 2, out needs room for point_cloud_wire_size(points) bytes.
+// Returns the size of the converted cloud.
+static inline uint32_t point_cloud_wire_from_v1(const PointCloudSphericalSlot* old, PointCloudWire* out)
+{
+  uint32_t points = old->meta_data.points;
+
+  memset(out, 0, sizeof(PointCloudWire));
+  out->meta_data = old->meta_data;
+  out->version   = POINT_CLOUD_WIRE_VERSION;
+
+  DPIF_PointCloudSpherical* spheres = point_cloud_wire_points(out);
+  DPIF_PointCloudSideInfo*  side    = point_cloud_wire_side_info(out);
+  for(uint32_t i = 0; i < points; i++) {
+    memcpy(&spheres[i], &old->points[i].sphere, sizeof(DPIF_PointCloudSpherical));
+    memcpy(&side[i], &old->points[i].side, sizeof(DPIF_PointCloudSideInfo));
+  }
+  return point_cloud_wire_size(points);
+}
+
+// Version 2 -> 1, for tools that still read the old layout. out needs
+// room for sizeof(PointCloudMetaData) + points * sizeof(SphericalPointAndSnr).
+static inline uint32_t point_cloud_wire_to_v1(const PointCloudWire* cloud, PointCloudSphericalSlot* out)
+{
+  uint32_t points = cloud->meta_data.points;
+  const DPIF_PointCloudSpherical* spheres = point_cloud_wire_points(cloud);
+  const DPIF_PointCloudSideInfo*  side    = point_cloud_wire_side_info(cloud);
+
+  out->meta_data = cloud->meta_data;
+  for(uint32_t i = 0; i < points; i++) {
+    memcpy(&out->points[i].sphere, &spheres[i], sizeof(DPIF_PointCloudSpherical));
+    memcpy(&out->points[i].side, &side[i], sizeof(DPIF_PointCloudSideInfo));
+  }
+  return sizeof(PointCloudMetaData) + points * sizeof(SphericalPointAndSnr);
+}
@@ -0,0 +1,166 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cassert>
+
+#include "capture.h"
+#include "pty.h"
+
+// Plays a capture made with RADAR_CAPTURE/SENSOR_CAPTURE back through a
+// pseudo-terminal, so the unmodified radar/sensor programs can consume it:
+//
+//   $ ./replay -c radar.cap
+//   RADAR_DATA_PORT=/dev/pts/3
+//   RADAR_CFG_PORT=/dev/pts/4
+//   $ RADAR_DATA_PORT=/dev/pts/3 RADAR_CFG_PORT=/dev/pts/4 ./radar
+//
+// A sensor board capture prints SENSOR_PORT=/dev/pts/N instead, for the
+// sensor program.
+
+using std::string;
+using std::vector;
+
+typedef struct {
+  uint64_t offset_ns;     // from the first record
+  vector<uint8_t> data;
+} capture_record;
+
+static void usage() {
+  puts("usage: replay [-s speed] [-f] [-n loops] [-c] <capture file>");
+  puts("  -s N  replay at N times the captured speed (default 1)");
+  puts("  -f    replay as fast as the reader keeps up");
+  puts("  -n N  play the capture N times");
+  puts("  -c    also emulate the radar CLI port (answers every command with Done)");
+  exit(1);
+}
+
+static uint64_t now_ns() {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline) {
+  struct timespec tp;
+  tp.tv_sec  = deadline / 1000000000ULL;
+  tp.tv_nsec = deadline % 1000000000ULL;
+  while(EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL));
+}
+
+// source is filled in from the file header (capture_source_e)
+static vector<capture_record> load_capture(const char* path, uint32_t* source) {
+  vector<capture_record> records;
+  FILE* fp = fopen(path, "r");
+  if(!fp) {
+    printf("Failed to open %s with errno: %s\n", path, strerror(errno));
+    exit(1);
+  }
+
+  capture_file_header header;
+  if(1 != fread(&header, sizeof(header), 1, fp) || strncmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) ||
+     CAPTURE_VERSION != header.version) {
+    printf("%s is not a capture file\n", path);
+    exit(1);
+  }
+  *source = header.source;
+
+  capture_record_header record_header;
+  uint64_t last_ns = 0, offset_ns = 0;
+  while(1 == fread(&record_header, sizeof(record_header), 1, fp)) {
+    // The clock only goes back across a reboot (see capture.h)
+    if(!records.empty() && record_header.monotonic_ns > last_ns) {
+      offset_ns += record_header.monotonic_ns - last_ns;
+    }
+    last_ns = record_header.monotonic_ns;
+
+    capture_record record;
+    record.offset_ns = offset_ns;
+    record.data.resize(record_header.len);
+    if(record_header.len != fread(record.data.data(), 1, record_header.len, fp)) {
+      puts("Capture is truncated, replaying what we have");
+      break;
+    }
+    records.push_back(std::move(record));
+  }
+  fclose(fp);
+  return records;
+}
+
+int main(int argc, char** argv) {
+  double speed     = 1.0;
+  bool   fast      = false;
+  bool   fake_cli  = false;
+  int    loops     = 1;
+  int    opt;
+
+  while((opt = getopt(argc, argv, "s:fn:c")) != -1) {
+    switch(opt) {
+      case 's': speed    = atof(optarg); break;
+      case 'f': fast     = true;         break;
+      case 'n': loops    = atoi(optarg); break;
+      case 'c': fake_cli = true;         break;
+      default:  usage();
+    }
+  }
+  if(optind >= argc || speed <= 0) {
+    usage();
+  }
+
+  uint32_t source;
+  vector<capture_record> records = load_capture(argv[optind], &source);
+  if(records.empty()) {
+    puts("Capture is empty");
+    return 1;
+  }
+
+  string data_path;
+  int data_fd  = open_pty(data_path);
+  int watch_fd = watch_pty_open(data_path);
+  printf("%s=%s\n", CAPTURE_SOURCE_SENSOR == source ? "SENSOR_PORT" : "RADAR_DATA_PORT", data_path.c_str());
+
+  std::atomic<bool> sensor_started{!fake_cli};
+  if(fake_cli) {
+    string cfg_path;
+    int cfg_fd = open_pty(cfg_path);
+    printf("RADAR_CFG_PORT=%s\n", cfg_path.c_str());
+    std::thread(serve_fake_cli, cfg_fd, &sensor_started).detach();
+  }
+  fflush(stdout);
+
+  // Nothing to replay into until the program under test shows up
+  wait_for_pty_open(watch_fd, data_path);
+  while(!sensor_started) {
+    usleep(1000);
+  }
+  puts("Reader attached, replaying");
+
+  size_t   total_bytes = 0;
+  uint64_t start       = now_ns();
+  for(int loop = 0; loop < loops; loop++) {
+    uint64_t loop_start = now_ns();
+    for(const auto& record : records) {
+      if(!fast) {
+        sleep_until_ns(loop_start + record.offset_ns / speed);
+      }
+      pty_write_all(data_fd, record.data.data(), record.data.size());
+      total_bytes += record.data.size();
+    }
+  }
+  double elapsed = (now_ns() - start) / 1e9;
+
+  printf("Replayed %zu records (%zu bytes) in %.3fs, %.2f MB/s\n", records.size() * loops, total_bytes,
+         elapsed, total_bytes / elapsed / (1024 * 1024));
+
+  // Leave the pty open so the reader can drain what is still buffered
+  sleep(1);
+  close(data_fd);
+}
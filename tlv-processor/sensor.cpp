@@ -16,6 +16,9 @@
 #include "sensor_board_tlv.h"
 #include "radar_tlv.h"
 #include "message_queue.h"
+#include "tlv_processor.h"
+#include "shm_ring.h"
+#include "imu_batch.h"
 
 using std::make_tuple;
 using std::string;
@@ -26,31 +29,141 @@ using std::fstream;
 using std::regex;
 using std::regex_search;
 using std::tuple;
+using std::unique_ptr;
 
 /* One for tracking logic, another for displaying orientation on the screen*/
 static inline string mq_path_imu_tracking {"/mq_imu_tracking"};
-static inline string mq_path_imu_display  {"/mq_imu_display"};
+// Display only wants the latest sample, see shm_mailbox.h
+static inline string mailbox_path_imu_display {"/shm_imu_display"};
 
 static inline string mq_path_ui  {"/mq_ui"};
 
+// Set in process mode, samples go straight to it instead of the IPC topics
+static sensor_sample_sink sample_sink;
+
+// IMU samples for imu.c, see imu_batch.h
+static shm_ring  imu_ring;
+static mq_topic  imu_ring_topic;
+static imu_batch pending_batch;
+static uint32_t  batch_samples{IMU_BATCH_DEFAULT_SAMPLES};
+static uint64_t  batch_max_ns{IMU_BATCH_DEFAULT_MS * 1000000ULL};
+
 void process_sensor_tlv(processed_tlv, tlv_message_type_e);
 
-tty_handler setup_sensor_board() {
+void set_sensor_sample_sink(sensor_sample_sink sink) {
+  sample_sink = sink;
+}
+
+void set_imu_batch(uint32_t samples, uint32_t max_latency_ms) {
+  batch_samples = samples < 1 ? 1 : (samples > IMU_BATCH_MAX_SAMPLES ? IMU_BATCH_MAX_SAMPLES : samples);
+  batch_max_ns  = max_latency_ms * 1000000ULL;
+}
+
+unique_ptr<tty_handler> setup_sensor_board() {
   vector<tuple<string, string, speed_t, string, int>> sensor_ports;
 
   // sensor board data plane
-  sensor_ports.push_back(make_tuple("/dev/ttyACM1",
+  sensor_ports.push_back(make_tuple(env_or_default("SENSOR_PORT", "/dev/ttyACM1"),
     "not_canonical",
     B115200, 
     "",
     IS_DATA_PORT)
   );
 
-  tty_handler sensor_board(sensor_ports);
+  unique_ptr<tty_handler> sensor_board(new tty_handler(sensor_ports));
+
+  // SENSOR_CAPTURE=<file> records the raw data port, see the replay tool
+  string capture = env_or_default("SENSOR_CAPTURE", "");
+  if(capture != "") {
+    sensor_board->enable_capture(capture, CAPTURE_SOURCE_SENSOR);
+  }
 
+  // SENSOR_IMU_BATCH=<samples> and SENSOR_IMU_BATCH_MS=<ms> bound the IMU
+  // batches, SENSOR_IMU_BATCH=1 sends every sample on its own
+  string samples = env_or_default("SENSOR_IMU_BATCH", std::to_string(IMU_BATCH_DEFAULT_SAMPLES));
+  string latency = env_or_default("SENSOR_IMU_BATCH_MS", std::to_string(IMU_BATCH_DEFAULT_MS));
+  set_imu_batch(std::stoi(samples), std::stoi(latency));
+  printf("IMU batches of up to %u samples or %lums\n", batch_samples, (unsigned long)(batch_max_ns / 1000000));
   return sensor_board;
 }
 
+static uint64_t now_ns() {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+static void flush_imu_batch() {
+  uint32_t len = imu_batch_size(pending_batch.count);
+  void* slot   = shm_ring_claim(&imu_ring);
+  mq_topic_sent(&imu_ring_topic, nullptr != slot);
+  if(slot) {
+    memcpy(slot, &pending_batch, len);
+    shm_ring_publish(&imu_ring, len);
+  } else {
+    printf("IMU ring full, dropped %u samples\n", pending_batch.count);
+  }
+  pending_batch.count = 0;
+}
+
+static void batch_imu_sample(const uint8_t* sample) {
+  if(nullptr == imu_ring.header) {
+    if(shm_ring_open(&imu_ring, IMU_BATCH_RING_PATH, IMU_BATCH_RING_SLOTS, sizeof(imu_batch))) {
+      assert(0);
+    }
+    imu_ring_topic = mq_topic_publish(mq_registry_instance(), IMU_BATCH_RING_PATH, MQ_TOPIC_RING);
+  }
+  if(!mq_topic_wanted(mq_registry_instance(), &imu_ring_topic)) {
+    pending_batch.count = 0;
+    return;
+  }
+
+  uint64_t now = now_ns();
+
+  if(0 == pending_batch.count) {
+    pending_batch.received_ns = now;
+  }
+  // The sample sits unaligned in the parse buffer
+  memcpy(&pending_batch.samples[pending_batch.count++], sample, sizeof(imu_t));
+
+  if(pending_batch.count >= batch_samples || now - pending_batch.received_ns >= batch_max_ns) {
+    flush_imu_batch();
+  }
+}
+
+// Rounded up, so whoever waits this long finds the batch due
+int imu_batch_timeout_ms() {
+  if(0 == pending_batch.count) {
+    return -1;
+  }
+  uint64_t due = pending_batch.received_ns + batch_max_ns;
+  uint64_t now = now_ns();
+  return now >= due ? 0 : (int)((due - now + 999999) / 1000000);
+}
+
+void flush_due_imu_batch() {
+  if(pending_batch.count && now_ns() - pending_batch.received_ns >= batch_max_ns) {
+    flush_imu_batch();
+  }
+}
+
+int serve_sensor_board(tty_handler& board) {
+  int rc = board.tty_read_frame(imu_batch_timeout_ms());
+  if(REQUEST_RESET == rc) {
+    // Whatever the board sent last still goes out
+    if(pending_batch.count) {
+      flush_imu_batch();
+    }
+    return REQUEST_RESET;
+  }
+  if(READ_TIMED_OUT == rc) {
+    flush_due_imu_batch();
+    return 0;
+  }
+  process_sensor_board_tlv(board.get_last_processed_tlv());
+  return 0;
+}
+
 // Returns size of package going to python OR -1 in case of error 
 void process_sensor_board_tlv(processed_tlv tlv) {
   MmwDemo_output_message_tlv* sensor_tlv = reinterpret_cast<MmwDemo_output_message_tlv*> (tlv.buff + sizeof(MmwDemo_output_message_header_t));
@@ -75,20 +188,22 @@ void process_sensor_tlv(processed_tlv tlv_imu, tlv_message_type_e type){
                                                    sizeof(MmwDemo_output_message_tlv_t)
                                                   );
 
-  if(TLV_TYPE_IMU == type){
-    mq_enqueue(mq_path_imu_tracking, sensor_sample, sizeof(imu_t));
-    mq_enqueue(mq_path_imu_display, sensor_sample, sizeof(imu_t));
-  } else {
-    mq_enqueue(mq_path_ui, sensor_sample, sizeof(imu_t));
+  if(sample_sink) {
+    sample_sink(sensor_sample, type);
+    return;
   }
-}
 
-int main() {
-  tty_handler sensor_board = setup_sensor_board();
+  // Registered on the first sample. A topic nobody subscribed to (no one
+  // reads /mq_imu_tracking yet) costs a shared memory load per sample.
+  static mq_publisher imu_tracking(mq_path_imu_tracking);
+  static mq_mailbox   imu_display(mailbox_path_imu_display, sizeof(imu_t));
+  static mq_publisher ui(mq_path_ui);
 
-  while(true){
-    sensor_board.tty_read_frame(); // blocking read
-    auto last_sensor_tlv = sensor_board.get_last_processed_tlv();
-    process_sensor_board_tlv(last_sensor_tlv);
+  if(TLV_TYPE_IMU == type){
+    batch_imu_sample(sensor_sample);
+    imu_tracking.send(sensor_sample, sizeof(imu_t));
+    imu_display.send(sensor_sample, sizeof(imu_t));
+  } else {
+    ui.send(sensor_sample, sizeof(imu_t));
   }
 }
@@ -0,0 +1,12 @@
+#include <memory>
+
+#include "tty.h"
+#include "tlv_processor.h"
+
+int main() {
+  auto sensor_board = setup_sensor_board();
+
+  while(true){
+    serve_sensor_board(*sensor_board); // blocks until a frame or the IMU batch deadline
+  }
+}
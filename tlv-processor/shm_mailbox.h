@@ -0,0 +1,182 @@
+#pragma once
+
+// Latest value channel in POSIX shared memory, for consumers that only
+// care about the freshest sample (IMU display, crosshair, calibrated
+// radar cloud). A single writer overwrites the value under a seqlock: it
+// never blocks and never fails, no matter how far behind the readers are.
+// Readers copy the newest value out and get its sequence number, a gap
+// since the last read is how many values they missed.
+//
+// Plain C so both sides can use it, scope-deepstream (C) and
+// tlv-processor (C++)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shm_region.h"
+
+#define SHM_MAILBOX_MAGIC      (0x534D4258) // "SMBX"
+#define SHM_MAILBOX_VERSION    (1)
+#define SHM_MAILBOX_CACHE_LINE (64)
+// Times a reader yields to a writer in the middle of an update before it
+// gives up, a writer that died there leaves seq odd for good
+#define SHM_MAILBOX_MAX_RETRIES (100)
+
+// seq is odd while the writer is updating the value, it is also the
+// futex word readers sleep on. len is part of the value.
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;             // largest value that fits
+
+  uint32_t seq __attribute__((aligned(SHM_MAILBOX_CACHE_LINE)));
+  uint32_t waiters;
+  uint32_t len;
+} __attribute__((aligned(SHM_MAILBOX_CACHE_LINE))) shm_mailbox_header;
+
+// Per process view of a mailbox, last_seq is what this reader saw last
+typedef struct {
+  shm_mailbox_header* header;
+  uint8_t*            value;
+  size_t              map_size;
+  uint32_t            last_seq;
+} shm_mailbox;
+
+static inline long shm_mailbox_futex(uint32_t* word, int op, uint32_t val, const struct timespec* timeout) {
+  return syscall(SYS_futex, word, op, val, timeout, NULL, 0);
+}
+
+// Writer and readers call this with the same size, whoever comes first
+// creates the mailbox. Returns 0 on success, -1 (after printing why).
+static inline int shm_mailbox_open(shm_mailbox* mailbox, const char* name, uint32_t size) {
+  mailbox->map_size = sizeof(shm_mailbox_header) + size;
+  mailbox->last_seq = 0;
+
+  int created;
+  void* mem = shm_region_open(name, mailbox->map_size, &created);
+  if(!mem) {
+    return -1;
+  }
+  mailbox->header = (shm_mailbox_header*)mem;
+  mailbox->value  = (uint8_t*)mem + sizeof(shm_mailbox_header);
+
+  if(created) {
+    mailbox->header->version = SHM_MAILBOX_VERSION;
+    mailbox->header->size    = size;
+    shm_region_publish(&mailbox->header->magic, SHM_MAILBOX_MAGIC);
+    return 0;
+  }
+
+  if(shm_region_wait(name, &mailbox->header->magic, SHM_MAILBOX_MAGIC) ||
+     SHM_MAILBOX_VERSION != mailbox->header->version || size != mailbox->header->size) {
+    printf("shm mailbox %s has a different version or size, remove /dev/shm%s\n", name, name);
+    munmap(mem, mailbox->map_size);
+    return -1;
+  }
+  return 0;
+}
+
+static inline void shm_mailbox_close(shm_mailbox* mailbox) {
+  if(mailbox->header) {
+    munmap(mailbox->header, mailbox->map_size);
+    mailbox->header = NULL;
+  }
+}
+
+// Writer only, len has to fit the size the mailbox was opened with
+static inline void shm_mailbox_write(shm_mailbox* mailbox, const void* value, uint32_t len) {
+  shm_mailbox_header* header = mailbox->header;
+  uint32_t seq = header->seq;
+
+  // A writer that died mid update left seq odd
+  seq += (seq & 1);
+
+  __atomic_store_n(&header->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  header->len = len;
+  memcpy(mailbox->value, value, len);
+
+  __atomic_store_n(&header->seq, seq + 2, __ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&header->waiters, __ATOMIC_SEQ_CST)) {
+    shm_mailbox_futex(&header->seq, FUTEX_WAKE, INT_MAX, NULL);
+  }
+}
+
+// Copies the newest value (up to out_len bytes) if it is newer than what
+// this reader saw last. Returns the value length, 0 if nothing new. *seq
+// (optional) is the value's sequence number, it counts up by one per write.
+// Also 0 if the writer stays in the middle of an update.
+static inline uint32_t shm_mailbox_read(shm_mailbox* mailbox, void* out, uint32_t out_len, uint32_t* seq) {
+  shm_mailbox_header* header = mailbox->header;
+  uint32_t before, after, len;
+  int retries = 0;
+
+  do {
+    before = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+    if(before == mailbox->last_seq) {
+      return 0;
+    }
+    if(before & 1) {
+      if(++retries > SHM_MAILBOX_MAX_RETRIES) {
+        return 0;
+      }
+      sched_yield();
+      after = before + 1;
+      continue;
+    }
+
+    len = header->len;
+    if(len > header->size) {
+      len = header->size;
+    }
+    memcpy(out, mailbox->value, len < out_len ? len : out_len);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&header->seq, __ATOMIC_RELAXED);
+  } while(before != after);
+
+  mailbox->last_seq = before;
+  if(seq) {
+    *seq = before / 2;
+  }
+  return len < out_len ? len : out_len;
+}
+
+// Same as shm_mailbox_read but waits up to timeout_ms (-1 forever) for a
+// value newer than the last one read. Returns 0 on timeout.
+static inline uint32_t shm_mailbox_wait(shm_mailbox* mailbox, void* out, uint32_t out_len, uint32_t* seq, int timeout_ms) {
+  shm_mailbox_header* header = mailbox->header;
+
+  while(1) {
+    uint32_t len = shm_mailbox_read(mailbox, out, out_len, seq);
+    if(len) {
+      return len;
+    }
+
+    // Sleeps through a write left half done too, until the next writer
+    // finishes one
+    __atomic_fetch_add(&header->waiters, 1, __ATOMIC_SEQ_CST);
+    long rc = 0;
+    uint32_t current = __atomic_load_n(&header->seq, __ATOMIC_SEQ_CST);
+    if(current == mailbox->last_seq || (current & 1)) {
+      struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+      rc = shm_mailbox_futex(&header->seq, FUTEX_WAIT, current, timeout_ms < 0 ? NULL : &timeout);
+    }
+    __atomic_fetch_sub(&header->waiters, 1, __ATOMIC_RELAXED);
+
+    if(-1 == rc && ETIMEDOUT == errno) {
+      return 0;
+    }
+  }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+// Named POSIX shared memory regions, shared by the IPC primitives
+// (shm_ring.h, shm_mailbox.h). Every side opens the region with the same
+// size and whoever comes first creates it. The creator fills in the
+// header and stores its magic last (shm_region_publish), everybody else
+// waits for the magic (shm_region_wait) before touching anything.
+//
+// Plain C so both sides can use it
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// How long an opener waits for whoever created a region to set it up
+#define SHM_REGION_OPEN_WAIT_MS (1000)
+
+// Returns the mapping or NULL (after printing why), *created tells if
+// this call made the region
+static inline void* shm_region_open(const char* name, size_t size, int* created) {
+  *created = 1;
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if(-1 == fd && EEXIST == errno) {
+    *created = 0;
+    fd = shm_open(name, O_RDWR, 0600);
+  }
+  if(-1 == fd) {
+    printf("Failed to open shm %s with errno: %s\n", name, strerror(errno));
+    return NULL;
+  }
+
+  if(*created && ftruncate(fd, size)) {
+    printf("Failed to size shm %s with errno: %s\n", name, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  // The creator might not have sized it yet
+  struct stat st = {0};
+  for(int waited = 0; waited < SHM_REGION_OPEN_WAIT_MS; waited++) {
+    if(0 == fstat(fd, &st) && st.st_size) {
+      break;
+    }
+    usleep(1000);
+  }
+  if((size_t)st.st_size != size) {
+    printf("shm %s has a different size (%ld bytes, expected %zu), remove /dev/shm%s\n",
+      name, (long)st.st_size, size, name);
+    close(fd);
+    return NULL;
+  }
+
+  void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(MAP_FAILED == mem) {
+    printf("Failed to map shm %s with errno: %s\n", name, strerror(errno));
+    return NULL;
+  }
+  return mem;
+}
+
+static inline void shm_region_publish(uint32_t* magic, uint32_t value) {
+  __atomic_store_n(magic, value, __ATOMIC_RELEASE);
+}
+
+// Returns 0 once the creator published value, -1 if it never did
+static inline int shm_region_wait(const char* name, const uint32_t* magic, uint32_t value) {
+  for(int waited = 0; value != __atomic_load_n(magic, __ATOMIC_ACQUIRE); waited++) {
+    if(waited == SHM_REGION_OPEN_WAIT_MS) {
+      printf("shm %s was never initialized\n", name);
+      return -1;
+    }
+    usleep(1000);
+  }
+  return 0;
+}
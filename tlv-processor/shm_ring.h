@@ -0,0 +1,179 @@
+#pragma once
+
+// Single producer / single consumer ring of fixed size slots in POSIX
+// shared memory. The producer fills a slot in place (shm_ring_claim +
+// shm_ring_publish) and the consumer reads it in place (shm_ring_peek +
+// shm_ring_release), nothing is copied on the way between processes.
+// The producer never waits: if the consumer falls behind the ring fills
+// up, new frames are dropped and counted in the header.
+//
+// Plain C so both sides can use it, scope-deepstream (C) and
+// tlv-processor (C++)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shm_region.h"
+
+#define SHM_RING_MAGIC      (0x53524E47) // "SRNG"
+#define SHM_RING_VERSION    (2)
+#define SHM_RING_CACHE_LINE (64)
+#define SHM_RING_ALIGN      (16) // payloads start at least this aligned
+
+// Producer and consumer counters live on their own cache lines, head is
+// also the futex word the consumer sleeps on
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slot_count;       // power of two
+  uint32_t slot_size;        // payload bytes per slot
+
+  uint32_t head __attribute__((aligned(SHM_RING_CACHE_LINE)));  // slots published
+  uint32_t dropped;          // frames thrown away on a full ring
+
+  uint32_t tail __attribute__((aligned(SHM_RING_CACHE_LINE)));  // slots released
+  uint32_t consumer_waiting;
+} __attribute__((aligned(SHM_RING_CACHE_LINE))) shm_ring_header;
+
+// Each slot is this header followed by slot_size bytes of payload, slots
+// are cache line aligned so the payload is SHM_RING_ALIGN aligned
+typedef struct {
+  uint32_t len;
+  uint32_t reserved[3];
+} shm_ring_slot;
+
+// Per process view of a ring
+typedef struct {
+  shm_ring_header* header;
+  uint8_t*         slots;
+  size_t           stride;
+  size_t           map_size;
+} shm_ring;
+
+static inline size_t shm_ring_stride(uint32_t slot_size) {
+  size_t size = sizeof(shm_ring_slot) + slot_size;
+  return (size + SHM_RING_CACHE_LINE - 1) & ~(size_t)(SHM_RING_CACHE_LINE - 1);
+}
+
+static inline shm_ring_slot* shm_ring_slot_at(shm_ring* ring, uint32_t index) {
+  return (shm_ring_slot*)(ring->slots + (index & (ring->header->slot_count - 1)) * ring->stride);
+}
+
+static inline long shm_ring_futex(uint32_t* word, int op, uint32_t val, const struct timespec* timeout) {
+  return syscall(SYS_futex, word, op, val, timeout, NULL, 0);
+}
+
+// Both sides call this with the same geometry, whoever comes first creates
+// the ring. Returns 0 on success, -1 (after printing why) otherwise.
+static inline int shm_ring_open(shm_ring* ring, const char* name, uint32_t slot_count, uint32_t slot_size) {
+  if(0 == slot_count || (slot_count & (slot_count - 1))) {
+    printf("shm ring %s: slot count %u is not a power of two\n", name, slot_count);
+    return -1;
+  }
+
+  ring->stride   = shm_ring_stride(slot_size);
+  ring->map_size = sizeof(shm_ring_header) + slot_count * ring->stride;
+
+  int created;
+  void* mem = shm_region_open(name, ring->map_size, &created);
+  if(!mem) {
+    return -1;
+  }
+  ring->header = (shm_ring_header*)mem;
+  ring->slots  = (uint8_t*)mem + sizeof(shm_ring_header);
+
+  if(created) {
+    ring->header->version    = SHM_RING_VERSION;
+    ring->header->slot_count = slot_count;
+    ring->header->slot_size  = slot_size;
+    shm_region_publish(&ring->header->magic, SHM_RING_MAGIC);
+    return 0;
+  }
+
+  if(shm_region_wait(name, &ring->header->magic, SHM_RING_MAGIC) ||
+     SHM_RING_VERSION != ring->header->version || slot_count != ring->header->slot_count || slot_size != ring->header->slot_size) {
+    printf("shm ring %s has a different version or geometry, remove /dev/shm%s\n", name, name);
+    munmap(mem, ring->map_size);
+    return -1;
+  }
+  return 0;
+}
+
+static inline void shm_ring_close(shm_ring* ring) {
+  if(ring->header) {
+    munmap(ring->header, ring->map_size);
+    ring->header = NULL;
+  }
+}
+
+// Producer: returns the payload of the next free slot, or NULL if the ring
+// is full (the frame is counted as dropped)
+static inline void* shm_ring_claim(shm_ring* ring) {
+  uint32_t head = ring->header->head;
+  uint32_t tail = __atomic_load_n(&ring->header->tail, __ATOMIC_ACQUIRE);
+
+  if(head - tail == ring->header->slot_count) {
+    __atomic_fetch_add(&ring->header->dropped, 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+  return shm_ring_slot_at(ring, head) + 1;
+}
+
+// Producer: hands the claimed slot holding len bytes to the consumer
+static inline void shm_ring_publish(shm_ring* ring, uint32_t len) {
+  uint32_t head = ring->header->head;
+
+  shm_ring_slot_at(ring, head)->len = len;
+  __atomic_store_n(&ring->header->head, head + 1, __ATOMIC_SEQ_CST);
+
+  // Only pay for the syscall if the consumer is (about to be) asleep
+  if(__atomic_load_n(&ring->header->consumer_waiting, __ATOMIC_SEQ_CST)) {
+    shm_ring_futex(&ring->header->head, FUTEX_WAKE, 1, NULL);
+  }
+}
+
+// Consumer: waits up to timeout_ms (-1 forever) for the next frame and
+// returns it in place, NULL on timeout. Valid until shm_ring_release().
+static inline const void* shm_ring_peek(shm_ring* ring, uint32_t* len, int timeout_ms) {
+  uint32_t tail = ring->header->tail;
+
+  while(tail == __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE)) {
+    __atomic_store_n(&ring->header->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+
+    long rc = 0;
+    if(tail == __atomic_load_n(&ring->header->head, __ATOMIC_SEQ_CST)) {
+      struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+      rc = shm_ring_futex(&ring->header->head, FUTEX_WAIT, tail, timeout_ms < 0 ? NULL : &timeout);
+    }
+    __atomic_store_n(&ring->header->consumer_waiting, 0, __ATOMIC_RELAXED);
+
+    if(-1 == rc && ETIMEDOUT == errno) {
+      return NULL;
+    }
+  }
+
+  shm_ring_slot* slot = shm_ring_slot_at(ring, tail);
+  *len = slot->len;
+  return slot + 1;
+}
+
+// Consumer: done with the frame returned by shm_ring_peek()
+static inline void shm_ring_release(shm_ring* ring) {
+  __atomic_store_n(&ring->header->tail, ring->header->tail + 1, __ATOMIC_RELEASE);
+}
+
+// Consumer: forget about frames published before we attached
+static inline void shm_ring_skip_to_latest(shm_ring* ring) {
+  __atomic_store_n(&ring->header->tail, __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+static inline uint32_t shm_ring_dropped(shm_ring* ring) {
+  return __atomic_load_n(&ring->header->dropped, __ATOMIC_RELAXED);
+}
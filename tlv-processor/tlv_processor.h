@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+
+#include "tty.h"
+#include "radar_tlv.h"
+#include "sensor_board_tlv.h"
+
+// Entry points shared by the stand alone radar/sensor programs, tlvd,
+// which serves both from a single event loop, and libtlvproc (tlvproc.h)
+
+// In process mode the parsed frames go to a sink instead of the IPC topics
+typedef void (*radar_cloud_sink)(const PointCloudWire*);
+typedef void (*sensor_sample_sink)(const uint8_t*, tlv_message_type_e);
+
+// radar.cpp
+std::unique_ptr<tty_handler> setup_radar();
+int  process_radar_tlv(processed_tlv);
+void enque_to_python_radar(int);
+void handle_radar_frame(processed_tlv);
+void set_radar_cloud_sink(radar_cloud_sink);
+
+// sensor.cpp
+std::unique_ptr<tty_handler> setup_sensor_board();
+void process_sensor_board_tlv(processed_tlv);
+void set_sensor_sample_sink(sensor_sample_sink);
+void set_imu_batch(uint32_t samples, uint32_t max_latency_ms);
+// A partly filled IMU batch is sent once its first sample is
+// max_latency_ms old, whether or not more samples come in. Milliseconds
+// until that, -1 if nothing is pending.
+int  imu_batch_timeout_ms();
+void flush_due_imu_batch();
+// Handles the next frame from the sensor board, or sends the pending IMU
+// batch if it comes due first. REQUEST_RESET if the board has to be
+// reopened.
+int  serve_sensor_board(tty_handler&);
+
+// tlvproc.cpp, serves the radar and the sensor board, never returns
+void serve_radar_and_sensor_board();
@@ -0,0 +1,198 @@
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include <vector>
+#include <random>
+
+#include "tlv_synth.h"
+
+using std::vector;
+
+#define SYNTH_PLATFORM         (0xA6843)
+#define SYNTH_VERSION          (0x03050004)
+#define SYNTH_CPU_CLOCK_HZ     (200000000)
+#define SYNTH_PACKET_ALIGNMENT (32)  // the demo pads every frame to 32 bytes
+#define SYNTH_MAX_RANGE        (50.0f)
+#define SYNTH_FOV              (1.0f) // +- radians
+
+synth_config synth_default_config() {
+  synth_config cfg;
+  cfg.frame_period_s    = 0.1;
+  cfg.points            = 64;
+  cfg.noise_points      = 16;
+  cfg.target_range      = 20.0f;
+  cfg.target_velocity   = -1.5f;
+  cfg.target_sweep_rate = 0.2f;
+  cfg.tracked_targets   = 0;
+  cfg.corrupt_pct       = 0;
+  cfg.seed              = 1;
+  return cfg;
+}
+
+tlv_synth::tlv_synth(const synth_config& config) : cfg(config), rng(config.seed) {
+}
+
+template<typename T>
+static void append(vector<uint8_t>& out, const T& value) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+static void append_tlv_header(vector<uint8_t>& out, uint32_t type, uint32_t length) {
+  MmwDemo_output_message_tlv tlv;
+  tlv.type   = type;
+  tlv.length = length;
+  append(out, tlv);
+}
+
+static void append_header(vector<uint8_t>& out, uint32_t frame_number, uint32_t cpu_cycles, uint32_t points, uint32_t num_tlvs) {
+  MmwDemo_output_message_header header = {0};
+  header.magicWord[0]   = 0x0102;
+  header.magicWord[1]   = 0x0304;
+  header.magicWord[2]   = 0x0506;
+  header.magicWord[3]   = 0x0708;
+  header.version        = SYNTH_VERSION;
+  header.platform       = SYNTH_PLATFORM;
+  header.frameNumber    = frame_number;
+  header.timeCpuCycles  = cpu_cycles;
+  header.numDetectedObj = points;
+  header.numTLVs        = num_tlvs;
+  append(out, header);
+}
+
+static void finish_frame(vector<uint8_t>& out, size_t frame_start) {
+  while((out.size() - frame_start) % SYNTH_PACKET_ALIGNMENT) {
+    out.push_back(0x0F);
+  }
+  uint32_t total_len = out.size() - frame_start;
+  memcpy(&out[frame_start] + offsetof(MmwDemo_output_message_header, totalPacketLen), &total_len, sizeof(total_len));
+}
+
+void tlv_synth::append_imu_frame(vector<uint8_t>& out) {
+  size_t frame_start = out.size();
+
+  append_header(out, frame_number, frame_number * (32768 / 800), 0, 1);
+  append_tlv_header(out, TLV_TYPE_IMU, sizeof(imu_t));
+
+  imu_t sample;
+  sample.a_x = uniform(-0.2f, 0.2f);
+  sample.a_y = uniform(-0.2f, 0.2f);
+  sample.a_z = 9.81f + uniform(-0.2f, 0.2f);
+  sample.r_p = uniform(-0.01f, 0.01f);
+  sample.r_r = uniform(-0.01f, 0.01f);
+  sample.r_y = uniform(-0.01f, 0.01f);
+  sample.cpu_cycles_since_boot = frame_number * (32768 / 800);
+  append(out, sample);
+
+  finish_frame(out, frame_start);
+  frame_number++;
+}
+
+synth_corruption_e tlv_synth::append_frame(vector<uint8_t>& out) {
+  size_t frame_start = out.size();
+  double t           = frame_number * cfg.frame_period_s;
+  int    targets     = cfg.tracked_targets;
+  int    num_tlvs    = 2 + (targets ? 3 : 0);
+
+  // Target walks towards/away from us and sweeps back and forth across the FOV
+  float range = fmodf(cfg.target_range + cfg.target_velocity * t, SYNTH_MAX_RANGE);
+  if(range < 1.0f) {
+    range += SYNTH_MAX_RANGE - 1.0f;
+  }
+  float azimuth = SYNTH_FOV * sinf(cfg.target_sweep_rate * t);
+
+  // Wraps every ~21s like the radar's cycle counter
+  append_header(out, frame_number, (uint32_t)(uint64_t)(t * SYNTH_CPU_CLOCK_HZ), cfg.points, num_tlvs);
+
+  // Angles go out in radians, that's what the smartscope side expects
+  append_tlv_header(out, MMWDEMO_OUTPUT_MSG_SPHERICAL_POINTS, cfg.points * sizeof(DPIF_PointCloudSpherical));
+  for(int i = 0; i < cfg.points; i++) {
+    DPIF_PointCloudSpherical point;
+    if(i < cfg.noise_points) {
+      point.range        = uniform(0.5f, SYNTH_MAX_RANGE);
+      point.azimuthAngle = uniform(-SYNTH_FOV, SYNTH_FOV);
+      point.elevAngle    = uniform(-0.3f, 0.3f);
+      point.velocity     = uniform(-0.2f, 0.2f);
+    } else {
+      point.range        = range + uniform(-0.3f, 0.3f);
+      point.azimuthAngle = azimuth + uniform(-0.02f, 0.02f);
+      point.elevAngle    = uniform(-0.05f, 0.05f);
+      point.velocity     = cfg.target_velocity + uniform(-0.1f, 0.1f);
+    }
+    append(out, point);
+  }
+
+  append_tlv_header(out, MMWDEMO_OUTPUT_MSG_DETECTED_POINTS_SIDE_INFO, cfg.points * sizeof(DPIF_PointCloudSideInfo));
+  for(int i = 0; i < cfg.points; i++) {
+    DPIF_PointCloudSideInfo side;
+    side.snr   = (i < cfg.noise_points) ? 40 + rng() % 40 : 150 + rng() % 100;
+    side.noise = 20 + rng() % 10;
+    append(out, side);
+  }
+
+  if(targets) {
+    append_tlv_header(out, MMWDEMO_OUTPUT_MSG_TRACKERPROC_3D_TARGET_LIST, targets * sizeof(DPIF_TrackerTarget3D));
+    for(int i = 0; i < targets; i++) {
+      DPIF_TrackerTarget3D target = {0};
+      target.tid             = i;
+      target.posX            = range * sinf(azimuth) + i;
+      target.posY            = range * cosf(azimuth);
+      target.velY            = cfg.target_velocity;
+      target.confidenceLevel = 1.0f;
+      append(out, target);
+    }
+
+    append_tlv_header(out, MMWDEMO_OUTPUT_MSG_TRACKERPROC_TARGET_INDEX, cfg.points * sizeof(DPIF_TrackerTargetIndex));
+    for(int i = 0; i < cfg.points; i++) {
+      DPIF_TrackerTargetIndex index = (i < cfg.noise_points) ? TRACKER_INDEX_NOT_ASSOCIATED : i % targets;
+      append(out, index);
+    }
+
+    append_tlv_header(out, MMWDEMO_OUTPUT_MSG_TRACKERPROC_TARGET_HEIGHT, targets * sizeof(DPIF_TrackerTargetHeight));
+    for(int i = 0; i < targets; i++) {
+      DPIF_TrackerTargetHeight height = {(uint32_t)i, 1.8f, 0.0f};
+      append(out, height);
+    }
+  }
+
+  finish_frame(out, frame_start);
+  frame_number++;
+
+  synth_corruption_e corruption = CORRUPT_NONE;
+  if(cfg.corrupt_pct > 0 && uniform(0, 100) < cfg.corrupt_pct) {
+    corruption = static_cast<synth_corruption_e>(1 + rng() % (CORRUPT_MAX - 1));
+    corrupt(out, frame_start, corruption);
+  }
+  return corruption;
+}
+
+void tlv_synth::corrupt(vector<uint8_t>& out, size_t frame_start, synth_corruption_e how) {
+  size_t frame_len = out.size() - frame_start;
+
+  switch(how) {
+    case CORRUPT_FLIP_BYTES:
+      for(int i = 0; i < 4; i++) {
+        out[frame_start + rng() % frame_len] ^= 1 << (rng() % 8);
+      }
+      break;
+    case CORRUPT_TRUNCATE:
+      out.resize(frame_start + rng() % frame_len);
+      break;
+    case CORRUPT_GARBAGE: {
+      vector<uint8_t> garbage(1 + rng() % 512);
+      for(auto& byte : garbage) {
+        byte = rng();
+      }
+      out.insert(out.begin() + frame_start, garbage.begin(), garbage.end());
+      break;
+    }
+    case CORRUPT_BAD_LENGTH: {
+      uint32_t bad_len = MAX_TLV_SIZE + 1 + rng() % 1024;
+      memcpy(&out[frame_start] + offsetof(MmwDemo_output_message_header, totalPacketLen), &bad_len, sizeof(bad_len));
+      break;
+    }
+    default:
+      break;
+  }
+}
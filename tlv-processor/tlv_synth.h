@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+#include <random>
+
+#include "tty.h"
+#include "radar_tlv.h"
+#include "sensor_board_tlv.h"
+
+// Builds byte exact IWR68xx output frames for load testing the parser
+// without a radar attached. Used by tlvgen and the benchmarks.
+
+typedef struct {
+  double   frame_period_s;     // frame period the timeCpuCycles field is based on
+  int      points;             // points per frame, may go past MAX_CLOUD_POINTS
+  int      noise_points;       // of those, how many are scattered clutter
+  float    target_range;       // starting range of the simulated target (m)
+  float    target_velocity;    // radial velocity of the target (m/s)
+  float    target_sweep_rate;  // how fast the target crosses the FOV (rad/s)
+  int      tracked_targets;    // > 0 adds the tracker TLVs (1010, 1011, 1012)
+  double   corrupt_pct;        // % of frames that get corrupted in some way
+  uint32_t seed;
+} synth_config;
+
+typedef enum {
+  CORRUPT_NONE,
+  CORRUPT_FLIP_BYTES,     // random bit flips inside the frame
+  CORRUPT_TRUNCATE,       // frame gets cut short (lost USB packet)
+  CORRUPT_GARBAGE,        // noise in front of the frame
+  CORRUPT_BAD_LENGTH,     // impossible totalPacketLen
+  CORRUPT_MAX
+} synth_corruption_e;
+
+synth_config synth_default_config();
+
+class tlv_synth {
+ private:
+  synth_config cfg;
+  uint32_t     frame_number{0};
+  std::mt19937 rng;
+
+  float uniform(float lo, float hi) { return std::uniform_real_distribution<float>(lo, hi)(rng); }
+  void  corrupt(std::vector<uint8_t>& out, size_t frame_start, synth_corruption_e);
+
+ public:
+  explicit tlv_synth(const synth_config& config);
+
+  // Appends the next frame (possibly corrupted) to out, returns how
+  // it was corrupted
+  synth_corruption_e append_frame(std::vector<uint8_t>& out);
+
+  // Appends a sensor board frame (same framing as the radar) holding
+  // a single IMU sample
+  void append_imu_frame(std::vector<uint8_t>& out);
+
+  uint32_t frames_built() { return frame_number; }
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "tty.h"
+
+// Walks every TLV of a frame and dispatches it by type to a handler picked
+// at compile time:
+//
+//   using registry = tlv_registry<
+//     tlv_handler<MMWDEMO_OUTPUT_MSG_SPHERICAL_POINTS, DPIF_PointCloudSpherical, on_points>,
+//     tlv_handler<MMWDEMO_OUTPUT_MSG_STATS, MmwDemo_output_message_stats, on_stats>>;
+//
+//   walk_tlvs<registry>(frame);
+//
+// All the length checks live here, handlers get a typed view of their
+// payload that is guaranteed to be inside the frame.
+
+// Payload of a single TLV seen as an array of T
+template<typename T>
+struct tlv_payload {
+  uint32_t type;
+  const T* items;
+  size_t   count;
+};
+
+template<uint32_t Type, typename Payload, void (*Handler)(const MmwDemo_output_message_header&, tlv_payload<Payload>)>
+struct tlv_handler {
+  static constexpr uint32_t type = Type;
+
+  static void dispatch(const MmwDemo_output_message_header& header, const uint8_t* payload, uint32_t length) {
+    if(length % sizeof(Payload)) {
+      printf("TLV %u: length %u is not a multiple of %zu, dropping it\n", Type, length, sizeof(Payload));
+      return;
+    }
+    Handler(header, tlv_payload<Payload>{Type, reinterpret_cast<const Payload*>(payload), length / sizeof(Payload)});
+  }
+};
+
+template<typename... Handlers>
+struct tlv_registry {
+  // Returns false if no handler is registered for type
+  static bool dispatch(uint32_t type, const MmwDemo_output_message_header& header, const uint8_t* payload, uint32_t length) {
+    return ((type == Handlers::type ? (Handlers::dispatch(header, payload, length), true) : false) || ...);
+  }
+};
+
+// Returns the number of TLVs walked, or -1 if the frame is malformed (TLVs
+// handled before the bad one have already been dispatched)
+template<typename Registry>
+int walk_tlvs(processed_tlv frame) {
+  if(frame.len < sizeof(MmwDemo_output_message_header)) {
+    return -1;
+  }
+
+  const MmwDemo_output_message_header& header = *reinterpret_cast<const MmwDemo_output_message_header*>(frame.buff);
+  size_t offset = sizeof(MmwDemo_output_message_header);
+
+  for(uint32_t i = 0; i < header.numTLVs; i++) {
+    if(offset + sizeof(MmwDemo_output_message_tlv) > frame.len) {
+      printf("Frame %u: TLV %u of %u starts past the end of the frame\n", header.frameNumber, i, header.numTLVs);
+      return -1;
+    }
+    const MmwDemo_output_message_tlv& tlv = *reinterpret_cast<const MmwDemo_output_message_tlv*>(frame.buff + offset);
+    offset += sizeof(MmwDemo_output_message_tlv);
+
+    if(tlv.length > frame.len - offset) {
+      printf("Frame %u: TLV %u (type %u) runs past the end of the frame\n", header.frameNumber, i, tlv.type);
+      return -1;
+    }
+    Registry::dispatch(tlv.type, header, frame.buff + offset, tlv.length);
+    offset += tlv.length;
+  }
+  return header.numTLVs;
+}
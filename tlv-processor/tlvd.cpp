@@ -0,0 +1,7 @@
+#include "tlv_processor.h"
+
+// Serves the radar (data + cfg port) and the sensor board from a single
+// thread, replaces running the radar and sensor programs side by side
+int main() {
+  serve_radar_and_sensor_board();
+}
@@ -0,0 +1,214 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "capture.h"
+#include "pty.h"
+#include "tlv_synth.h"
+
+// Generates a synthetic IWR68xx stream, either live through a pty (the
+// radar program reads it like the real data port) or into a capture file
+// that replay can play back later:
+//
+//   $ ./tlvgen -c -r 50 -p 400       # 5x the real frame rate, 400 points
+//   RADAR_DATA_PORT=/dev/pts/3
+//   RADAR_CFG_PORT=/dev/pts/4
+//   $ RADAR_DATA_PORT=/dev/pts/3 RADAR_CFG_PORT=/dev/pts/4 ./radar
+//
+// In pty mode the pty is non-blocking, like a real UART a frame gets
+// dropped if the reader can't keep up. Those drops are reported.
+
+using std::string;
+using std::vector;
+
+static void usage() {
+  puts("usage: tlvgen [options]");
+  puts("  -r fps     frame rate (default 10, the radar cfgs run at 10)");
+  puts("  -p points  points per frame (default 64)");
+  puts("  -N points  of those, clutter points (default 16)");
+  puts("  -R m       initial target range (default 20)");
+  puts("  -v m/s     target radial velocity (default -1.5)");
+  puts("  -w rad/s   target sweep rate across the FOV (default 0.2)");
+  puts("  -t count   tracked targets, adds TLVs 1010-1012 (default 0)");
+  puts("  -x pct     corrupt pct% of frames (default 0)");
+  puts("  -n frames  stop after this many frames (default: run forever)");
+  puts("  -s seed    random seed");
+  puts("  -o file    write a capture file instead of streaming to a pty");
+  puts("  -c         also emulate the radar CLI port");
+  exit(1);
+}
+
+static uint64_t now_ns() {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline) {
+  struct timespec tp;
+  tp.tv_sec  = deadline / 1000000000ULL;
+  tp.tv_nsec = deadline % 1000000000ULL;
+  while(EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL));
+}
+
+static void write_capture(const char* path, tlv_synth& synth, double fps, long frames) {
+  FILE* fp = fopen(path, "w");
+  if(!fp) {
+    printf("Failed to open %s with errno: %s\n", path, strerror(errno));
+    exit(1);
+  }
+
+  capture_file_header header = {0};
+  strncpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+  header.version = CAPTURE_VERSION;
+  header.source  = CAPTURE_SOURCE_RADAR;
+  fwrite(&header, sizeof(header), 1, fp);
+
+  vector<uint8_t> frame;
+  for(long i = 0; i < frames; i++) {
+    frame.clear();
+    synth.append_frame(frame);
+
+    capture_record_header record;
+    record.monotonic_ns = (uint64_t)(i * 1e9 / fps);
+    record.len          = frame.size();
+    fwrite(&record, sizeof(record), 1, fp);
+    fwrite(frame.data(), 1, frame.size(), fp);
+  }
+  fclose(fp);
+  printf("Wrote %ld frames to %s\n", frames, path);
+}
+
+// Returns false if the pty was full and the frame got dropped
+static bool write_frame(int fd, const vector<uint8_t>& frame) {
+  int rc = write(fd, frame.data(), frame.size());
+  if(rc < 0) {
+    if(EAGAIN == errno) {
+      return false;
+    }
+    printf("Failed to write to pty with errno: %s\n", strerror(errno));
+    exit(1);
+  }
+
+  // Started the frame, finish it or the stream gets out of sync
+  size_t written = rc;
+  while(written < frame.size()) {
+    struct pollfd pfd = {fd, POLLOUT, 0};
+    poll(&pfd, 1, -1);
+    rc = write(fd, frame.data() + written, frame.size() - written);
+    if(rc > 0) {
+      written += rc;
+    }
+  }
+  return true;
+}
+
+static void stream_pty(tlv_synth& synth, double fps, long frames, bool fake_cli) {
+  string data_path;
+  int data_fd = open_pty(data_path);
+  fcntl(data_fd, F_SETFL, fcntl(data_fd, F_GETFL) | O_NONBLOCK);
+  int watch_fd = watch_pty_open(data_path);
+  printf("RADAR_DATA_PORT=%s\n", data_path.c_str());
+
+  std::atomic<bool> sensor_started{!fake_cli};
+  if(fake_cli) {
+    string cfg_path;
+    int cfg_fd = open_pty(cfg_path);
+    printf("RADAR_CFG_PORT=%s\n", cfg_path.c_str());
+    std::thread(serve_fake_cli, cfg_fd, &sensor_started).detach();
+  }
+  fflush(stdout);
+
+  wait_for_pty_open(watch_fd, data_path);
+  while(!sensor_started) {
+    usleep(1000);
+  }
+  puts("Reader attached, streaming");
+
+  uint64_t period      = 1e9 / fps;
+  uint64_t start       = now_ns();
+  uint64_t last_report = start;
+  long     sent = 0, dropped = 0, corrupted = 0, late = 0;
+  size_t   bytes = 0;
+  vector<uint8_t> frame;
+
+  for(long i = 0; frames <= 0 || i < frames; i++) {
+    uint64_t deadline = start + i * period;
+    sleep_until_ns(deadline);
+    if(now_ns() > deadline + period) {
+      late++;
+    }
+
+    frame.clear();
+    if(CORRUPT_NONE != synth.append_frame(frame)) {
+      corrupted++;
+    }
+    if(write_frame(data_fd, frame)) {
+      sent++;
+      bytes += frame.size();
+    } else {
+      dropped++;
+    }
+
+    uint64_t now = now_ns();
+    if(now - last_report >= 1000000000ULL) {
+      double elapsed = (now - start) / 1e9;
+      printf("frames sent %ld (%.1f fps, %.2f MB/s) dropped %ld corrupted %ld late %ld\n", sent, sent / elapsed,
+             bytes / elapsed / (1024 * 1024), dropped, corrupted, late);
+      fflush(stdout);
+      last_report = now;
+    }
+  }
+
+  printf("Done: frames sent %ld dropped %ld corrupted %ld late %ld\n", sent, dropped, corrupted, late);
+  sleep(1);
+  close(data_fd);
+}
+
+int main(int argc, char** argv) {
+  synth_config cfg = synth_default_config();
+  double fps       = 10;
+  long   frames    = 0;
+  bool   fake_cli  = false;
+  char*  out_path  = NULL;
+  int    opt;
+
+  while((opt = getopt(argc, argv, "r:p:N:R:v:w:t:x:n:s:o:c")) != -1) {
+    switch(opt) {
+      case 'r': fps                   = atof(optarg); break;
+      case 'p': cfg.points            = atoi(optarg); break;
+      case 'N': cfg.noise_points      = atoi(optarg); break;
+      case 'R': cfg.target_range      = atof(optarg); break;
+      case 'v': cfg.target_velocity   = atof(optarg); break;
+      case 'w': cfg.target_sweep_rate = atof(optarg); break;
+      case 't': cfg.tracked_targets   = atoi(optarg); break;
+      case 'x': cfg.corrupt_pct       = atof(optarg); break;
+      case 'n': frames                = atol(optarg); break;
+      case 's': cfg.seed              = atoi(optarg); break;
+      case 'o': out_path              = optarg;       break;
+      case 'c': fake_cli              = true;         break;
+      default:  usage();
+    }
+  }
+  if(fps <= 0 || cfg.points < 0 || cfg.noise_points > cfg.points) {
+    usage();
+  }
+  cfg.frame_period_s = 1.0 / fps;
+
+  tlv_synth synth(cfg);
+  if(out_path) {
+    write_capture(out_path, synth, fps, frames > 0 ? frames : 1000);
+  } else {
+    stream_pty(synth, fps, frames, fake_cli);
+  }
+}
@@ -0,0 +1,106 @@
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+#include <memory>
+#include <thread>
+#include <system_error>
+#include <cassert>
+
+#include "tty.h"
+#include "event_loop.h"
+#include "tlv_processor.h"
+#include "radar_recovery.h"
+#include "tlvproc.h"
+
+// The radar walks its recovery ladder (which can take forever, an
+// unplugged radar) on a thread of its own, the sensor board and the IMU
+// batch deadline are served meanwhile. The recovered handler is handed
+// back to the loop through an eventfd.
+class radar_recovery_thread {
+ private:
+  int wakeup_fd;
+  std::thread thread;
+  std::unique_ptr<tty_handler> recovered;
+
+ public:
+  radar_recovery_thread() {
+    wakeup_fd = eventfd(0, EFD_CLOEXEC);
+    if(-1 == wakeup_fd) {
+      printf("eventfd failed with errno: %s\n", strerror(errno));
+      assert(0);
+    }
+  }
+
+  int get_wakeup_fd() const { return wakeup_fd; }
+
+  void start(std::unique_ptr<tty_handler> radar) {
+    thread = std::thread([this](std::unique_ptr<tty_handler> failed) {
+      recovered    = recover_radar(std::move(failed));
+      uint64_t one = 1;
+      if(sizeof(one) != write(wakeup_fd, &one, sizeof(one))) {
+        printf("Failed to wake up the event loop with errno: %s\n", strerror(errno));
+      }
+    }, std::move(radar));
+  }
+
+  // Once get_wakeup_fd() is readable
+  std::unique_ptr<tty_handler> finish() {
+    uint64_t count;
+    read(wakeup_fd, &count, sizeof(count));
+    thread.join();
+    return std::move(recovered);
+  }
+};
+
+void serve_radar_and_sensor_board() {
+  tty_event_loop loop;
+  radar_recovery_thread recovery;
+
+  auto sensor_board = setup_sensor_board();
+  auto radar        = setup_radar();
+
+  loop.add_device("sensor board", *sensor_board, process_sensor_board_tlv);
+  // A partly filled IMU batch goes out on time, even if the board goes quiet
+  loop.add_deadline(imu_batch_timeout_ms, flush_due_imu_batch);
+  loop.add_wakeup("radar recovery", recovery.get_wakeup_fd(), [&]() {
+    radar = recovery.finish();
+    handle_radar_frame(radar->get_last_processed_tlv());
+    loop.add_device("radar", *radar, handle_radar_frame);
+  });
+
+  if(radar->tty_cfg_applied()) {
+    loop.add_device("radar", *radar, handle_radar_frame);
+  } else {
+    recovery.start(std::move(radar));
+  }
+
+  while(true) {
+    tty_handler* failed = loop.run();
+    loop.remove_device(*failed);
+
+    if(failed == sensor_board.get()) {
+      puts("Sensor board stopped responding, reopening it");
+      sensor_board.reset();
+      sensor_board = setup_sensor_board();
+      loop.add_device("sensor board", *sensor_board, process_sensor_board_tlv);
+      continue;
+    }
+
+    recovery.start(std::move(radar));
+  }
+}
+
+int tlvproc_start(const tlvproc_callbacks* callbacks) {
+  set_radar_cloud_sink(callbacks->on_radar_cloud);
+  set_sensor_sample_sink(callbacks->on_sensor_sample);
+
+  try {
+    std::thread(serve_radar_and_sensor_board).detach();
+  } catch(const std::system_error& e) {
+    printf("Failed to start the tlv-processor thread: %s\n", e.what());
+    return -1;
+  }
+  return 0;
+}
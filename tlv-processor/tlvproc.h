@@ -0,0 +1,33 @@
+#pragma once
+
+// tlv-processor as a library (libtlvproc.a) for running the radar and
+// sensor board parsers as a thread inside smartscope, instead of as the
+// radar and sensor programs. Frames are handed to the callbacks on the
+// parser thread straight from the parse buffer, nothing goes through
+// shared memory or a message queue on the way.
+//
+// Plain C interface, smartscope is C
+
+#include <stdint.h>
+
+#include "radar_tlv.h"
+#include "sensor_board_tlv.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Both run on the parser thread, the data is only valid during the call
+typedef struct {
+  void (*on_radar_cloud)(const PointCloudWire* cloud);
+  void (*on_sensor_sample)(const uint8_t* sample, tlv_message_type_e type);
+} tlvproc_callbacks;
+
+// Opens the radar and sensor board (same env vars as the programs) and
+// serves them from a new thread, like tlvd. Returns 0, or -1 if the
+// thread couldn't be started.
+int tlvproc_start(const tlvproc_callbacks* callbacks);
+
+#ifdef __cplusplus
+}
+#endif
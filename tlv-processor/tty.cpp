@@ -4,16 +4,22 @@
 #include <termios.h>
 #include <stdint.h>
 #include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <math.h>
 
 #include <iostream>
 #include <string>
 #include <vector>
 #include <cassert>
 #include <tuple>
-#include <regex>
+#include <map>
+#include <mutex>
 
 #include "tty.h"
 #include "radar_tlv.h"
+#include "magic_scan.h"
 
 using std::cout;
 using std::endl;
@@ -22,9 +28,10 @@ using std::string;
 using std::tuple;
 using std::make_tuple;
 using std::get;
-using std::regex;
 using std::fstream;
 
+#define READ_BUFF_SIZE  (250)
+
 tty_handler::tty_handler(vector<tuple<string, string, speed_t, string, int>>& port_configs) {
   if(0 == port_configs.size()) {
     printf("Incorrect number of ports specified\n");
@@ -113,26 +120,95 @@ void tty_handler::apply_cfg() {
     }
 
     auto list_of_configs = read_cfg(cfg_file);
+    uint64_t fingerprint = cfg_fingerprint(list_of_configs);
 
-    for(const auto& cfg_cmd : list_of_configs) {
-      tty_send_cfg(cfg_cmd);
+    // frameCfg <chirp start> <chirp end> <loops> <frames> <period ms> ...
+    float period = 0;
+    for(auto& cmd : list_of_configs) {
+      if(1 == sscanf(cmd.c_str(), "frameCfg %*d %*d %*d %*d %f", &period)) {
+        set_frame_period_ms(period);
+      }
+    }
 
-      if(false == tty_check_done()) { 
-        printf("Did not receive 'Done' when sending: %s\n", cfg_cmd.c_str());
-        assert(0);
+    // Radar is still running the same profile, restarting it is enough.
+    // If it lost its config (power cycle...) sensorStart errors out and
+    // we fall back to sending everything.
+    if(cfg_cache_matches(fingerprint)) {
+      if(tty_restart_sensor()) {
+        puts("Radar already runs this cfg, restarted it");
+        iter++;
+        continue;
       }
+      puts("Radar lost its cfg, sending all of it");
+      cfg_cache_invalidate();
     }
+
+    if(false == tty_send_cfg_pipelined(list_of_configs)) {
+      // Left to the caller, the radar program walks its recovery ladder
+      cfg_applied = false;
+      return;
+    }
+    cfg_cache_store(fingerprint);
     iter++; 
   } 
 }
 
-void tty_handler::tty_send_cfg(const string& cfg) {
+// Keeps up to CFG_PIPELINE_DEPTH commands in flight. sensorStop/sensorStart
+// and flushCfg change the state of the whole radar, they go out on their
+// own once everything before them got acked.
+bool tty_handler::tty_send_cfg_pipelined(const vector<string>& cmds) {
+  vector<double> sent_at(cmds.size());
+  size_t next_to_send = 0;
+  size_t next_to_ack  = 0;
+  double start        = tty_now_ms();
+
+  // Throw away whatever the CLI printed before we got here
+  tcflush(cfg_port_fd, TCIFLUSH);
+  cli.reset();
+
+  while(next_to_ack < cmds.size()) {
+    while(next_to_send < cmds.size() && next_to_send - next_to_ack < CFG_PIPELINE_DEPTH) {
+      bool barrier = (0 == cmds[next_to_send].compare(0, 6, "sensor") || 0 == cmds[next_to_send].compare(0, 8, "flushCfg"));
+      if(barrier && next_to_send != next_to_ack) {
+        break;
+      }
+      if(false == tty_send_cfg(cmds[next_to_send])) {
+        return false;
+      }
+      sent_at[next_to_send] = tty_now_ms();
+      next_to_send++;
+      if(barrier) {
+        break;
+      }
+    }
+
+    cli_ack_e ack;
+    if(false == tty_wait_ack(ack)) {
+      printf("Did not receive 'Done' when sending: %s\n", cmds[next_to_ack].c_str());
+      return false;
+    }
+    if(CLI_ACK_ERROR == ack) {
+      printf("Radar rejected: %s\n", cmds[next_to_ack].c_str());
+      return false;
+    }
+    printf("Acked in %6.1f ms: %s\n", tty_now_ms() - sent_at[next_to_ack], cmds[next_to_ack].c_str());
+    next_to_ack++;
+  }
+
+  printf("**** Radar configured with %zu commands in %.1f ms ****\n", cmds.size(), tty_now_ms() - start);
+  // The radar just (re)started chirping, the stall deadline runs from here
+  last_frame_ms = tty_now_ms();
+  return true;
+}
+
+bool tty_handler::tty_send_cfg(const string& cfg) {
   printf("Applying CLI CMD: %s\n", cfg.c_str());
   int rc = write(cfg_port_fd, cfg.c_str(), cfg.size());
   if(rc != cfg.size()) {
 	  printf("Failed to write to cfg port with errno = %s\n", strerror(errno));
-    assert(0);
+    return false;
   }
+  return true;
 }
 
 void process_ui_tlv(uint8_t* data, size_t size) {
@@ -140,33 +216,35 @@ void process_ui_tlv(uint8_t* data, size_t size) {
   cout << "UI event : " << *message << endl;
 }
 
-// Read the terminal, looks for "Done" which 
-// Is what the 3.6 version of the mmWave demo 
-// outputs once it has been configured.
-bool tty_handler::tty_check_done() {
-#define CHECK_FOR_DONE_RETRY_COUNT (5)
-#define READ_BUFF_SIZE  (250)
+// Waits for the next "Done"/"Error" the CLI prints, "Done" is what
+// the 3.6 version of the mmWave demo outputs once a command is applied.
+bool tty_handler::tty_wait_ack(cli_ack_e& ack) {
+  char read_buff[READ_BUFF_SIZE];
+  double deadline = tty_now_ms() + CFG_ACK_TIMEOUT_MS;
 
-  char read_buff[READ_BUFF_SIZE + 1] = { 0 };
-  size_t index = 0;
- 
-  for(int i = 0; i < CHECK_FOR_DONE_RETRY_COUNT; i++) {
-    int rc = read(cfg_port_fd, &read_buff[index], READ_BUFF_SIZE - index);
+  while(false == cli.pop(ack)) {
+    int timeout = deadline - tty_now_ms();
+    if(timeout <= 0) {
+      return false;
+    }
 
-    if (rc < 0) {
-      printf("Failed to read cfg with read error: %s\n", strerror(errno));
-      assert(0);
-    } else if (rc > 0) {
-      string read_so_far { read_buff };
-      regex rx { "Done" };
+    struct pollfd pfd = {cfg_port_fd, POLLIN, 0};
+    int rc = poll(&pfd, 1, timeout);
+    if(rc < 0 && EINTR != errno) {
+      printf("Failed to poll cfg port with error: %s\n", strerror(errno));
+      return false;
+    } else if(rc <= 0) {
+      continue;
+    }
 
-      if (regex_search(read_so_far, rx)) {
-        return true;
-      }
-      index += rc;
+    rc = read(cfg_port_fd, read_buff, sizeof(read_buff));
+    if (rc <= 0) {
+      printf("Failed to read cfg with read error: %s\n", strerror(errno));
+      return false;
     }
+    cli.feed(read_buff, rc);
   }
-  return false;
+  return true;
 }
 
 vector<string> tty_handler::read_cfg(string& cfg_file_path) {
@@ -177,9 +255,12 @@ vector<string> tty_handler::read_cfg(string& cfg_file_path) {
   if (cfg_stream.is_open()) {
     puts("Reading in config file");
     while(getline(cfg_stream, line)) {
+      // The CLI doesn't answer comments or empty lines
+      if(line.empty() || line[0] == '%' || line == "\r") {
+        continue;
+      }
       list_of_configs.push_back(line + '\r');
     }
-    puts("**** Done sending config  ****");
   } else {
     puts("Could not open stream!");
     assert(0);
@@ -187,96 +268,315 @@ vector<string> tty_handler::read_cfg(string& cfg_file_path) {
   return list_of_configs;
 }
 
-// reduce code duplication
+// Copies len bytes starting at ring position pos, taking care of the wrap
+void tty_handler::ring_copy(uint8_t* dst, size_t pos, size_t len) {
+  size_t offset = pos & TLV_RING_MASK;
+  size_t first  = (offset + len > TLV_RING_SIZE) ? TLV_RING_SIZE - offset : len;
 
-// Note, sometimes the radar gets stuck and repetivly returns 0,
-// A condition has been added to check for this, if we hit this clause
-// We will reset the USB FD for the radar
-#define READ_CHUNK() do {                                                  \
-      remainder = bytes_read - read_index;                                 \
-      max_read = (remainder >= to_read) ? to_read : remainder;             \
-      memcpy(tlv_buff + tlv_processed, &read_buff[read_index], max_read);  \
-      to_read       -= max_read;                                           \
-      read_index    += max_read;                                           \
-      tlv_processed += max_read;                                           \
-      if(to_read) {                                                        \
-        bytes_read = read_stream();                                        \
-        if(bytes_read == REQUEST_RESET){                                   \
-          return REQUEST_RESET;                                            \
-        }                                                                  \
-      }                                                                    \
-    } while(to_read);                                                      \
-
-#define RESET_LOGIC() do {      \
-      magic_matched = 0;        \
-      tlv_processed = 0;        \
-      state = STATE_FIND_MAGIC; \
-    } while(0);                 \
+  memcpy(dst, &ring[offset], first);
+  memcpy(dst + first, &ring[0], len - first);
+}
 
-int tty_handler::tty_read_frame() {
-  int magic_matched    = 0;  // how many of the magic start bytes we matched
-  size_t tlv_processed = 0;  // how much of the TLV we have currently read in
-  int state            = STATE_FIND_MAGIC; 
-  MmwDemo_output_message_header_t *ptr = NULL;
-  
-  size_t remainder;
-  size_t to_read;
-  size_t max_read;
+bool tty_handler::magic_at(size_t pos) const {
+  for(size_t i = 0; i < MAGIC_START_BYTES; i++) {
+    if(magic_key[i] != ring_at(pos + i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Walks whatever is buffered in the ring, returns true once a complete
+// frame is available through last_tlv. Never calls read().
+bool tty_handler::extract_frame() {
+  MmwDemo_output_message_header_t header;
 
   while(true) {
+    size_t available = ring_tail - ring_head;
+
     switch(state) {
       case STATE_FIND_MAGIC:
-        remainder = bytes_read - read_index;
-        if (remainder == 0) {
-          bytes_read = read_stream();
-          printf("read %d\n", bytes_read);
-          if(bytes_read == 0) { 
+        // Keep the last few bytes around, they might be the start of
+        // a magic word that straddles two reads
+        while(available >= MAGIC_START_BYTES) {
+          size_t offset = ring_head & TLV_RING_MASK;
+          size_t span   = (available < TLV_RING_SIZE - offset) ? available : TLV_RING_SIZE - offset;
+          size_t skip   = find_magic(&ring[offset], span);
+
+          ring_head           += skip;
+          available           -= skip;
+          stats.bytes_skipped += skip;
+          if(skip + MAGIC_START_BYTES <= span) {
+            state = STATE_READ_REST;
             break;
           }
-        }
 
-        while(read_index != bytes_read) {
-          if(magic_key[magic_matched] == read_buff[read_index]) {
-            magic_matched++;
-            if(MAGIC_START_BYTES == magic_matched) {
+          // The buffered data wraps, the magic word might straddle the
+          // end of the ring so check the last few positions by hand
+          if(span - skip == available) {
+            break;
+          }
+          while((ring_head & TLV_RING_MASK) && available >= MAGIC_START_BYTES) {
+            if(magic_at(ring_head)) {
               state = STATE_READ_REST;
-              read_index++;
               break;
             }
-          } else {
-            magic_matched = 0;
+            ring_head++;
+            available--;
+            stats.bytes_skipped++;
+          }
+          if(state == STATE_READ_REST) {
+            break;
           }
-          read_index++;
         }
         if(state != STATE_READ_REST) {
-          puts("Missed header");
-        } else {
-          printf("Found magic header\n");
-          tlv_processed = MAGIC_START_BYTES;
+          return false;
         }
         break;
       case STATE_READ_REST:
-        to_read = sizeof(MmwDemo_output_message_header) - MAGIC_START_BYTES;
-        READ_CHUNK()
-        
-        ptr = reinterpret_cast<MmwDemo_output_message_header_t*>(tlv_buff); 
-        to_read = ptr->totalPacketLen - sizeof(MmwDemo_output_message_header);
-        last_tlv_size = ptr->totalPacketLen;
-        if(to_read > MAX_TLV_SIZE - sizeof(MmwDemo_output_message_header)) {
+        if(available < sizeof(MmwDemo_output_message_header)) {
+          return false;
+        }
+        ring_copy(reinterpret_cast<uint8_t*>(&header), ring_head, sizeof(header));
+
+        if(header.totalPacketLen > MAX_TLV_SIZE || header.totalPacketLen < sizeof(MmwDemo_output_message_header)) {
           printf("Error: exceeded TLV size!\n");
-          RESET_LOGIC();
+          // Skip this magic word and hunt for the next one
+          ring_head++;
+          stats.bytes_skipped++;
+          state = STATE_FIND_MAGIC;
           break;
-        }       
+        }
+        if(available < header.totalPacketLen) {
+          return false;
+        }
+
+        // Only copy if the frame wrapped around the end of the ring
+        if((ring_head & TLV_RING_MASK) + header.totalPacketLen <= TLV_RING_SIZE) {
+          last_tlv = &ring[ring_head & TLV_RING_MASK];
+        } else {
+          ring_copy(wrap_buff, ring_head, header.totalPacketLen);
+          last_tlv = wrap_buff;
+          stats.bytes_copied += header.totalPacketLen;
+          stats.wrapped_frames++;
+        }
+        last_tlv_size        = header.totalPacketLen;
+        release_on_next_read = header.totalPacketLen;
+        state                = STATE_FIND_MAGIC;
+        return true;
+    }
+  }
+}
+
+bool tty_handler::tty_next_frame() {
+  // The caller is done with the last frame, hand its space back to read()
+  ring_head += release_on_next_read;
+  release_on_next_read = 0;
+
+  if(extract_frame()) {
+    stats.frames++;
+    last_frame_ms = tty_now_ms();
+    return true;
+  }
+  return false;
+}
+
+// Note, sometimes the radar gets stuck and repetivly returns 0,
+// A condition has been added to check for this, if we hit this clause
+// We will reset the USB FD for the radar
+int tty_handler::tty_read_frame() {
+  while(false == tty_next_frame()) {
+    if(REQUEST_RESET == read_stream()) {
+      return REQUEST_RESET;
+    }
+  }
+  return 0;
+}
+
+// Whatever the radar CLI prints once it is up and running (sensorStop
+// output, errors, ...), only logged
+void tty_handler::tty_read_cfg_output() {
+  char cli_buff[READ_BUFF_SIZE + 1] = { 0 };
+
+  int rc = read(cfg_port_fd, cli_buff, READ_BUFF_SIZE);
+  if(rc > 0) {
+    printf("Radar CLI: %s", cli_buff);
+  }
+}
+
+int tty_handler::tty_read_frame(int timeout_ms) {
+  if(timeout_ms < 0) {
+    return tty_read_frame();
+  }
+  double deadline = tty_now_ms() + timeout_ms;
+
+  while(false == tty_next_frame()) {
+    // Rounded up, poll() would otherwise return right away for the last
+    // fraction of a millisecond and we'd spin
+    double left = deadline - tty_now_ms();
+    if(left <= 0) {
+      return READ_TIMED_OUT;
+    }
+    int timeout = ceil(left);
 
-        printf("Will read %lu bytes on frame %d with [%d] TLVs", to_read, ptr->frameNumber, ptr->numTLVs);
-        READ_CHUNK();
-        return 0;
+    struct pollfd pfd = {data_port_fd, POLLIN, 0};
+    int rc = poll(&pfd, 1, timeout);
+    if(rc < 0 && EINTR != errno) {
+      printf("Failed to poll data port with error: %s\n", strerror(errno));
+      return REQUEST_RESET;
+    } else if(rc <= 0) {
+      continue;
     }
+
+    if(REQUEST_RESET == read_stream()) {
+      return REQUEST_RESET;
+    }
+  }
+  return 0;
+}
+
+bool tty_handler::tty_wait_frame(int timeout_ms) {
+  return 0 == tty_read_frame(timeout_ms);
+}
+
+void tty_handler::tty_flush() {
+  if(-1 != data_port_fd) {
+    tcflush(data_port_fd, TCIOFLUSH);
   }
+  if(-1 != cfg_port_fd) {
+    tcflush(cfg_port_fd, TCIOFLUSH);
+  }
+  ring_head              = ring_tail;
+  release_on_next_read   = 0;
+  state                  = STATE_FIND_MAGIC;
+  zero_len_reads_counter = 0;
+  last_frame_ms          = tty_now_ms();
+}
+
+int tty_handler::tty_stall_timeout_ms() {
+  if(0 == frame_period_ms) {
+    return -1;
+  }
+  double left = stall_deadline_ms() - tty_now_ms();
+  return (left > 0) ? (int)left + 1 : 0;
+}
+
+bool tty_handler::tty_stalled() {
+  if(0 == tty_stall_timeout_ms()) {
+    report_stall();
+    return true;
+  }
+  return false;
+}
+
+// Detection latency is measured from the last frame, the last byte tells
+// a silent radar apart from one sending garbage
+void tty_handler::report_stall() {
+  double now = tty_now_ms();
+  stats.stalls++;
+  printf("Data port stalled: no frame for %.1f ms, no data for %.1f ms (limit %d frames of %.1f ms)\n",
+    now - last_frame_ms, last_data_ms ? now - last_data_ms : -1.0, stall_missed_frames, frame_period_ms);
+}
+
+// Restarts the chirps without touching the cfg the radar holds
+bool tty_handler::tty_restart_sensor() {
+  if(-1 == cfg_port_fd) {
+    return false;
+  }
+  return tty_send_cfg_pipelined({"sensorStop\r", "sensorStart 0\r"});
+}
+
+vector<string> tty_handler::get_port_paths() {
+  vector<string> paths;
+  for(auto& port : _port_configs) {
+    paths.push_back(get<PORT_IN_TUPLE>(port));
+  }
+  return paths;
+}
+
+// Capture files stay open for the life of the process. The radar and the
+// sensor board are set up again on every recovery, the capture has to
+// keep the bytes that led up to it. Appends to what an earlier run left,
+// the header only goes into an empty file.
+static FILE* open_capture(const string& path, capture_source_e source) {
+  static std::mutex mutex;
+  static std::map<string, FILE*> open_captures;
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto it = open_captures.find(path);
+  if(it != open_captures.end()) {
+    return it->second;
+  }
+
+  FILE* fp = fopen(path.c_str(), "a");
+  if(!fp) {
+    printf("Failed to open capture file %s with errno: %s\n", path.c_str(), strerror(errno));
+    assert(0);
+  }
+  fseek(fp, 0, SEEK_END);
+  if(0 == ftell(fp)) {
+    capture_file_header header = {0};
+    strncpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = CAPTURE_VERSION;
+    header.source  = source;
+    fwrite(&header, sizeof(header), 1, fp);
+  }
+  printf("Capturing data port to %s\n", path.c_str());
+  open_captures[path] = fp;
+  return fp;
+}
+
+void tty_handler::enable_capture(const string& path, capture_source_e source) {
+  capture_fp = open_capture(path, source);
+}
+
+void tty_handler::capture_chunk(const uint8_t* chunk, size_t len) {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+
+  capture_record_header record;
+  record.monotonic_ns = tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+  record.len          = len;
+  fwrite(&record, sizeof(record), 1, capture_fp);
+  fwrite(chunk, 1, len, capture_fp);
+}
+
+// FNV-1a over every command we send
+uint64_t cfg_fingerprint(const vector<string>& cmds) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for(const auto& cmd : cmds) {
+    for(unsigned char c : cmd) {
+      hash = (hash ^ c) * 0x100000001b3ULL;
+    }
+  }
+  return hash;
+}
+
+bool cfg_cache_matches(uint64_t fingerprint) {
+  uint64_t cached = 0;
+  FILE* fp = fopen(env_or_default("RADAR_CFG_CACHE", CFG_CACHE_PATH).c_str(), "r");
+  if(!fp) {
+    return false;
+  }
+  bool valid = (1 == fscanf(fp, "%lx", &cached));
+  fclose(fp);
+  return valid && cached == fingerprint;
+}
+
+void cfg_cache_store(uint64_t fingerprint) {
+  FILE* fp = fopen(env_or_default("RADAR_CFG_CACHE", CFG_CACHE_PATH).c_str(), "w");
+  if(fp) {
+    fprintf(fp, "%lx\n", fingerprint);
+    fclose(fp);
+  }
+}
+
+// Call whenever the radar might have lost its config (USB reset, power...)
+void cfg_cache_invalidate() {
+  unlink(env_or_default("RADAR_CFG_CACHE", CFG_CACHE_PATH).c_str());
 }
 
-// This function does a hard reset of a USB port
-void usb_radar_reset(){
-  // TODO... don't hardcode paths
-  system("/opt/nvidia/deepstream/deepstream-6.0/sources/apps/scope-jetson/usb-reset/usbreset");
+string env_or_default(const char* env, const string& fallback) {
+  const char* value = getenv(env);
+  return value ? string(value) : fallback;
 }
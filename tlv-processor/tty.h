@@ -1,9 +1,12 @@
+#pragma once
+
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <termios.h>
 #include <stdint.h>
 #include <time.h>
+#include <poll.h>
 
 #include <iostream>
 #include <string>
@@ -13,10 +16,18 @@
 #include <regex>
 #include <fstream>
 
+#include "capture.h"
+#include "cli_matcher.h"
+
 #define MAX_TLV_READ_SIZE  (2048)
 #define MAGIC_START_BYTES  (8)
 #define MAX_TLV_SIZE       (1024*200)
 
+// Frames are assembled in place inside this ring, must be a power of two
+// and big enough to hold the largest frame plus a read chunk
+#define TLV_RING_SIZE      (1024*512)
+#define TLV_RING_MASK      (TLV_RING_SIZE - 1)
+
 #define IS_DATA_PORT (0)
 #define IS_CFG_PORT  (1)
 
@@ -26,9 +37,23 @@
 #define CFG_PATH_IN_TUPLE   (3)
 #define DESCIPLINE_IN_TUPLE (4)
 
+// Radar configuration: up to CFG_PIPELINE_DEPTH commands are in flight
+// before we wait for their acks, each ack must show up within
+// CFG_ACK_TIMEOUT_MS. The fingerprint of the last cfg applied is kept in
+// CFG_CACHE_PATH, if it matches the radar only gets restarted.
+#define CFG_PIPELINE_DEPTH (4)
+#define CFG_ACK_TIMEOUT_MS (2000)
+#define CFG_CACHE_PATH     "/tmp/radar_cfg.fingerprint"
+
 #define REQUEST_RESET      (-0xFFFF)
+#define READ_TIMED_OUT     (1)
 #define MAX_ZERO_LEN_READS (0xFF)
 
+// The data port is declared stalled once STALL_MISSED_FRAMES frame
+// periods (from frameCfg) went by without a complete frame. Ports
+// without a frameCfg only rely on MAX_ZERO_LEN_READS.
+#define STALL_MISSED_FRAMES (5)
+
 // From TI, header information 
 typedef struct MmwDemo_output_message_header_t {
     uint16_t    magicWord[4];
@@ -55,11 +80,29 @@ typedef struct {
 
 typedef enum { STATE_FIND_MAGIC, STATE_READ_REST } tlv_read_state_machine_e;
 
+typedef struct {
+  uint64_t frames;          // complete frames handed out
+  uint64_t bytes_read;      // bytes pulled off the data port
+  uint64_t bytes_copied;    // bytes copied out of the ring (only frames that wrap)
+  uint64_t wrapped_frames;  // frames that straddled the end of the ring
+  uint64_t bytes_skipped;   // garbage thrown away while looking for the magic word
+  uint64_t stalls;          // times no frame showed up before the deadline
+} tty_stats;
+
+static inline double tty_now_ms() {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return tp.tv_sec * 1000.0 + tp.tv_nsec / 1e6;
+}
+
+static_assert((TLV_RING_SIZE & TLV_RING_MASK) == 0, "TLV_RING_SIZE must be a power of two");
+static_assert(TLV_RING_SIZE >= MAX_TLV_SIZE + MAX_TLV_READ_SIZE, "TLV ring can't hold a full frame");
+
 class tty_handler {
  private:
   size_t _number_of_ports;
-  int data_port_fd;
-  int cfg_port_fd;
+  int data_port_fd{-1};
+  int cfg_port_fd{-1};
 
   std::vector<std::tuple<std::string, std::string, speed_t, std::string, int>> _port_configs;
   
@@ -75,34 +118,92 @@ class tty_handler {
   // Are little endian, the byte ordering needs to be swapped to come up 
   // with key_d
   static const inline uint8_t magic_key[] = {2,1,4,3,6,5,8,7};
-  uint8_t read_buff[MAX_TLV_READ_SIZE + 1];
-  uint8_t tlv_buff[MAX_TLV_SIZE + 1]; 
-  size_t read_index{0};
-  size_t remainder{0};
-  size_t last_tlv_size{0};
-  int    bytes_read{0};
-  int    zero_len_reads_counter{0};
+
+  // read() lands directly in the ring, complete frames are handed out
+  // in place. ring_head/ring_tail only ever grow, mask them to index.
+  // Anything between ring_head and ring_tail is owned by the parser,
+  // the rest of the ring is free for the next read()
+  uint8_t ring[TLV_RING_SIZE];
+  uint8_t wrap_buff[MAX_TLV_SIZE + 1];
+  size_t  ring_head{0};
+  size_t  ring_tail{0};
+  int     state{STATE_FIND_MAGIC};
+  uint8_t* last_tlv{nullptr};
+  size_t  last_tlv_size{0};
+  size_t  release_on_next_read{0};
+  int     zero_len_reads_counter{0};
+  tty_stats stats{};
+  FILE*   capture_fp{nullptr};
+  size_t  read_chunk_size{MAX_TLV_READ_SIZE};
+
+  // Stall detection, frame_period_ms == 0 turns it off
+  double  frame_period_ms{0};
+  int     stall_missed_frames{STALL_MISSED_FRAMES};
+  double  last_frame_ms{0};
+  double  last_data_ms{0};
+
+  double stall_deadline_ms() const { return last_frame_ms + frame_period_ms * stall_missed_frames; }
+  void report_stall();
 
   int read_stream() {
-    read_index = 0; 
-    int rc = read(data_port_fd, read_buff, MAX_TLV_READ_SIZE);  
-    if(0 == rc){
+    size_t offset     = ring_tail & TLV_RING_MASK;
+    size_t space      = TLV_RING_SIZE - (ring_tail - ring_head);
+    size_t contiguous = TLV_RING_SIZE - offset;
+    size_t to_read    = read_chunk_size;
+
+    if(to_read > space)      to_read = space;
+    if(to_read > contiguous) to_read = contiguous;
+    assert(to_read);
+
+    // Don't block past the deadline, VMIN=1 would wait forever. A signal
+    // only shortens the wait, any other poll error counts as a stall.
+    if(frame_period_ms > 0) {
+      struct pollfd pfd = {data_port_fd, POLLIN, 0};
+      int rc;
+      do {
+        int timeout = stall_deadline_ms() - tty_now_ms();
+        rc = timeout > 0 ? poll(&pfd, 1, timeout) : 0;
+      } while(-1 == rc && EINTR == errno);
+      if(rc <= 0) {
+        report_stall();
+        return REQUEST_RESET;
+      }
+    }
+
+    int rc = read(data_port_fd, &ring[offset], to_read);
+    if(rc <= 0){
       zero_len_reads_counter++;
     } else {
-      zero_len_reads_counter = 0;  
+      zero_len_reads_counter = 0;
+      if(capture_fp) {
+        capture_chunk(&ring[offset], rc);
+      }
+      ring_tail        += rc;
+      stats.bytes_read += rc;
+      last_data_ms      = tty_now_ms();
     }
-    
+
     if(zero_len_reads_counter > MAX_ZERO_LEN_READS){
       return REQUEST_RESET;
-    } 
-  
+    }
+
     return rc;
   }
 
+  uint8_t ring_at(size_t pos) const { return ring[pos & TLV_RING_MASK]; }
+  void capture_chunk(const uint8_t*, size_t);
+  bool magic_at(size_t pos) const;
+  void ring_copy(uint8_t* dst, size_t pos, size_t len);
+  bool extract_frame();
+
   void init_ports();
+  cli_matcher cli;
+  bool cfg_applied{true};
+
   void apply_cfg();
-  void tty_send_cfg(const std::string& cfg);
-  bool tty_check_done();
+  bool tty_send_cfg(const std::string& cfg);
+  bool tty_wait_ack(cli_ack_e& ack);
+  bool tty_send_cfg_pipelined(const std::vector<std::string>& cmds);
   std::vector<std::string> read_cfg(std::string&);
  
  public:
@@ -114,26 +215,85 @@ class tty_handler {
   // type is one of "IS_DATA_PORT" or "IS_CFG_PORT"
   tty_handler(std::vector<std::tuple<std::string, std::string, speed_t, std::string, int>>&);
 
+  // Parses frames out of an already open fd (file, pipe, memfd...), no
+  // line discipline or radar configuration is applied. Takes ownership of fd.
+  explicit tty_handler(int data_fd) : data_port_fd(data_fd) {}
+
   ~tty_handler(){
     printf("\n\n***Closing USB ports**\n\n");
-    if(data_port_fd){
+    if(-1 != data_port_fd){
       close(data_port_fd);
     }
-    if(cfg_port_fd){
+    if(-1 != cfg_port_fd){
       close(cfg_port_fd);
     }
+    // The capture outlives the handler, see enable_capture()
+    if(capture_fp){
+      fflush(capture_fp);
+    }
   }
  
   // Reads a single TLV from the stream
   int tty_read_frame();
 
+  // Same, giving up after timeout_ms (READ_TIMED_OUT), -1 waits forever
+  int tty_read_frame(int timeout_ms);
+
+  // Non-blocking building blocks for the event loop, tty_read_available()
+  // does a single read() on the data port and tty_next_frame() hands out
+  // the next complete frame already sitting in the ring (if any)
+  int  tty_read_available() { return read_stream(); }
+  bool tty_next_frame();
+  void tty_read_cfg_output();
+
+  // Recovery building blocks (see radar_recovery.h). tty_wait_frame()
+  // polls the data port for up to timeout_ms until a frame completes,
+  // tty_flush() drops everything buffered in the driver and the ring
+  bool tty_wait_frame(int timeout_ms);
+  void tty_flush();
+  bool tty_restart_sensor();
+
+  // false if the radar never acked its cfg
+  bool tty_cfg_applied() { return cfg_applied; }
+
+  // Stall detection for callers that don't go through read_stream()'s
+  // poll (the event loop). Milliseconds left before the data port counts
+  // as stalled, -1 if stall detection is off.
+  int  tty_stall_timeout_ms();
+  bool tty_stalled();
+  void set_stall_missed_frames(int frames) { stall_missed_frames = frames; }
+  void set_frame_period_ms(double period) { frame_period_ms = period; last_frame_ms = tty_now_ms(); }
+  std::vector<std::string> get_port_paths();
+
+  int get_data_fd() { return data_port_fd; }
+  int get_cfg_fd()  { return cfg_port_fd; }
+
+  // Points into the ring (or wrap_buff if the frame wrapped), only
+  // valid until the next call to tty_read_frame
   processed_tlv get_last_processed_tlv() { 
     processed_tlv ret;
-    ret.buff = tlv_buff;
+    ret.buff = last_tlv;
     ret.len  = last_tlv_size;
     return ret;
   }
+
+  tty_stats get_stats() { return stats; }
+
+  // Largest read() issued on the data port, defaults to MAX_TLV_READ_SIZE
+  void set_read_chunk_size(size_t size) { read_chunk_size = size; }
+
+  // Records every chunk read off the data port to path (see capture.h),
+  // appending to the file of an earlier handler or run
+  void enable_capture(const std::string& path, capture_source_e source);
 };
 
 // Helper functions
-void usb_radar_reset();
+// Config fingerprint cache, see CFG_CACHE_PATH
+uint64_t cfg_fingerprint(const std::vector<std::string>& cmds);
+bool     cfg_cache_matches(uint64_t fingerprint);
+void     cfg_cache_store(uint64_t fingerprint);
+void     cfg_cache_invalidate();
+
+// Returns the value of the environment variable or fallback if it isn't
+// set, lets the port paths be pointed at a replay pty
+std::string env_or_default(const char* env, const std::string& fallback);